@@ -0,0 +1,250 @@
+#define _POSIX_C_SOURCE 199309L  // clock_gettime
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// benchmarks every stage of plot() separately over synthetic data and
+// prints the results as json
+// usage: bench [max points] [output dir] - defaults to 1e7 and bin
+
+#define MIN_POINTS 1000
+#define DEFAULT_MAX_POINTS 10000000
+#define TARGET_POINTS 10000000  // points timed per size, spread over reps
+#define MAX_REPS 5
+
+enum
+{
+  STAGE_BOUNDS,
+  STAGE_BACKGROUND,
+  STAGE_GRID,
+  STAGE_TEXT,
+  STAGE_SCATTER,
+  STAGE_PACK,
+  STAGE_PNG,
+  STAGE_JPEG,
+  STAGE_COUNT,
+};
+
+static const char *stage_names[STAGE_COUNT] = {
+    "bounds", "background_border", "grid", "text",
+    "scatter", "rgb_pack", "png_write", "jpeg_write",
+};
+
+static double now_ns(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+#endif
+}
+
+// xorshift so runs are repeatable across platforms
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static double uniform(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double normal(void)
+{
+  double u = uniform(), v = uniform();
+  return sqrt(-2 * log(u + 1e-300)) * cos(2 * PI * v);
+}
+
+// DATA GENERATORS
+static void gen_uniform(float *x, float *y, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+  {
+    x[i] = (float)uniform();
+    y[i] = (float)uniform();
+  }
+}
+
+static void gen_clustered(float *x, float *y, size_t n)
+{
+  // eight gaussian blobs
+  float cx[8], cy[8];
+  for (int c = 0; c < 8; ++c)
+  {
+    cx[c] = (float)uniform();
+    cy[c] = (float)uniform();
+  }
+  for (size_t i = 0; i < n; ++i)
+  {
+    int c = (int)(uniform() * 8);
+    x[i] = cx[c] + 0.03f * (float)normal();
+    y[i] = cy[c] + 0.03f * (float)normal();
+  }
+}
+
+static void gen_random_walk(float *x, float *y, size_t n)
+{
+  double pos = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    pos += normal();
+    x[i] = (float)i;
+    y[i] = (float)pos;
+  }
+}
+
+static void gen_sorted(float *x, float *y, size_t n)
+{
+  // increasing x with jittered spacing, like sampled time
+  double t = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    t += 0.5 + uniform();
+    x[i] = (float)t;
+    y[i] = (float)uniform();
+  }
+}
+
+static void gen_nan_laden(float *x, float *y, size_t n)
+{
+  // uniform with 10% of the points missing a coordinate
+  gen_uniform(x, y, n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (uniform() < 0.05) { x[i] = NAN; }
+    else if (uniform() < 0.05) { y[i] = NAN; }
+  }
+}
+
+typedef struct
+{
+  const char *name;
+  void (*generate)(float *x, float *y, size_t n);
+} Distribution;
+
+static const Distribution distributions[] = {
+    {"uniform", gen_uniform},     {"clustered", gen_clustered},
+    {"random_walk", gen_random_walk}, {"sorted", gen_sorted},
+    {"nan_laden", gen_nan_laden},
+};
+
+static void run_once(float *x, float *y, size_t n, const char *png_path,
+                     const char *jpg_path, double *times)
+{
+  // one plot() worth of work with a timestamp between every stage
+  PlotArray xa = plot_array(x), ya = plot_array(y);
+  Canvas *c = plot_canvas();
+  double t0 = now_ns();
+  Bounds b = compute_bounds(xa, ya, n);
+  double t1 = now_ns();
+  draw_background(c, COLOR_GREY);
+  draw_border(c, COLOR_BLACK);
+  double t2 = now_ns();
+  draw_grid(c, COLOR_DARKGREY);
+  double t3 = now_ns();
+  add_text(c, "x-axis", "y-axis", "benchmark");
+  draw_ticks(c, b, true, COLOR_BLACK);
+  double t4 = now_ns();
+  plot_scatter(c, xa, ya, n, b, COLOR_PURPLE);
+  double t5 = now_ns();
+  uint8_t *rgb = pack_rgb(c);
+  double t6 = now_ns();
+  write_image(png_path, rgb);
+  double t7 = now_ns();
+  write_image(jpg_path, rgb);
+  double t8 = now_ns();
+  trace_free(rgb);
+
+  times[STAGE_BOUNDS] = t1 - t0;
+  times[STAGE_BACKGROUND] = t2 - t1;
+  times[STAGE_GRID] = t3 - t2;
+  times[STAGE_TEXT] = t4 - t3;
+  times[STAGE_SCATTER] = t5 - t4;
+  times[STAGE_PACK] = t6 - t5;
+  times[STAGE_PNG] = t7 - t6;
+  times[STAGE_JPEG] = t8 - t7;
+}
+
+int main(int argc, char **argv)
+{
+  size_t max_points = argc > 1 ? (size_t)atof(argv[1]) : DEFAULT_MAX_POINTS;
+  const char *out_dir = argc > 2 ? argv[2] : "bin";
+  char png_path[256], jpg_path[256];
+  snprintf(png_path, sizeof png_path, "%s/bench.png", out_dir);
+  snprintf(jpg_path, sizeof jpg_path, "%s/bench.jpg", out_dir);
+
+  float *x = malloc(max_points * sizeof(float));
+  float *y = malloc(max_points * sizeof(float));
+  if (x == NULL || y == NULL)
+  {
+    printf("ERROR: couldn't allocate %zu points\n", max_points);
+    return 1;
+  }
+  grid(GRID_DENSITY);
+
+  printf("{\n  \"width\": %d,\n  \"height\": %d,\n  \"results\": [", WIDTH,
+         HEIGHT);
+  const char *sep = "\n";
+  size_t n_dists = sizeof distributions / sizeof distributions[0];
+  for (size_t d = 0; d < n_dists; ++d)
+  {
+    for (size_t n = MIN_POINTS; n <= max_points; n *= 10)
+    {
+      distributions[d].generate(x, y, n);
+      int reps = (int)(TARGET_POINTS / n);
+      if (reps < 1) { reps = 1; }
+      if (reps > MAX_REPS) { reps = MAX_REPS; }
+
+      double best[STAGE_COUNT], total[STAGE_COUNT] = {0};
+      for (int s = 0; s < STAGE_COUNT; ++s) { best[s] = INFINITY; }
+      for (int r = 0; r < reps; ++r)
+      {
+        double times[STAGE_COUNT];
+        run_once(x, y, n, png_path, jpg_path, times);
+        for (int s = 0; s < STAGE_COUNT; ++s)
+        {
+          total[s] += times[s];
+          if (times[s] < best[s]) { best[s] = times[s]; }
+        }
+      }
+
+      printf("%s    {\"distribution\": \"%s\", \"n\": %zu, \"reps\": %d, ",
+             sep, distributions[d].name, n, reps);
+      printf("\"points_per_sec\": %.0f,\n     \"min_ns\": {",
+             n / ((best[STAGE_BOUNDS] + best[STAGE_SCATTER]) * 1e-9));
+      for (int s = 0; s < STAGE_COUNT; ++s)
+      {
+        printf("%s\"%s\": %.0f", s ? ", " : "", stage_names[s], best[s]);
+      }
+      printf("},\n     \"mean_ns\": {");
+      for (int s = 0; s < STAGE_COUNT; ++s)
+      {
+        printf("%s\"%s\": %.0f", s ? ", " : "", stage_names[s],
+               total[s] / reps);
+      }
+      printf("}}");
+      fflush(stdout);
+      sep = ",\n";
+    }
+  }
+  printf("\n  ]\n}\n");
+  free(x);
+  free(y);
+  return 0;
+}
@@ -0,0 +1,791 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// batch rendering - a manifest of charts, one json object per line, drawn
+// over a pool of threads. every line is checked before anything is drawn,
+// so a bad manifest stops the batch without writing a file. every worker
+// keeps its own canvas, rgb buffer and data buffers from chart to chart,
+// so after the first few a chart costs its drawing and encoding and no
+// setting up. with the settings being per thread a worker parses a line by
+// calling the same setting functions a program would, and draws and
+// encodes each chart on its own thread - the pool is the parallelism. the
+// lines are dealt out in one run per worker, which takes from the front of
+// its run, and a worker that runs out steals the back half of someone
+// else's - long charts and short ones even out without the workers
+// queueing on one counter
+
+#define BATCH_STRING_MAX 260  // paths, labels are held to less
+
+static const size_t type_size[] = {
+    [PLOT_F32] = 4, [PLOT_F64] = 8, [PLOT_I32] = 4, [PLOT_I64] = 8,
+    [PLOT_U16] = 2,
+};
+
+typedef struct
+{
+  const char *at;     // where parsing has got to, the line ends at a '\n'
+  const char *start;  // the whole manifest, to count lines for errors
+} Reader;
+
+typedef struct
+{
+  PanelKind kind;
+  char path[BATCH_STRING_MAX];
+  char x[BATCH_STRING_MAX], y[BATCH_STRING_MAX];  // column files, "" if none
+  PlotType x_type, y_type;
+  int bins;
+} BatchJob;
+
+typedef struct
+{
+  uint8_t *data;
+  size_t cap;
+} Column;
+
+typedef struct
+{
+  Canvas canvas;    // buffers for the scale last drawn at, 0 for none yet
+  Palette palette;  // the canvas' with indexed_colour() on
+  uint8_t *rgb;     // pack_rgb_into() scratch
+  Column x, y;
+} BatchWorker;
+
+typedef struct
+{
+  atomic_uint_fast64_t range;  // jobs [begin, end) as begin << 32 | end
+  char pad[64 - sizeof(atomic_uint_fast64_t)];  // a cache line each
+} JobRun;
+
+typedef struct
+{
+  const char *manifest;
+  const size_t *starts;  // offset of each job's line
+  const int *lines;      // and its line number, for errors
+  size_t jobs;
+  const PlotSettings *settings;  // the caller's plus indexed_colour(true),
+                                 // what every job starts from
+  JobRun *runs;
+  int workers;
+  atomic_int next_worker;
+  atomic_size_t written;
+  atomic_size_t failed;
+} Batch;
+
+static int manifest_line(const char *start, const char *at)
+{
+  int line = 1;
+  for (; start < at; ++start) { line += *start == '\n'; }
+  return line;
+}
+
+static void manifest_error(const Reader *r, const char *what)
+{
+  printf("ERROR: manifest line %d: %s\n", manifest_line(r->start, r->at),
+         what);
+  exit(1);
+}
+
+static void skip_space(Reader *r)
+{
+  while (*r->at == ' ' || *r->at == '\t' || *r->at == '\r') { ++r->at; }
+}
+
+static bool accept(Reader *r, char ch)
+{
+  skip_space(r);
+  if (*r->at != ch) { return false; }
+  ++r->at;
+  return true;
+}
+
+static void expect(Reader *r, char ch)
+{
+  if (!accept(r, ch))
+  {
+    char what[32];
+    snprintf(what, sizeof what, "expected '%c'", ch);
+    manifest_error(r, what);
+  }
+}
+
+static void read_string(Reader *r, char *out, size_t cap)
+{
+  // a json string, escapes and all. only ascii \u escapes, labels are drawn
+  // with an ascii font anyway
+  expect(r, '"');
+  size_t len = 0;
+  for (;;)
+  {
+    char ch = *r->at++;
+    if (ch == '"') { break; }
+    if (ch == '\n' || ch == '\0') { manifest_error(r, "unterminated string"); }
+    if (ch == '\\')
+    {
+      ch = *r->at++;
+      switch (ch)
+      {
+      case 'n': ch = '\n'; break;
+      case 't': ch = '\t'; break;
+      case 'r': ch = '\r'; break;
+      case 'b': ch = '\b'; break;
+      case 'f': ch = '\f'; break;
+      case '"': case '\\': case '/': break;
+      case 'u':
+      {
+        char hex[5] = {0};
+        for (int i = 0; i < 4 && r->at[i] != '\n' && r->at[i] != '\0'; ++i)
+        {
+          hex[i] = r->at[i];
+        }
+        char *end;
+        long code = strtol(hex, &end, 16);
+        if (end != hex + 4 || code <= 0 || code > 127)
+        {
+          manifest_error(r, "only ascii \\u escapes are supported");
+        }
+        ch = (char)code;
+        r->at += 4;
+        break;
+      }
+      default: manifest_error(r, "bad escape in string");
+      }
+    }
+    if (len + 1 >= cap) { manifest_error(r, "string is too long"); }
+    out[len++] = ch;
+  }
+  out[len] = '\0';
+}
+
+static double read_number(Reader *r)
+{
+  // null reads as NaN, which is what the limits use for automatic
+  skip_space(r);
+  if (strncmp(r->at, "null", 4) == 0)
+  {
+    r->at += 4;
+    return NAN;
+  }
+  char *end;
+  double v = strtod(r->at, &end);
+  if (end == r->at) { manifest_error(r, "expected a number"); }
+  r->at = end;
+  return v;
+}
+
+static int read_int(Reader *r)
+{
+  double v = read_number(r);
+  if (!(v == floor(v) && fabs(v) <= INT32_MAX))
+  {
+    manifest_error(r, "expected a whole number");
+  }
+  return (int)v;
+}
+
+static bool read_bool(Reader *r)
+{
+  skip_space(r);
+  if (strncmp(r->at, "true", 4) == 0)
+  {
+    r->at += 4;
+    return true;
+  }
+  if (strncmp(r->at, "false", 5) == 0)
+  {
+    r->at += 5;
+    return false;
+  }
+  manifest_error(r, "expected true or false");
+  return false;
+}
+
+static int read_choice(Reader *r, const char *const *names, int count,
+                       const char *what)
+{
+  // the index of the string read among names
+  char name[16];
+  read_string(r, name, sizeof name);
+  for (int i = 0; i < count; ++i)
+  {
+    if (strcmp(name, names[i]) == 0) { return i; }
+  }
+  char message[64];
+  snprintf(message, sizeof message, "unknown %s \"%s\"", what, name);
+  manifest_error(r, message);
+  return 0;
+}
+
+static void read_label(Reader *r, void (*set)(const char *))
+{
+  char text[40];
+  read_string(r, text, sizeof text);
+  set(text);
+}
+
+static void read_limits(Reader *r, void (*set)(double, double))
+{
+  // [min, max], null for an automatic end
+  expect(r, '[');
+  double min = read_number(r);
+  expect(r, ',');
+  double max = read_number(r);
+  expect(r, ']');
+  set(min, max);
+}
+
+static PlotType read_type(Reader *r)
+{
+  static const char *const names[] = {"f32", "f64", "i32", "i64", "u16"};
+  static const PlotType types[] = {PLOT_F32, PLOT_F64, PLOT_I32, PLOT_I64,
+                                   PLOT_U16};
+  return types[read_choice(r, names, 5, "type")];
+}
+
+static bool svg_path(const char *path)
+{
+  size_t len = strlen(path);
+  return len >= 4 && strcmp(path + len - 4, ".svg") == 0;
+}
+
+static void read_field(Reader *r, const char *key, BatchJob *job)
+{
+  // one "key": value, applied as it's read. keys are named after the
+  // functions that set the same thing
+  static const char *const kinds[] = {"plot", "hist", "bars"};
+  static const char *const scales[] = {"linear", "log", "symlog"};
+  static const char *const markers[] = {"square", "circle",  "cross",
+                                        "plus",   "diamond", "pixel"};
+  static const char *const units[] = {"off", "s", "ms", "us", "ns"};
+  if (strcmp(key, "path") == 0)
+  {
+    read_string(r, job->path, sizeof job->path);
+    if (image_format(job->path) == NULL && !svg_path(job->path))
+    {
+      manifest_error(r, "path needs to end in .png, .jpg, .bmp, .ppm, "
+                        ".rgba, .qoi or .svg");
+    }
+  }
+  else if (strcmp(key, "kind") == 0)
+  {
+    static const PanelKind kind[] = {PANEL_POINTS, PANEL_HIST, PANEL_BARS};
+    job->kind = kind[read_choice(r, kinds, 3, "kind")];
+  }
+  else if (strcmp(key, "x") == 0) { read_string(r, job->x, sizeof job->x); }
+  else if (strcmp(key, "y") == 0) { read_string(r, job->y, sizeof job->y); }
+  else if (strcmp(key, "x_type") == 0) { job->x_type = read_type(r); }
+  else if (strcmp(key, "y_type") == 0) { job->y_type = read_type(r); }
+  else if (strcmp(key, "bins") == 0) { job->bins = read_int(r); }
+  else if (strcmp(key, "title") == 0) { read_label(r, title); }
+  else if (strcmp(key, "xlabel") == 0) { read_label(r, xlabel); }
+  else if (strcmp(key, "ylabel") == 0) { read_label(r, ylabel); }
+  else if (strcmp(key, "grid") == 0) { grid(read_int(r)); }
+  else if (strcmp(key, "colour") == 0)
+  {  // a number, or a string so it can be written in hex
+    skip_space(r);
+    if (*r->at == '"')
+    {
+      char text[16], *end;
+      read_string(r, text, sizeof text);
+      unsigned long c = strtoul(text, &end, 0);
+      if (*end != '\0' || c > 0xFFFFFFFFul)
+      {
+        manifest_error(r, "colour should look like \"0xFF0000FF\"");
+      }
+      colour((Colour32)c);
+    }
+    else
+    {
+      double c = read_number(r);
+      if (!(c == floor(c) && c >= 0 && c <= 0xFFFFFFFFu))
+      {
+        manifest_error(r, "colour should be a whole number from 0 to "
+                          "0xFFFFFFFF");
+      }
+      colour((Colour32)c);
+    }
+  }
+  else if (strcmp(key, "alpha") == 0) { alpha((float)read_number(r)); }
+  else if (strcmp(key, "marker") == 0)
+  {
+    marker((Marker)read_choice(r, markers, 6, "marker"), point_size);
+  }
+  else if (strcmp(key, "marker_size") == 0)
+  {
+    marker(point_shape, read_int(r));
+  }
+  else if (strcmp(key, "antialias") == 0) { antialias(read_int(r)); }
+  else if (strcmp(key, "indexed_colour") == 0)
+  {
+    indexed_colour(read_bool(r));
+  }
+  else if (strcmp(key, "xscale") == 0)
+  {
+    xscale((AxisScale)read_choice(r, scales, 3, "scale"));
+  }
+  else if (strcmp(key, "yscale") == 0)
+  {
+    yscale((AxisScale)read_choice(r, scales, 3, "scale"));
+  }
+  else if (strcmp(key, "symlog_threshold") == 0)
+  {
+    symlog_threshold(read_number(r));
+  }
+  else if (strcmp(key, "sorted_x") == 0) { sorted_x(read_bool(r)); }
+  else if (strcmp(key, "xlim") == 0) { read_limits(r, xlim); }
+  else if (strcmp(key, "ylim") == 0) { read_limits(r, ylim); }
+  else if (strcmp(key, "time_axis") == 0)
+  {
+    time_axis((TimeUnit)read_choice(r, units, 5, "time unit"));
+  }
+  else
+  {
+    char message[BATCH_STRING_MAX + 32];
+    snprintf(message, sizeof message, "unknown key \"%s\"", key);
+    manifest_error(r, message);
+  }
+}
+
+static void parse_job(Reader *r, BatchJob *job)
+{
+  // a flat json object, fields take effect in the order they're written
+  *job = (BatchJob){.kind = PANEL_POINTS, .x_type = PLOT_F64,
+                    .y_type = PLOT_F64};
+  expect(r, '{');
+  if (!accept(r, '}'))
+  {
+    do
+    {
+      char key[BATCH_STRING_MAX];
+      read_string(r, key, sizeof key);
+      expect(r, ':');
+      read_field(r, key, job);
+    } while (accept(r, ','));
+    expect(r, '}');
+  }
+  skip_space(r);
+  if (*r->at != '\n' && *r->at != '\0')
+  {
+    manifest_error(r, "one object per line, nothing after it");
+  }
+  if (job->path[0] == '\0') { manifest_error(r, "every chart needs a path"); }
+  bool wants_x = job->kind == PANEL_HIST, wants_y = job->kind != PANEL_HIST;
+  if ((wants_x && job->x[0] == '\0') || (wants_y && job->y[0] == '\0'))
+  {
+    manifest_error(r, job->kind == PANEL_HIST
+                          ? "a hist needs an x column file"
+                          : "a plot or bars needs a y column file");
+  }
+}
+
+static bool load_column(const char *path, PlotType type, Column *c,
+                        PlotArray *out, size_t *n)
+{
+  // the whole file into the worker's buffer, grown when it's too small
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) { return false; }
+  long bytes = -1;
+  if (fseek(f, 0, SEEK_END) == 0) { bytes = ftell(f); }
+  if (bytes < 0 || fseek(f, 0, SEEK_SET) != 0)
+  {
+    fclose(f);
+    return false;
+  }
+  if ((size_t)bytes > c->cap)
+  {
+    uint8_t *grown = trace_realloc(c->data, bytes);
+    if (grown == NULL)
+    {
+      printf("ERROR: not enough memory for %s\n", path);
+      exit(1);
+    }
+    c->data = grown;
+    c->cap = bytes;
+  }
+  bool ok = fread(c->data, 1, bytes, f) == (size_t)bytes;
+  fclose(f);
+  *out = (PlotArray){.data = c->data, .stride = type_size[type],
+                     .type = type};
+  *n = bytes / type_size[type];
+  return ok;
+}
+
+static void index_column(Column *c, size_t n, PlotArray *out)
+{
+  // 0 to n - 1 for a plot given no x
+  if (n * sizeof(double) > c->cap)
+  {
+    uint8_t *grown = trace_realloc(c->data, n * sizeof(double));
+    if (grown == NULL)
+    {
+      printf("ERROR: not enough memory for a chart's x values\n");
+      exit(1);
+    }
+    c->data = grown;
+    c->cap = n * sizeof(double);
+  }
+  double *x = (double *)c->data;
+  for (size_t i = 0; i < n; ++i) { x[i] = (double)i; }
+  *out = plot_array(x);
+}
+
+static Canvas *worker_canvas(BatchWorker *w, bool svg)
+{
+  // the worker's canvas for the current settings, like plot_canvas(). the
+  // buffers last until the antialias factor changes, and are made as
+  // they're needed
+  const int s = svg ? 1 : aa_scale;
+  Canvas *c = &w->canvas;
+  if (c->scale != s)
+  {
+    trace_free(c->pixels);
+    trace_free(c->counts);
+    trace_free(c->indices);
+    *c = (Canvas){
+        .width = WIDTH * s,
+        .height = HEIGHT * s,
+        .stride = WIDTH * s,
+        .scale = s,
+    };
+    frame_canvas(c, image_frame());
+  }
+  c->svg = NULL;
+  c->palette = NULL;
+  if (indexed_on && !svg)
+  {
+    if (c->indices == NULL)
+    {
+      c->indices = trace_malloc((size_t)c->stride * c->height);
+      if (c->indices == NULL)
+      {
+        printf("ERROR: not enough memory for a batch worker\n");
+        exit(1);
+      }
+    }
+    palette_reset(&w->palette);
+    c->palette = &w->palette;
+  }
+  else { canvas_pixels(c); }
+  return c;
+}
+
+static bool save_chart(BatchWorker *w, Canvas *c, const char *path)
+{
+  // save_image_as_png() without the message, packed into the worker's
+  // buffer rather than a new one. false if the file couldn't be written
+  if (c->svg != NULL) { return svg_close(c, point_shape, series_colour) > 0; }
+  const ImageFormat *f = image_format(path);
+  if (canvas_indexed(c) && c->scale == 1 && f->encode_indexed != NULL)
+  {
+    return write_indexed_image(path, c->indices, c->palette) != NULL;
+  }
+  pack_rgb_into(c, w->rgb);
+  return write_image(path, w->rgb) != NULL;
+}
+
+static Panel job_panel(const BatchJob *job, PlotArray x, size_t nx,
+                       PlotArray y, size_t ny)
+{
+  // the panel a job draws from its columns
+  Panel panel = {.kind = job->kind, .bins = job->bins};
+  if (job->kind == PANEL_HIST)
+  {
+    panel.x = x;
+    panel.n = nx;
+  }
+  else if (job->kind == PANEL_BARS)
+  {  // bars keep their heights in x, like plot_bars()
+    panel.x = y;
+    panel.n = ny;
+  }
+  else
+  {
+    panel.x = x;
+    panel.y = y;
+    panel.n = nx < ny ? nx : ny;  // the shorter column sets the count
+  }
+  return panel;
+}
+
+static bool run_job(const Batch *b, BatchWorker *w, size_t i)
+{
+  // parses and draws line i of the manifest, already checked. a chart whose
+  // data can't be read or file can't be written is reported and skipped
+  uint64_t plot_start = trace_begin();
+  settings_load(b->settings);
+  Reader r = {b->manifest + b->starts[i], b->manifest};
+  BatchJob job;
+  parse_job(&r, &job);
+
+  PlotArray x, y;
+  size_t nx = 0, ny = 0;
+  const char *unread = NULL;
+  if (job.x[0] != '\0' && !load_column(job.x, job.x_type, &w->x, &x, &nx))
+  {
+    unread = job.x;
+  }
+  if (job.y[0] != '\0' && !load_column(job.y, job.y_type, &w->y, &y, &ny))
+  {
+    unread = job.y;
+  }
+  if (unread != NULL)
+  {
+    printf("ERROR: manifest line %d: couldn't read %s\n", b->lines[i],
+           unread);
+    return false;
+  }
+  if (job.kind == PANEL_POINTS && job.x[0] == '\0')
+  {
+    index_column(&w->x, ny, &x);
+    nx = ny;
+  }
+  Panel panel = job_panel(&job, x, nx, y, ny);
+
+  bool svg = svg_path(job.path);
+  Canvas *c = worker_canvas(w, svg);
+  if (svg) { c->svg = svg_open(job.path, WIDTH, HEIGHT); }
+  bool ok = !svg || c->svg != NULL;
+  if (ok)
+  {
+    draw_panel(c, &panel);
+    ok = save_chart(w, c, job.path);
+  }
+  if (!ok)
+  {
+    printf("ERROR: manifest line %d: couldn't write %s - check the folder "
+           "exists\n",
+           b->lines[i], job.path);
+  }
+  trace_end(TRACE_PLOT, plot_start);
+  return ok;
+}
+
+static bool take(JobRun *run, size_t *job)
+{
+  // the front job of a run, false if it's empty
+  uint_fast64_t range = atomic_load(&run->range);
+  for (;;)
+  {
+    uint32_t begin = (uint32_t)(range >> 32), end = (uint32_t)range;
+    if (begin >= end) { return false; }
+    uint_fast64_t rest = (uint_fast64_t)(begin + 1) << 32 | end;
+    if (atomic_compare_exchange_weak(&run->range, &range, rest))
+    {
+      *job = begin;
+      return true;
+    }
+  }
+}
+
+static bool steal(Batch *b, int self)
+{
+  // moves the back half of another worker's run into this one's, which is
+  // empty, false once every run is. jobs only ever leave a run that isn't
+  // its owner's while it has any, so empty runs all round means every job
+  // has been taken by someone
+  for (int k = 1; k < b->workers; ++k)
+  {
+    JobRun *victim = &b->runs[(self + k) % b->workers];
+    uint_fast64_t range = atomic_load(&victim->range);
+    for (;;)
+    {
+      uint32_t begin = (uint32_t)(range >> 32), end = (uint32_t)range;
+      if (begin >= end) { break; }
+      uint32_t split = end - (end - begin + 1) / 2;
+      uint_fast64_t kept = (uint_fast64_t)begin << 32 | split;
+      if (atomic_compare_exchange_weak(&victim->range, &range, kept))
+      {
+        atomic_store(&b->runs[self].range, (uint_fast64_t)split << 32 | end);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void *batch_worker(void *arg)
+{
+  // works through its own run, then whatever it can steal
+  Batch *b = arg;
+  int self = atomic_fetch_add(&b->next_worker, 1);
+  BatchWorker w = {0};
+  const int hist_threads = hist_thread_count;
+  hist_thread_count = 1;  // the other workers have the other cores
+  w.rgb = trace_malloc((size_t)WIDTH * HEIGHT * CHANNEL_NUM);
+  if (w.rgb == NULL)
+  {
+    printf("ERROR: not enough memory for a batch worker\n");
+    exit(1);
+  }
+  size_t job;
+  for (;;)
+  {
+    if (!take(&b->runs[self], &job))
+    {
+      if (steal(b, self)) { continue; }
+      break;
+    }
+    if (run_job(b, &w, job)) { atomic_fetch_add(&b->written, 1); }
+    else { atomic_fetch_add(&b->failed, 1); }
+  }
+  hist_thread_count = hist_threads;
+  trace_free(w.canvas.pixels);
+  trace_free(w.canvas.counts);
+  trace_free(w.canvas.indices);
+  trace_free(w.rgb);
+  trace_free(w.x.data);
+  trace_free(w.y.data);
+  return NULL;
+}
+
+static char *read_manifest(const char *path)
+{
+  // the whole file with a '\0' after it
+  FILE *f = fopen(path, "rb");
+  long bytes = -1;
+  if (f != NULL && fseek(f, 0, SEEK_END) == 0) { bytes = ftell(f); }
+  if (bytes < 0 || fseek(f, 0, SEEK_SET) != 0)
+  {
+    printf("ERROR: couldn't read the manifest %s\n", path);
+    exit(1);
+  }
+  char *text = trace_malloc((size_t)bytes + 1);
+  if (text == NULL)
+  {
+    printf("ERROR: not enough memory for the manifest %s\n", path);
+    exit(1);
+  }
+  if (fread(text, 1, bytes, f) != (size_t)bytes)
+  {
+    printf("ERROR: couldn't read the manifest %s\n", path);
+    exit(1);
+  }
+  fclose(f);
+  text[bytes] = '\0';
+  return text;
+}
+
+static void check_manifest(const char *text, const size_t *starts,
+                           size_t jobs, const PlotSettings *settings)
+{
+  // parses every line and checks its chart can be drawn with its settings,
+  // stopping at the first that can't. nothing is read or written
+  char message[80];
+  for (size_t i = 0; i < jobs; ++i)
+  {
+    settings_load(settings);
+    Reader r = {text + starts[i], text};
+    BatchJob job;
+    parse_job(&r, &job);
+    PlotArray x = {.type = job.x[0] != '\0' ? job.x_type : PLOT_F64};
+    PlotArray y = {.type = job.y_type};
+    Panel panel = job_panel(&job, x, 0, y, 0);
+    if (panel_problem(&panel, message, sizeof message))
+    {
+      manifest_error(&r, message);
+    }
+  }
+}
+
+size_t plot_batch(const char *manifest, int threads)
+{
+  // every chart in the manifest over the threads (0 for one per core),
+  // each starting from the settings in effect now with indexed_colour() on.
+  // charts that can't be read or written are skipped, returns how many
+  // were written
+  subplot_check("plot_batch()");
+  char *text = read_manifest(manifest);
+  size_t jobs = 0, cap = 0;
+  size_t *starts = NULL;
+  int *lines = NULL;
+  int line_number = 1;
+  for (const char *line = text; *line != '\0'; ++line_number)
+  {
+    const char *end = strchr(line, '\n');
+    if (end == NULL) { end = line + strlen(line); }
+    if (strspn(line, " \t\r") < (size_t)(end - line))
+    {  // blank lines are skipped
+      if (jobs == cap)
+      {
+        cap = cap ? 2 * cap : 256;
+        starts = trace_realloc(starts, cap * sizeof *starts);
+        lines = trace_realloc(lines, cap * sizeof *lines);
+        if (starts == NULL || lines == NULL)
+        {
+          printf("ERROR: not enough memory for the manifest %s\n", manifest);
+          exit(1);
+        }
+      }
+      starts[jobs] = line - text;
+      lines[jobs++] = line_number;
+    }
+    line = *end == '\n' ? end + 1 : end;
+  }
+  if (jobs >= UINT32_MAX)
+  {
+    printf("ERROR: a manifest can have at most %u charts\n", UINT32_MAX - 1);
+    exit(1);
+  }
+  if (threads < 1) { threads = cpu_count(); }
+  if ((size_t)threads > jobs) { threads = jobs > 0 ? (int)jobs : 1; }
+
+  PlotSettings settings;
+  settings_save(&settings);
+  PlotSettings own = settings;
+  // the same image either way, and palette pngs encode many times quicker
+  settings.indexed_on = true;
+  settings.jpeg_thread_count = 1;  // the other workers have the other cores
+  check_manifest(text, starts, jobs, &settings);
+  Batch b = {.manifest = text, .starts = starts, .lines = lines,
+             .jobs = jobs, .settings = &settings, .workers = threads};
+  b.runs = trace_malloc(threads * sizeof *b.runs);
+  pthread_t *workers = trace_malloc(threads * sizeof *workers);
+  if (b.runs == NULL || workers == NULL)
+  {
+    printf("ERROR: not enough memory for the batch\n");
+    exit(1);
+  }
+  for (int i = 0; i < threads; ++i)
+  {  // an even share each to start with
+    uint_fast64_t begin = jobs * i / threads, end = jobs * (i + 1) / threads;
+    atomic_init(&b.runs[i].range, begin << 32 | end);
+  }
+  atomic_init(&b.next_worker, 0);
+  atomic_init(&b.written, 0);
+  atomic_init(&b.failed, 0);
+  int started = 0;
+  for (; started < threads - 1; ++started)
+  {
+    if (pthread_create(&workers[started], NULL, batch_worker, &b) != 0)
+    {  // fewer threads is fine, the runs left without one get stolen
+      break;
+    }
+  }
+  batch_worker(&b);
+  for (int i = 0; i < started; ++i) { pthread_join(workers[i], NULL); }
+  settings_load(&own);  // this thread drew charts with theirs
+
+  size_t written = atomic_load(&b.written);
+  size_t failed = atomic_load(&b.failed);
+  trace_free(workers);
+  trace_free(b.runs);
+  trace_free(starts);
+  trace_free(lines);
+  trace_free(text);
+  if (failed > 0)
+  {
+    printf("-- %zu charts from %s saved, %zu skipped --\n", written,
+           manifest, failed);
+  }
+  else { printf("-- %zu charts from %s saved --\n", written, manifest); }
+  return written;
+}
@@ -0,0 +1,298 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// translucent series are stamped as hit counts and blended once at the end.
+// k points of one colour with alpha a drawn source-over on top of each
+// other cover a pixel by 1 - (1 - a)^k, so the count alone gives the exact
+// result of blending them one at a time.
+
+// even at alpha 1/255 a pixel is opaque after ~1600 hits
+#define COVERAGE_LUT_SIZE 2048
+
+static int build_weights(uint8_t *weights, unsigned alpha)
+{
+  // weights[k] = 255 * coverage of k hits, returns the first k where it
+  // reaches 255 (everything past that is opaque too)
+  double a = alpha / 255.0, remaining = 1;
+  weights[0] = 0;
+  for (int k = 1; k < COVERAGE_LUT_SIZE; ++k)
+  {
+    remaining *= 1 - a;
+    int w = (int)(255 * (1 - remaining) + 0.5);
+    weights[k] = (uint8_t)w;
+    if (w >= 255) { return k; }
+  }
+  return COVERAGE_LUT_SIZE - 1;
+}
+
+static inline Colour32 blend(Colour32 dst, Colour32 src, unsigned w)
+{
+  // per channel (src * w + dst * (255 - w)) / 255, rounded
+  Colour32 out = 0xFF000000;
+  for (int shift = 0; shift < 24; shift += 8)
+  {
+    unsigned s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+    unsigned v = s * w + d * (255 - w) + 128;
+    out |= ((v + (v >> 8)) >> 8) << shift;
+  }
+  return out;
+}
+
+void resolve_coverage(Colour32 *pixels, uint16_t *counts, int stride,
+                      Rect area, Colour32 colour)
+{
+  // blends colour into every pixel of area by its hit count, zeroing the
+  // counts on the way so the buffer is ready for the next series
+  uint8_t weights[COVERAGE_LUT_SIZE];
+  int opaque_from = build_weights(weights, colour >> 24);
+
+  for (int y = area.y0; y <= area.y1; ++y)
+  {
+    Colour32 *row = pixels + (ptrdiff_t)y * stride;
+    uint16_t *hits = counts + (ptrdiff_t)y * stride;
+    int x = area.x0;
+#ifdef __SSE2__
+    // four pixels at a time - widen to 16 bits, mix, divide by 255
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i all = _mm_set1_epi16(255);
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)colour), zero);
+    for (; x + 3 <= area.x1; x += 4)
+    {
+      uint64_t four;
+      memcpy(&four, hits + x, sizeof four);
+      if (four == 0) { continue; }  // common case away from the data
+      unsigned w[4];
+      for (int i = 0; i < 4; ++i)
+      {
+        unsigned k = hits[x + i];
+        w[i] = weights[k < (unsigned)opaque_from ? k : (unsigned)opaque_from];
+      }
+      memset(hits + x, 0, 4 * sizeof *hits);
+
+      __m128i dst = _mm_loadu_si128((const __m128i *)(row + x));
+      __m128i w_lo = _mm_set_epi16(w[1], w[1], w[1], w[1], w[0], w[0], w[0],
+                                   w[0]);
+      __m128i w_hi = _mm_set_epi16(w[3], w[3], w[3], w[3], w[2], w[2], w[2],
+                                   w[2]);
+      __m128i d_lo = _mm_unpacklo_epi8(dst, zero);
+      __m128i d_hi = _mm_unpackhi_epi8(dst, zero);
+      __m128i v_lo = _mm_add_epi16(
+          _mm_add_epi16(_mm_mullo_epi16(src, w_lo),
+                        _mm_mullo_epi16(d_lo, _mm_sub_epi16(all, w_lo))),
+          round);
+      __m128i v_hi = _mm_add_epi16(
+          _mm_add_epi16(_mm_mullo_epi16(src, w_hi),
+                        _mm_mullo_epi16(d_hi, _mm_sub_epi16(all, w_hi))),
+          round);
+      v_lo = _mm_srli_epi16(_mm_add_epi16(v_lo, _mm_srli_epi16(v_lo, 8)), 8);
+      v_hi = _mm_srli_epi16(_mm_add_epi16(v_hi, _mm_srli_epi16(v_hi, 8)), 8);
+      __m128i out = _mm_packus_epi16(v_lo, v_hi);
+      out = _mm_or_si128(out, _mm_set1_epi32((int)0xFF000000));
+      _mm_storeu_si128((__m128i *)(row + x), out);
+    }
+#endif
+    for (; x <= area.x1; ++x)
+    {
+      unsigned k = hits[x];
+      if (k == 0) { continue; }
+      hits[x] = 0;
+      unsigned w = weights[k < (unsigned)opaque_from ? k : (unsigned)opaque_from];
+      row[x] = blend(row[x], colour, w);
+    }
+  }
+}
+
+void resolve_indexed(Canvas *c, Rect area, Colour32 colour)
+{
+  // resolve_coverage() for an indexed canvas. a pixel's blend only depends
+  // on its index and weight, so runs of the same pair share one lookup. a
+  // blend the palette has no room for sends the canvas over to pixels and
+  // the rest of the pixels get blended there
+  uint8_t weights[COVERAGE_LUT_SIZE];
+  int opaque_from = build_weights(weights, colour >> 24);
+  Palette *p = c->palette;
+  unsigned last_key = UINT32_MAX;
+  uint8_t last_index = 0;
+
+  for (int y = area.y0; y <= area.y1; ++y)
+  {
+    uint8_t *row = c->indices + (ptrdiff_t)y * c->stride;
+    uint16_t *hits = c->counts + (ptrdiff_t)y * c->stride;
+    for (int x = area.x0; x <= area.x1; ++x)
+    {
+      unsigned k = hits[x];
+      if (k == 0) { continue; }
+      if (k > (unsigned)opaque_from) { k = (unsigned)opaque_from; }
+      unsigned w = weights[k];
+      unsigned key = (unsigned)row[x] << 8 | w;
+      if (key != last_key)
+      {
+        int index = palette_index(p, blend(p->colours[row[x]], colour, w));
+        if (index < 0)
+        {
+          canvas_expand(c);
+          resolve_coverage(c->pixels, c->counts, c->stride, area, colour);
+          return;
+        }
+        last_key = key;
+        last_index = (uint8_t)index;
+      }
+      hits[x] = 0;
+      row[x] = last_index;
+    }
+  }
+}
+
+static inline void put_rgb(uint8_t *dst, uint32_t rgba)
+{
+  dst[0] = rgba & 0xFF;
+  dst[1] = (rgba >> 8) & 0xFF;
+  dst[2] = (rgba >> 16) & 0xFF;
+}
+
+void downsample_rgb(const Canvas *c, uint8_t *rgb)
+{
+  // box filters every scale x scale block of the canvas into one packed rgb
+  // output pixel, rounded to nearest
+  const int s = c->scale, area = s * s;
+  const int width = c->width / s, height = c->height / s;
+
+  for (int y = 0; y < height; ++y)
+  {
+    const Colour32 *rows = c->pixels + (ptrdiff_t)y * s * c->stride;
+    uint8_t *dst = rgb + (size_t)y * width * 3;
+    int x = 0;
+#ifdef __SSE2__
+    // channel sums fit in 16 bits (at most 16 * 255), widen and add rows
+    const __m128i zero = _mm_setzero_si128();
+    if (s == 2)
+    {  // two output pixels per pass
+      const Colour32 *next = rows + c->stride;
+      const __m128i round = _mm_set1_epi16(2);
+      for (; x + 2 <= width; x += 2)
+      {
+        __m128i a = _mm_loadu_si128((const __m128i *)(rows + 2 * x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(next + 2 * x));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                   _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                   _mm_unpackhi_epi8(b, zero));
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_unpacklo_epi64(lo, hi);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        __m128i out = _mm_packus_epi16(sum, sum);
+        put_rgb(dst + 3 * x, (uint32_t)_mm_cvtsi128_si32(out));
+        put_rgb(dst + 3 * x + 3,
+                (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out, 4)));
+      }
+    }
+    else if (s == 4)
+    {  // one output pixel per pass, a row of four canvas pixels per load
+      const __m128i round = _mm_set1_epi16(8);
+      for (; x < width; ++x)
+      {
+        __m128i sum = zero;
+        for (int r = 0; r < 4; ++r)
+        {
+          __m128i a = _mm_loadu_si128(
+              (const __m128i *)(rows + (ptrdiff_t)r * c->stride + 4 * x));
+          sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(a, zero));
+          sum = _mm_add_epi16(sum, _mm_unpackhi_epi8(a, zero));
+        }
+        sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 4);
+        put_rgb(dst + 3 * x,
+                (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+      }
+    }
+#endif
+    for (; x < width; ++x)
+    {
+      unsigned r = 0, g = 0, b = 0;
+      for (int dy = 0; dy < s; ++dy)
+      {
+        const Colour32 *p = rows + (ptrdiff_t)dy * c->stride + x * s;
+        for (int dx = 0; dx < s; ++dx)
+        {
+          r += p[dx] & 0xFF;
+          g += (p[dx] >> 8) & 0xFF;
+          b += (p[dx] >> 16) & 0xFF;
+        }
+      }
+      dst[3 * x] = (uint8_t)((r + area / 2) / area);
+      dst[3 * x + 1] = (uint8_t)((g + area / 2) / area);
+      dst[3 * x + 2] = (uint8_t)((b + area / 2) / area);
+    }
+  }
+}
+
+static inline uint32_t block_row(const uint8_t *p, int s)
+{
+  // one row of a 2 or 4 wide block of indices as a word
+  if (s == 4)
+  {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+  }
+  uint16_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+void downsample_indexed(const Canvas *c, uint8_t *rgb)
+{
+  // downsample_rgb() for an indexed canvas - a block that's all one index,
+  // which is most of them, is just that colour
+  const int s = c->scale, area = s * s;
+  const int width = c->width / s, height = c->height / s;
+  const Colour32 *colours = c->palette->colours;
+  const uint32_t ones = s == 4 ? 0x01010101u : 0x0101u;
+
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t *rows = c->indices + (ptrdiff_t)y * s * c->stride;
+    uint8_t *dst = rgb + (size_t)y * width * 3;
+    for (int x = 0; x < width; ++x)
+    {
+      const uint8_t *block = rows + x * s;
+      const uint32_t same = block[0] * ones;
+      uint32_t differ = 0;
+      for (int dy = 0; dy < s; ++dy)
+      {
+        differ |= block_row(block + (ptrdiff_t)dy * c->stride, s) ^ same;
+      }
+      if (differ == 0)
+      {
+        put_rgb(dst + 3 * x, colours[block[0]]);
+        continue;
+      }
+      unsigned r = 0, g = 0, b = 0;
+      for (int dy = 0; dy < s; ++dy)
+      {
+        const uint8_t *p = block + (ptrdiff_t)dy * c->stride;
+        for (int dx = 0; dx < s; ++dx)
+        {
+          Colour32 colour = colours[p[dx]];
+          r += colour & 0xFF;
+          g += (colour >> 8) & 0xFF;
+          b += (colour >> 16) & 0xFF;
+        }
+      }
+      dst[3 * x] = (uint8_t)((r + area / 2) / area);
+      dst[3 * x + 1] = (uint8_t)((g + area / 2) / area);
+      dst[3 * x + 2] = (uint8_t)((b + area / 2) / area);
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// viewport culling - packs the points inside a window to the front of the
+// chunk before they're transformed and stamped. stores are unconditional
+// and the write position only moves on a kept point, so there's no branch
+// per point for the predictor to miss
+
+size_t cull_chunk(double *x, double *y, size_t n, Bounds v)
+{
+  // keeps points with x in [min_x, max_x] and y in [min_y, max_y], NaN
+  // fails both tests. returns how many are left
+  size_t kept = 0, i = 0;
+#ifdef __SSE2__
+  const __m128d x0 = _mm_set1_pd(v.min_x), x1 = _mm_set1_pd(v.max_x);
+  const __m128d y0 = _mm_set1_pd(v.min_y), y1 = _mm_set1_pd(v.max_y);
+  for (; i + 2 <= n; i += 2)
+  {
+    __m128d xs = _mm_loadu_pd(x + i), ys = _mm_loadu_pd(y + i);
+    __m128d in = _mm_and_pd(
+        _mm_and_pd(_mm_cmpge_pd(xs, x0), _mm_cmple_pd(xs, x1)),
+        _mm_and_pd(_mm_cmpge_pd(ys, y0), _mm_cmple_pd(ys, y1)));
+    int mask = _mm_movemask_pd(in);
+    if (mask == 3 && kept == i)
+    {  // nothing dropped yet, the pair is already in place
+      kept += 2;
+      continue;
+    }
+    // kept <= i, so writing behind the read position is safe
+    x[kept] = x[i];
+    y[kept] = y[i];
+    kept += mask & 1;
+    x[kept] = x[i + 1];
+    y[kept] = y[i + 1];
+    kept += mask >> 1;
+  }
+#endif
+  for (; i < n; ++i)
+  {
+    int in = x[i] >= v.min_x && x[i] <= v.max_x && y[i] >= v.min_y &&
+             y[i] <= v.max_y;
+    x[kept] = x[i];
+    y[kept] = y[i];
+    kept += in;
+  }
+  return kept;
+}
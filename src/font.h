@@ -390,6 +390,15 @@ static char default_glyphs[128][FONT_HEIGHT][FONT_WIDTH] =
         {0, 0, 0, 0, 0},
         {0, 0, 0, 0, 0},
     },
+    [':'] = 
+    {
+        {0, 0, 0, 0, 0},
+        {0, 1, 1, 0, 0},
+        {0, 1, 1, 0, 0},
+        {0, 0, 0, 0, 0},
+        {0, 1, 1, 0, 0},
+        {0, 1, 1, 0, 0},
+    },
 };
 
 // static Font default_font = {
@@ -0,0 +1,263 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+#include "stb_image_write.h"
+
+// the output formats, picked by the path's extension. png and jpg compress,
+// the rest are for handing the image straight to something that decodes it
+// again - ppm, bmp and raw rgba are the pixels with (at most) a header, and
+// qoi gets most of png's size on plot images for a single cheap pass
+
+typedef struct
+{
+  uint8_t *data;
+  size_t len, cap;
+} ByteBuffer;
+
+static void buffer_write(void *context, void *data, int size)
+{
+  // stb write callback collecting the encoded file in memory
+  ByteBuffer *buf = context;
+  if (buf->len + size > buf->cap)
+  {
+    size_t cap = buf->cap ? buf->cap * 2 : 1 << 16;
+    while (cap < buf->len + size) { cap *= 2; }
+    uint8_t *grown = trace_realloc(buf->data, cap);
+    assert(grown != NULL);
+    buf->data = grown;
+    buf->cap = cap;
+  }
+  memcpy(buf->data + buf->len, data, size);
+  buf->len += size;
+}
+
+static uint8_t *encode_png_file(const uint8_t *rgb, int w, int h, size_t *len)
+{
+  int png_len;
+  uint8_t *encoded = encode_png(rgb, w, h, &png_len);
+  *len = (size_t)png_len;
+  return encoded;
+}
+
+static uint8_t *encode_indexed_png(const uint8_t *indices, int w, int h,
+                                   const Colour32 *palette, int colours,
+                                   size_t *len)
+{
+  int png_len;
+  uint8_t *encoded =
+      encode_palette_png(indices, w, h, palette, colours, &png_len);
+  *len = (size_t)png_len;
+  return encoded;
+}
+
+static uint8_t *encode_jpg(const uint8_t *rgb, int w, int h, size_t *len)
+{
+  return encode_jpeg(rgb, w, h, jpeg_quality, jpeg_sampling,
+                     jpeg_thread_count, len);
+}
+
+static uint8_t *encode_bmp(const uint8_t *rgb, int w, int h, size_t *len)
+{
+  uint64_t t = trace_begin();
+  ByteBuffer buf = {0};
+  stbi_write_bmp_to_func(buffer_write, &buf, w, h, CHANNEL_NUM, rgb);
+  trace_count(COUNT_ENCODED, buf.len);
+  trace_end(TRACE_ENCODE, t);
+  *len = buf.len;
+  return buf.data;
+}
+
+static uint8_t *encode_ppm(const uint8_t *rgb, int w, int h, size_t *len)
+{
+  // binary pnm - a text header then the rgb bytes as they are
+  uint64_t t = trace_begin();
+  char header[32];
+  int header_len = snprintf(header, sizeof header, "P6\n%d %d\n255\n", w, h);
+  size_t pixels = (size_t)w * h * CHANNEL_NUM;
+  uint8_t *out = trace_malloc(header_len + pixels);
+  assert(out != NULL);
+  memcpy(out, header, header_len);
+  memcpy(out + header_len, rgb, pixels);
+  *len = header_len + pixels;
+  trace_count(COUNT_ENCODED, *len);
+  trace_end(TRACE_ENCODE, t);
+  return out;
+}
+
+static uint8_t *encode_rgba(const uint8_t *rgb, int w, int h, size_t *len)
+{
+  // no header at all, 4 bytes a pixel row by row from the top, alpha 255
+  uint64_t t = trace_begin();
+  size_t count = (size_t)w * h;
+  uint8_t *out = trace_malloc(count * 4);
+  assert(out != NULL);
+  for (size_t i = 0; i < count; ++i)
+  {
+    out[4 * i] = rgb[3 * i];
+    out[4 * i + 1] = rgb[3 * i + 1];
+    out[4 * i + 2] = rgb[3 * i + 2];
+    out[4 * i + 3] = 0xFF;
+  }
+  *len = count * 4;
+  trace_count(COUNT_ENCODED, *len);
+  trace_end(TRACE_ENCODE, t);
+  return out;
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_MAX_RUN 62
+
+static inline uint32_t qoi_pixel(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+}
+
+static inline int qoi_hash(uint32_t px)
+{
+  // (r * 3 + g * 5 + b * 7 + a * 11) % 64 with a always 255
+  return ((px & 0xFF) * 3 + (px >> 8 & 0xFF) * 5 + (px >> 16) * 7 + 255 * 11) %
+         64;
+}
+
+static uint8_t *encode_qoi(const uint8_t *rgb, int w, int h, size_t *len)
+{
+  // qoi with 3 channels. a plot is mostly long rows of background, so a
+  // repeat of the last pixel is followed to the end of its run in one tight
+  // loop and written as a string of run ops, only the pixels between runs
+  // go through the index and difference ops
+  uint64_t t = trace_begin();
+  size_t count = (size_t)w * h;
+  uint8_t *out = trace_malloc(14 + count * 4 + 8);
+  assert(out != NULL);
+  uint8_t *at = out;
+  memcpy(at, "qoif", 4);
+  at += 4;
+  for (int i = 3; i >= 0; --i) { *at++ = (uint8_t)((uint32_t)w >> (8 * i)); }
+  for (int i = 3; i >= 0; --i) { *at++ = (uint8_t)((uint32_t)h >> (8 * i)); }
+  *at++ = 3;  // rgb
+  *at++ = 0;  // srgb
+
+  uint32_t index[64] = {0};
+  bool seen[64] = {false};
+  uint32_t prev = 0;  // opaque black to start, alpha is implied
+  for (size_t i = 0; i < count;)
+  {
+    uint32_t px = qoi_pixel(rgb + 3 * i);
+    if (px == prev)
+    {
+      size_t run = 1;
+      while (i + run < count && qoi_pixel(rgb + 3 * (i + run)) == prev)
+      {
+        ++run;
+      }
+      i += run;
+      for (; run >= QOI_MAX_RUN; run -= QOI_MAX_RUN)
+      {
+        *at++ = QOI_OP_RUN | (QOI_MAX_RUN - 1);
+      }
+      if (run > 0) { *at++ = (uint8_t)(QOI_OP_RUN | (run - 1)); }
+      continue;
+    }
+    int slot = qoi_hash(px);
+    if (seen[slot] && index[slot] == px) { *at++ = QOI_OP_INDEX | slot; }
+    else
+    {
+      index[slot] = px;
+      seen[slot] = true;
+      int dr = (int8_t)((px & 0xFF) - (prev & 0xFF));
+      int dg = (int8_t)((px >> 8 & 0xFF) - (prev >> 8 & 0xFF));
+      int db = (int8_t)((px >> 16) - (prev >> 16));
+      int dr_dg = dr - dg, db_dg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+      {
+        *at++ = (uint8_t)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 |
+                          (db + 2));
+      }
+      else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+               db_dg >= -8 && db_dg <= 7)
+      {
+        *at++ = (uint8_t)(QOI_OP_LUMA | (dg + 32));
+        *at++ = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+      }
+      else
+      {
+        *at++ = QOI_OP_RGB;
+        *at++ = (uint8_t)px;
+        *at++ = (uint8_t)(px >> 8);
+        *at++ = (uint8_t)(px >> 16);
+      }
+    }
+    prev = px;
+    ++i;
+  }
+  static const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  memcpy(at, end, sizeof end);
+  at += sizeof end;
+
+  *len = (size_t)(at - out);
+  trace_count(COUNT_ENCODED, *len);
+  trace_end(TRACE_ENCODE, t);
+  return out;
+}
+
+static const ImageFormat image_formats[] = {
+    {".png", "PNG", encode_png_file, encode_indexed_png},
+    {".jpg", "JPEG", encode_jpg, NULL},
+    {".bmp", "BMP", encode_bmp, NULL},
+    {".ppm", "PPM", encode_ppm, NULL},
+    {".rgba", "RGBA", encode_rgba, NULL},
+    {".qoi", "QOI", encode_qoi, NULL},
+};
+
+const ImageFormat *image_format(const char *path)
+{
+  // the format for a path's extension, NULL if it isn't one of them
+  size_t p_len = strlen(path);
+  for (size_t i = 0; i < sizeof image_formats / sizeof *image_formats; ++i)
+  {
+    size_t e_len = strlen(image_formats[i].extension);
+    if (p_len >= e_len &&
+        strcmp(path + p_len - e_len, image_formats[i].extension) == 0)
+    {
+      return &image_formats[i];
+    }
+  }
+  return NULL;
+}
+
+const char *write_image(const char *path, const uint8_t *rgb)
+{
+  // encodes rgb in memory picking the format from the path then writes it
+  // out, returns the format name or NULL if the extension isn't known
+  const ImageFormat *format = image_format(path);
+  if (format == NULL) { return NULL; }
+  size_t len;
+  uint8_t *encoded = format->encode(rgb, WIDTH, HEIGHT, &len);
+  int ok = write_file(path, encoded, len);
+  trace_free(encoded);
+  return ok ? format->name : NULL;
+}
+
+const char *write_indexed_image(const char *path, const uint8_t *indices,
+                                const Palette *palette)
+{
+  // write_image() for a plot kept as palette indices, the path's format
+  // has to have an indexed form
+  const ImageFormat *format = image_format(path);
+  assert(format != NULL && format->encode_indexed != NULL);
+  size_t len;
+  uint8_t *encoded = format->encode_indexed(
+      indices, WIDTH, HEIGHT, palette->colours, palette->count, &len);
+  int ok = write_file(path, encoded, len);
+  trace_free(encoded);
+  return ok ? format->name : NULL;
+}
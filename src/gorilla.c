@@ -0,0 +1,520 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// compressed time series in the style of facebook's gorilla - timestamps
+// as delta of deltas (one bit each when they're evenly spaced) and values
+// xored with the one before, keeping only the bits that changed. points go
+// in blocks, each with its ranges in an index at the end of the file, so
+// the bounds usually come from the index alone and the drawing pass skips
+// blocks it can't see. blocks are decoded a chunk at a time straight into
+// the plotting kernels, the series never exists uncompressed
+//
+// layout: header, the blocks' bits, the index (8 byte aligned)
+
+#define GORILLA_MAGIC "PLOTGOR1"
+#define GORILLA_BLOCK 4096  // points per block
+// worst case bits a point - '1111' and 64 for the time, '11', 5 + 6 and 64
+// for the value
+#define GORILLA_POINT_BYTES 19
+
+typedef struct
+{
+  char magic[8];
+  uint64_t count;   // points
+  uint64_t blocks;
+  uint64_t index;   // file offset of blocks GorillaBlock entries
+} GorillaHeader;
+
+/*--------------------------------------------------------------*/
+/*---------------------------BIT I/O----------------------------*/
+/*--------------------------------------------------------------*/
+
+typedef struct
+{
+  uint8_t *out;
+  size_t len;
+  uint64_t bits;  // the last count bits are still to go out
+  int count;
+} BitPacker;
+
+static inline void pack_bits(BitPacker *w, uint64_t value, int n)
+{
+  // n up to 32 bits of value, most significant first
+  w->bits = (w->bits << n) | (value & ((1ull << n) - 1));
+  w->count += n;
+  while (w->count >= 8)
+  {
+    w->count -= 8;
+    w->out[w->len++] = (uint8_t)(w->bits >> w->count);
+  }
+}
+
+static inline void pack_wide(BitPacker *w, uint64_t value, int n)
+{
+  // up to 64
+  if (n > 32)
+  {
+    pack_bits(w, value >> 32, n - 32);
+    n = 32;
+  }
+  pack_bits(w, value, n);
+}
+
+static inline void refill(GorillaDecoder *d)
+{
+  // tops the reader up to at least 57 bits, a whole word at a time until
+  // the last 8 bytes of the block. bits is left aligned
+  if (d->end - d->at >= 8)
+  {
+    const uint8_t *p = d->at;
+    uint64_t word = (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+                    (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+                    (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+                    (uint64_t)p[6] << 8 | p[7];
+    d->bits |= word >> d->count;
+    d->at += (63 - d->count) >> 3;
+    d->count |= 56;
+    return;
+  }
+  while (d->count <= 56)
+  {  // zeros once the block runs out
+    uint64_t byte = d->at < d->end ? *d->at++ : 0;
+    d->bits |= byte << (56 - d->count);
+    d->count += 8;
+  }
+}
+
+static inline uint64_t unpack_bits(GorillaDecoder *d, int n)
+{
+  // n from 1 up to 32 bits
+  if (d->count < n) { refill(d); }
+  uint64_t value = d->bits >> (64 - n);
+  d->bits <<= n;
+  d->count -= n;
+  return value;
+}
+
+static inline uint64_t unpack_wide(GorillaDecoder *d, int n)
+{
+  if (n <= 32) { return unpack_bits(d, n); }
+  uint64_t high = unpack_bits(d, n - 32);
+  return (high << 32) | unpack_bits(d, 32);
+}
+
+// x is never 0 for these
+#if defined(__GNUC__)
+static inline int leading_zeros(uint64_t x) { return __builtin_clzll(x); }
+static inline int trailing_zeros(uint64_t x) { return __builtin_ctzll(x); }
+#else
+static inline int leading_zeros(uint64_t x)
+{
+  int n = 0;
+  while (!(x >> 63)) { x <<= 1, ++n; }
+  return n;
+}
+
+static inline int trailing_zeros(uint64_t x)
+{
+  int n = 0;
+  while (!(x & 1)) { x >>= 1, ++n; }
+  return n;
+}
+#endif
+
+/*--------------------------------------------------------------*/
+/*---------------------------ENCODING---------------------------*/
+/*--------------------------------------------------------------*/
+
+static void encode_block(BitPacker *w, const int64_t *t, const double *v,
+                         size_t n)
+{
+  uint64_t prev_t = (uint64_t)t[0], prev_delta = 0, prev_v;
+  memcpy(&prev_v, &v[0], sizeof prev_v);
+  pack_wide(w, prev_t, 64);
+  pack_wide(w, prev_v, 64);
+  int lead = 32, trail = 0;  // no window yet, 32 is past any real lead
+
+  for (size_t i = 1; i < n; ++i)
+  {
+    // time - the change in spacing, unsigned so wild data wraps rather
+    // than overflowing
+    uint64_t delta = (uint64_t)t[i] - prev_t;
+    int64_t dod = (int64_t)(delta - prev_delta);
+    if (dod == 0) { pack_bits(w, 0, 1); }
+    else if (dod >= -63 && dod <= 64)
+    {
+      pack_bits(w, 0x2 << 7 | (dod + 63), 9);
+    }
+    else if (dod >= -255 && dod <= 256)
+    {
+      pack_bits(w, 0x6 << 9 | (dod + 255), 12);
+    }
+    else if (dod >= -2047 && dod <= 2048)
+    {
+      pack_bits(w, 0xE << 12 | (dod + 2047), 16);
+    }
+    else
+    {
+      pack_bits(w, 0xF, 4);
+      pack_wide(w, (uint64_t)dod, 64);
+    }
+    prev_t = (uint64_t)t[i];
+    prev_delta = delta;
+
+    // value - nothing if it repeats, otherwise the changed bits, inside the
+    // last window of them when they fit
+    uint64_t bits;
+    memcpy(&bits, &v[i], sizeof bits);
+    uint64_t x = bits ^ prev_v;
+    prev_v = bits;
+    if (x == 0)
+    {
+      pack_bits(w, 0, 1);
+      continue;
+    }
+    int l = leading_zeros(x), r = trailing_zeros(x);
+    if (l > 31) { l = 31; }
+    if (l >= lead && r >= trail)
+    {
+      pack_bits(w, 0x2, 2);
+      pack_wide(w, x >> trail, 64 - lead - trail);
+      continue;
+    }
+    lead = l;
+    trail = r;
+    int sig = 64 - l - r;
+    pack_bits(w, 0x3 << 11 | l << 6 | (sig & 63), 13);  // 64 goes in as 0
+    pack_wide(w, x >> r, sig);
+  }
+  if (w->count > 0) { pack_bits(w, 0, 8 - w->count); }
+}
+
+static void block_ranges(GorillaBlock *b, const int64_t *t, const double *v,
+                         size_t n)
+{
+  // what the index keeps on a block - the time and value ranges of its
+  // points with a finite value, and whether time never goes backwards
+  b->count = n;
+  b->t_first = t[0];
+  b->t_last = t[n - 1];
+  b->t_min = INT64_MAX;
+  b->t_max = INT64_MIN;
+  b->v_min = INFINITY;
+  b->v_max = -INFINITY;
+  b->sorted = 1;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (i > 0 && t[i] < t[i - 1]) { b->sorted = 0; }
+    if (!isfinite(v[i])) { continue; }
+    if (t[i] < b->t_min) { b->t_min = t[i]; }
+    if (t[i] > b->t_max) { b->t_max = t[i]; }
+    if (v[i] < b->v_min) { b->v_min = v[i]; }
+    if (v[i] > b->v_max) { b->v_max = v[i]; }
+  }
+}
+
+size_t gorilla_write(const char *path, const int64_t *t, const double *v,
+                     size_t n)
+{
+  // compresses n points into a file plot_gorilla() can draw, returns the
+  // file's size
+  FILE *f = fopen(path, "wb");
+  size_t blocks = (n + GORILLA_BLOCK - 1) / GORILLA_BLOCK;
+  GorillaBlock *index = trace_malloc(blocks ? blocks * sizeof *index : 1);
+  BitPacker w = {trace_malloc(GORILLA_BLOCK * GORILLA_POINT_BYTES + 16), 0, 0,
+                 0};
+  if (f == NULL)
+  {
+    printf("ERROR: couldn't write %s\n", path);
+    exit(1);
+  }
+  if (index == NULL || w.out == NULL)
+  {
+    printf("ERROR: not enough memory to compress the series\n");
+    exit(1);
+  }
+  GorillaHeader h = {.count = n, .blocks = blocks};
+  memcpy(h.magic, GORILLA_MAGIC, sizeof h.magic);
+  bool ok = fwrite(&h, sizeof h, 1, f) == 1;
+  uint64_t at = sizeof h;
+  for (size_t k = 0; k < blocks; ++k)
+  {
+    size_t first = k * GORILLA_BLOCK;
+    size_t count = n - first < GORILLA_BLOCK ? n - first : GORILLA_BLOCK;
+    w.len = 0;
+    w.count = 0;
+    encode_block(&w, t + first, v + first, count);
+    block_ranges(&index[k], t + first, v + first, count);
+    index[k].offset = at;
+    index[k].bytes = w.len;
+    ok = ok && fwrite(w.out, 1, w.len, f) == w.len;
+    at += w.len;
+  }
+  static const uint8_t zeros[8] = {0};
+  size_t pad = (8 - at % 8) % 8;  // so the index can be read in place
+  ok = ok && fwrite(zeros, 1, pad, f) == pad;
+  h.index = at + pad;
+  ok = ok && fwrite(index, sizeof *index, blocks, f) == blocks;
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof h, 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+  {
+    printf("ERROR: couldn't write %s\n", path);
+    exit(1);
+  }
+  trace_free(w.out);
+  trace_free(index);
+  return (size_t)(h.index + blocks * sizeof *index);
+}
+
+/*--------------------------------------------------------------*/
+/*---------------------------DECODING---------------------------*/
+/*--------------------------------------------------------------*/
+
+void gorilla_open(GorillaFile *g, const char *path)
+{
+  // maps the file and checks the header and index hang together
+  stream_map(&g->file, path);
+  g->path = path;
+  const uint8_t *map = g->file.map;
+  GorillaHeader h;
+  bool ok = g->file.bytes >= sizeof h;
+  if (ok)
+  {
+    memcpy(&h, map, sizeof h);
+    ok = memcmp(h.magic, GORILLA_MAGIC, sizeof h.magic) == 0 &&
+         h.index % 8 == 0 && h.index <= g->file.bytes &&
+         h.blocks <= (g->file.bytes - h.index) / sizeof(GorillaBlock);
+  }
+  if (ok)
+  {
+    g->count = h.count;
+    g->blocks = h.blocks;
+    g->index = (const GorillaBlock *)(map + h.index);
+    uint64_t points = 0;
+    for (size_t k = 0; k < g->blocks && ok; ++k)
+    {
+      const GorillaBlock *b = &g->index[k];
+      ok = b->offset >= sizeof h && b->offset <= h.index &&
+           b->bytes <= h.index - b->offset && b->count > 0 &&
+           b->count <= GORILLA_BLOCK;
+      points += b->count;
+    }
+    ok = ok && points == h.count;
+  }
+  if (!ok)
+  {
+    printf("ERROR: %s isn't a gorilla series file\n", path);
+    exit(1);
+  }
+}
+
+void gorilla_close(GorillaFile *g) { stream_close(&g->file); }
+
+void gorilla_start(GorillaDecoder *d, const GorillaFile *g, size_t block)
+{
+  const GorillaBlock *b = &g->index[block];
+  *d = (GorillaDecoder){.at = g->file.map + b->offset,
+                        .end = g->file.map + b->offset + b->bytes,
+                        .path = g->path,
+                        .left = b->count};
+}
+
+size_t gorilla_decode(GorillaDecoder *d, int64_t *t, double *v, size_t max)
+{
+  // the block's next points, up to max of them, returns how many
+  size_t n = d->left < max ? d->left : max;
+  size_t i = 0;
+  if (n > 0 && !d->started)
+  {
+    d->t = unpack_wide(d, 64);
+    d->v = unpack_wide(d, 64);
+    d->lead = 32;
+    d->started = true;
+    t[0] = (int64_t)d->t;
+    memcpy(&v[0], &d->v, sizeof v[0]);
+    i = 1;
+  }
+  for (; i < n; ++i)
+  {
+    int64_t dod;
+    if (!unpack_bits(d, 1)) { dod = 0; }
+    else if (!unpack_bits(d, 1)) { dod = (int64_t)unpack_bits(d, 7) - 63; }
+    else if (!unpack_bits(d, 1)) { dod = (int64_t)unpack_bits(d, 9) - 255; }
+    else if (!unpack_bits(d, 1)) { dod = (int64_t)unpack_bits(d, 12) - 2047; }
+    else { dod = (int64_t)unpack_wide(d, 64); }
+    d->delta += (uint64_t)dod;
+    d->t += d->delta;
+    t[i] = (int64_t)d->t;
+
+    if (unpack_bits(d, 1))
+    {
+      if (unpack_bits(d, 1))
+      {  // a new window
+        d->lead = (int)unpack_bits(d, 5);
+        int sig = (int)unpack_bits(d, 6);
+        if (sig == 0) { sig = 64; }
+        if (d->lead + sig > 64)
+        {  // only a corrupt block can have a window past the last bit
+          printf("ERROR: %s isn't a gorilla series file\n", d->path);
+          exit(1);
+        }
+        d->trail = 64 - d->lead - sig;
+      }
+      d->v ^= unpack_wide(d, 64 - d->lead - d->trail) << d->trail;
+    }
+    memcpy(&v[i], &d->v, sizeof v[i]);
+  }
+  d->left -= n;
+  return n;
+}
+
+/*--------------------------------------------------------------*/
+/*-------------------------PLOTTING PASSES----------------------*/
+/*--------------------------------------------------------------*/
+
+static bool gorilla_sorted(const GorillaFile *g)
+{
+  for (size_t k = 0; k < g->blocks; ++k)
+  {
+    if (!g->index[k].sorted) { return false; }
+    if (k > 0 && g->index[k].t_first < g->index[k - 1].t_last)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+Bounds gorilla_bounds(GorillaFile *g, TimeScale *ts, int size)
+{
+  // compute_bounds(), or compute_time_bounds() when ts is set. on linear
+  // axes the index has everything, a log axis decodes the lot to find the
+  // range of the transformed values
+  Bounds b = {INFINITY, -INFINITY, INFINITY, -INFINITY, gorilla_sorted(g)};
+  int64_t t_min = INT64_MAX, t_max = INT64_MIN;
+  if (y_scale == SCALE_LINEAR && (ts != NULL || x_scale == SCALE_LINEAR))
+  {
+    for (size_t k = 0; k < g->blocks; ++k)
+    {
+      const GorillaBlock *blk = &g->index[k];
+      if (blk->t_min < t_min) { t_min = blk->t_min; }
+      if (blk->t_max > t_max) { t_max = blk->t_max; }
+      if (blk->v_min < b.min_y) { b.min_y = blk->v_min; }
+      if (blk->v_max > b.max_y) { b.max_y = blk->v_max; }
+    }
+  }
+  else
+  {
+    GorillaDecoder d;
+    int64_t ts_buf[PLOT_CHUNK];
+    double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+    stream_seek(&g->file, 0);
+    for (size_t k = 0; k < g->blocks; ++k)
+    {
+      gorilla_start(&d, g, k);
+      size_t count;
+      while ((count = gorilla_decode(&d, ts_buf, ys, PLOT_CHUNK)) > 0)
+      {
+        stream_advance(&g->file, (size_t)(d.at - g->file.map));
+        transform_chunk(ys, count, y_scale, symlog_linear);
+        for (size_t i = 0; i < count; ++i) { xs[i] = (double)ts_buf[i]; }
+        if (ts == NULL)
+        {
+          transform_chunk(xs, count, x_scale, symlog_linear);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+          if (!isfinite(ys[i]) || !isfinite(xs[i])) { continue; }
+          if (ts_buf[i] < t_min) { t_min = ts_buf[i]; }
+          if (ts_buf[i] > t_max) { t_max = ts_buf[i]; }
+          if (xs[i] < b.min_x) { b.min_x = xs[i]; }
+          if (xs[i] > b.max_x) { b.max_x = xs[i]; }
+          if (ys[i] < b.min_y) { b.min_y = ys[i]; }
+          if (ys[i] > b.max_y) { b.max_y = ys[i]; }
+        }
+      }
+    }
+    stream_seek(&g->file, g->file.bytes);
+  }
+  b.x_sorted = b.x_sorted || x_declared_sorted;
+  if (t_min > t_max)
+  {  // nothing finite to plot
+    t_min = t_max = 0;
+    b.min_x = b.max_x = b.min_y = b.max_y = 0;
+  }
+  else if (ts != NULL || x_scale == SCALE_LINEAR)
+  {
+    b.min_x = (double)t_min;
+    b.max_x = (double)t_max;
+  }
+  if (ts != NULL)
+  {
+    *ts = time_scale(t_min, t_max, size);
+    b.min_x = 0;
+    b.max_x = (double)((uint64_t)t_max - (uint64_t)t_min);
+  }
+  return b;
+}
+
+size_t gorilla_scatter(Canvas *c, GorillaFile *g, Bounds b,
+                       const TimeScale *ts, bool cull, Colour32 colour)
+{
+  // plot_scatter() or plot_time_scatter() decoding as it goes, returns the
+  // points drawn. with a cull window, blocks whose ranges miss it are
+  // never read
+  const Bounds window = cull_window(c, b);
+  GorillaDecoder d;
+  int64_t ts_buf[PLOT_CHUNK];
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  int32_t xval[PLOT_CHUNK], yval[PLOT_CHUNK];
+  size_t drawn = 0;
+  ColumnDedupe dedupe;
+  if (b.x_sorted) { dedupe_reset(&dedupe); }
+  stream_seek(&g->file, 0);
+
+  for (size_t k = 0; k < g->blocks; ++k)
+  {
+    const GorillaBlock *blk = &g->index[k];
+    if (blk->v_min > blk->v_max) { continue; }  // no values at all
+    if (ts == NULL && cull &&
+        ((double)blk->t_max < window.min_x ||
+         (double)blk->t_min > window.max_x || blk->v_max < window.min_y ||
+         blk->v_min > window.max_y))
+    {
+      continue;
+    }
+    gorilla_start(&d, g, k);
+    size_t count;
+    while ((count = gorilla_decode(&d, ts_buf, ys, PLOT_CHUNK)) > 0)
+    {
+      stream_advance(&g->file, (size_t)(d.at - g->file.map));
+      if (ts != NULL)
+      {
+        if (y_scale != SCALE_LINEAR)
+        {
+          transform_chunk(ys, count, y_scale, symlog_linear);
+        }
+        time_scale_chunk(ts_buf, ys, count, *ts, xval);
+        scale_chunk(ys, count, b.min_y, b.max_y, c->plot_px * c->scale,
+                    yval);
+        drawn += stamp_chunk(c, xval, yval, count, colour,
+                             b.x_sorted ? &dedupe : NULL);
+        continue;
+      }
+      for (size_t i = 0; i < count; ++i) { xs[i] = (double)ts_buf[i]; }
+      drawn += scatter_chunk(c, b, xs, ys, count, cull ? &window : NULL,
+                             colour, b.x_sorted ? &dedupe : NULL);
+    }
+  }
+  stream_seek(&g->file, g->file.bytes);
+  return drawn;
+}
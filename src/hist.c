@@ -0,0 +1,283 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// histogram binning - workers claim blocks of the values and count them into
+// their own counters, which get summed once they're all done. a bin is
+// worked out for two values at a time, and consecutive values count into
+// four separate sets of counters so a run landing in one bin isn't one long
+// chain of dependent increments. packed doubles on a linear axis are read
+// where they lie, anything else is loaded and transformed a chunk at a time
+
+#define HIST_BLOCK (64 * PLOT_CHUNK)  // values a worker claims at once
+#define HIST_LANES 4
+
+_Thread_local int hist_thread_count = 0;
+
+typedef struct
+{
+  PlotArray values;
+  size_t n;
+  bool direct;       // packed doubles on a linear axis, binned in place
+  bool ranging;      // finding the range rather than counting
+  double min, max;   // the binned range, in axis units
+  double scale;      // bins per axis unit
+  AxisScale axis;    // the x axis, and its symlog threshold - the caller's
+  double threshold;  // settings aren't the workers' own
+  int bins;
+  uint64_t *lanes;   // per worker, HIST_LANES sets of bins + 1 counters
+  double *lows, *highs;  // per worker, the finite range seen
+  atomic_size_t next_block;
+  atomic_int next_worker;
+} HistJob;
+
+static void range_chunk(const double *v, size_t n, double *lo, double *hi)
+{
+  // widens [lo, hi] by the finite values
+  size_t i = 0;
+  double low = *lo, high = *hi;
+#ifdef __SSE2__
+  const __m128d inf = _mm_set1_pd(INFINITY), neg_inf = _mm_set1_pd(-INFINITY);
+  const __m128d magnitude = _mm_castsi128_pd(_mm_set1_epi64x(INT64_MAX));
+  __m128d lows = _mm_set1_pd(low), highs = _mm_set1_pd(high);
+  for (; i + 2 <= n; i += 2)
+  {
+    __m128d x = _mm_loadu_pd(v + i);
+    // NaN and infinities fail the test and stand in as the other extreme
+    __m128d finite = _mm_cmplt_pd(_mm_and_pd(x, magnitude), inf);
+    lows = _mm_min_pd(lows, _mm_or_pd(_mm_and_pd(finite, x),
+                                      _mm_andnot_pd(finite, inf)));
+    highs = _mm_max_pd(highs, _mm_or_pd(_mm_and_pd(finite, x),
+                                        _mm_andnot_pd(finite, neg_inf)));
+  }
+  double pair[2];
+  _mm_storeu_pd(pair, lows);
+  low = pair[0] < pair[1] ? pair[0] : pair[1];
+  _mm_storeu_pd(pair, highs);
+  high = pair[0] > pair[1] ? pair[0] : pair[1];
+#endif
+  for (; i < n; ++i)
+  {
+    if (!isfinite(v[i])) { continue; }
+    if (v[i] < low) { low = v[i]; }
+    if (v[i] > high) { high = v[i]; }
+  }
+  *lo = low;
+  *hi = high;
+}
+
+#ifdef __SSE2__
+static inline __m128i bin_pair(__m128d x, __m128d lo, __m128d hi,
+                               __m128d scale, __m128d last, __m128d outside)
+{
+  // the bins of two values in the low half, outside for ones out of range
+  __m128d in = _mm_and_pd(_mm_cmpge_pd(x, lo), _mm_cmple_pd(x, hi));
+  __m128d f = _mm_min_pd(_mm_mul_pd(_mm_sub_pd(x, lo), scale), last);
+  f = _mm_or_pd(_mm_and_pd(in, f), _mm_andnot_pd(in, outside));
+  return _mm_cvttpd_epi32(f);
+}
+#endif
+
+static void bin_chunk(const HistJob *job, const double *v, size_t n,
+                      uint64_t *lanes)
+{
+  // counts n values, bin `bins` of each lane takes the ones out of range
+  // and NaNs. the top of the range goes in the last bin
+  const int bins = job->bins;
+  const size_t stride = (size_t)bins + 1;
+  const double min = job->min, max = job->max, scale = job->scale;
+  uint64_t *lane[HIST_LANES] = {lanes, lanes + stride, lanes + 2 * stride,
+                                lanes + 3 * stride};
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128d lo = _mm_set1_pd(min), hi = _mm_set1_pd(max);
+  const __m128d mul = _mm_set1_pd(scale), last = _mm_set1_pd(bins - 1);
+  const __m128d outside = _mm_set1_pd(bins);
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i a = bin_pair(_mm_loadu_pd(v + i), lo, hi, mul, last, outside);
+    __m128i b = bin_pair(_mm_loadu_pd(v + i + 2), lo, hi, mul, last, outside);
+    int32_t k[4];
+    _mm_storeu_si128((__m128i *)k, _mm_unpacklo_epi64(a, b));
+    ++lane[0][k[0]];
+    ++lane[1][k[1]];
+    ++lane[2][k[2]];
+    ++lane[3][k[3]];
+  }
+#endif
+  for (; i < n; ++i)
+  {
+    int k = bins;
+    if (v[i] >= min && v[i] <= max)
+    {
+      double f = (v[i] - min) * scale;
+      k = f < bins - 1 ? (int)f : bins - 1;
+    }
+    ++lane[i % HIST_LANES][k];
+  }
+}
+
+static void *hist_worker(void *arg)
+{
+  // takes a block at a time until the values run out
+  HistJob *job = arg;
+  int slot = atomic_fetch_add(&job->next_worker, 1);
+  uint64_t *lanes = NULL;
+  if (!job->ranging)
+  {
+    lanes = job->lanes + (size_t)slot * HIST_LANES * (job->bins + 1);
+  }
+  double low = INFINITY, high = -INFINITY;
+  double buf[PLOT_CHUNK];
+  for (;;)
+  {
+    size_t block = atomic_fetch_add(&job->next_block, 1);
+    if (block >= (job->n + HIST_BLOCK - 1) / HIST_BLOCK) { break; }
+    size_t end = (block + 1) * HIST_BLOCK;
+    if (end > job->n) { end = job->n; }
+    for (size_t start = block * HIST_BLOCK; start < end; start += PLOT_CHUNK)
+    {
+      size_t count = end - start < PLOT_CHUNK ? end - start : PLOT_CHUNK;
+      const double *v = buf;
+      if (job->direct) { v = (const double *)job->values.data + start; }
+      else
+      {
+        load_chunk(job->values, start, count, buf);
+        if (job->axis != SCALE_LINEAR)
+        {
+          transform_chunk(buf, count, job->axis, job->threshold);
+        }
+      }
+      if (job->ranging) { range_chunk(v, count, &low, &high); }
+      else { bin_chunk(job, v, count, lanes); }
+    }
+  }
+  if (job->ranging)
+  {
+    job->lows[slot] = low;
+    job->highs[slot] = high;
+  }
+  return NULL;
+}
+
+static int hist_threads(void)
+{
+  // the most threads a histogram pass uses
+  return hist_thread_count > 0 ? hist_thread_count : cpu_count();
+}
+
+static int hist_run(HistJob *job)
+{
+  // the job over hist_threads() threads (fewer for a short array), returns
+  // how many worked on it
+  size_t blocks = (job->n + HIST_BLOCK - 1) / HIST_BLOCK;
+  int threads = hist_threads();
+  if ((size_t)threads > blocks) { threads = blocks > 0 ? (int)blocks : 1; }
+  job->axis = x_scale;
+  job->threshold = symlog_linear;
+  job->direct = job->values.type == PLOT_F64 &&
+                job->values.stride == sizeof(double) &&
+                job->values.validity == NULL && x_scale == SCALE_LINEAR;
+  atomic_init(&job->next_block, 0);
+  atomic_init(&job->next_worker, 0);
+  pthread_t *workers = trace_malloc(threads * sizeof *workers);
+  if (workers == NULL)
+  {
+    printf("ERROR: not enough memory for the histogram\n");
+    exit(1);
+  }
+  int started = 0;
+  for (; started < threads - 1; ++started)
+  {
+    if (pthread_create(&workers[started], NULL, hist_worker, job) != 0)
+    {  // fewer threads is fine, the rest of the blocks still get done
+      break;
+    }
+  }
+  hist_worker(job);
+  for (int i = 0; i < started; ++i) { pthread_join(workers[i], NULL); }
+  trace_free(workers);
+  return started + 1;
+}
+
+bool hist_range(PlotArray values, size_t n, double *min, double *max)
+{
+  // the finite values' range in x axis units, false if there are none
+  int most = hist_threads();
+  HistJob job = {.values = values, .n = n, .ranging = true};
+  job.lows = trace_malloc(most * sizeof *job.lows);
+  job.highs = trace_malloc(most * sizeof *job.highs);
+  if (job.lows == NULL || job.highs == NULL)
+  {
+    printf("ERROR: not enough memory for the histogram\n");
+    exit(1);
+  }
+  int workers = hist_run(&job);
+  *min = INFINITY;
+  *max = -INFINITY;
+  for (int i = 0; i < workers; ++i)
+  {
+    if (job.lows[i] < *min) { *min = job.lows[i]; }
+    if (job.highs[i] > *max) { *max = job.highs[i]; }
+  }
+  trace_free(job.lows);
+  trace_free(job.highs);
+  return *min <= *max;
+}
+
+size_t hist_count(PlotArray values, size_t n, double min, double max,
+                  int bins, uint64_t *counts)
+{
+  // counts how many values (in x axis units) fall in each of bins equal
+  // bins over [min, max], returns how many landed in one
+  HistJob job = {.values = values, .n = n, .min = min, .max = max,
+                 .scale = bins / (max - min), .bins = bins};
+  size_t lane_len = (size_t)HIST_LANES * (bins + 1);
+  const int most = hist_threads();
+  job.lanes = trace_malloc(most * lane_len * sizeof *job.lanes);
+  if (job.lanes == NULL)
+  {
+    printf("ERROR: not enough memory for the histogram\n");
+    exit(1);
+  }
+  memset(job.lanes, 0, most * lane_len * sizeof *job.lanes);
+  int workers = hist_run(&job);
+  size_t binned = 0;
+  for (int b = 0; b < bins; ++b)
+  {
+    uint64_t sum = 0;
+    for (int w = 0; w < workers; ++w)
+    {
+      const uint64_t *lanes = job.lanes + w * lane_len;
+      for (int l = 0; l < HIST_LANES; ++l)
+      {
+        sum += lanes[l * (bins + 1) + b];
+      }
+    }
+    counts[b] = sum;
+    binned += sum;
+  }
+  trace_free(job.lanes);
+  return binned;
+}
+
+int hist_bins(size_t n)
+{
+  // the rice rule, 2 n^(1/3) bins, kept to bars at least two pixels wide
+  int bins = (int)ceil(2 * cbrt((double)n));
+  if (bins > (PLOT_WIDTH) / 2) { bins = (PLOT_WIDTH) / 2; }
+  return bins < 1 ? 1 : bins;
+}
@@ -0,0 +1,262 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// spatial index - the points are counting sorted into a uniform grid over
+// the data once, then every render walks just the cells that overlap the
+// view. a cell whose whole box lands on one pixel is a single weighted
+// stamp, so zoomed out the cost goes with the cells on screen rather than
+// the points behind them
+
+#define INDEX_CELL_POINTS 32  // points per cell the grid aims for
+#define INDEX_MAX_GRID 1024   // cells along a side, 1M cells is ~40MB
+
+static void *index_alloc(size_t size)
+{
+  void *p = trace_malloc(size ? size : 1);
+  if (p == NULL)
+  {
+    printf("ERROR: not enough memory for the index\n");
+    exit(1);
+  }
+  return p;
+}
+
+static int cell_of(double v, double min, double size, int grid)
+{
+  // column (or row) of the grid holding v, past either end clamps to the
+  // edge cell
+  double k = (v - min) / size;
+  if (!(k >= 0)) { return 0; }
+  if (k >= grid) { return grid - 1; }
+  return (int)k;
+}
+
+static size_t cell_index(const PlotIndex *index, double x, double y)
+{
+  const Bounds r = index->bounds;
+  int cx = cell_of(x, r.min_x, index->cell_w, index->grid);
+  int cy = cell_of(y, r.min_y, index->cell_h, index->grid);
+  return (size_t)cy * index->grid + cx;
+}
+
+typedef struct
+{
+  double x, y;
+} IndexPoint;
+
+static int compare_x(const void *a, const void *b)
+{
+  double l = ((const IndexPoint *)a)->x, r = ((const IndexPoint *)b)->x;
+  return (l > r) - (l < r);
+}
+
+static void sort_cells(PlotIndex *index, size_t cells)
+{
+  // each cell's run goes in x order, so its points reach the column dedupe
+  // a pixel column at a time like sorted data does
+  size_t longest = 0;
+  for (size_t i = 0; i < cells; ++i)
+  {
+    size_t count = index->start[i + 1] - index->start[i];
+    if (count > longest) { longest = count; }
+  }
+  IndexPoint *run = index_alloc(longest * sizeof *run);
+  for (size_t i = 0; i < cells; ++i)
+  {
+    size_t first = index->start[i], count = index->start[i + 1] - first;
+    if (count < 2) { continue; }
+    double *x = index->x + first, *y = index->y + first;
+    if (count <= 32)
+    {  // most cells, insertion sort in place beats going through qsort
+      for (size_t k = 1; k < count; ++k)
+      {
+        double vx = x[k], vy = y[k];
+        size_t j = k;
+        for (; j > 0 && x[j - 1] > vx; --j)
+        {
+          x[j] = x[j - 1];
+          y[j] = y[j - 1];
+        }
+        x[j] = vx;
+        y[j] = vy;
+      }
+      continue;
+    }
+    for (size_t k = 0; k < count; ++k)
+    {
+      run[k] = (IndexPoint){x[k], y[k]};
+    }
+    qsort(run, count, sizeof *run, compare_x);
+    for (size_t k = 0; k < count; ++k)
+    {
+      x[k] = run[k].x;
+      y[k] = run[k].y;
+    }
+  }
+  trace_free(run);
+}
+
+PlotIndex *plot_index_build(PlotArray x, PlotArray y, size_t n)
+{
+  // three passes over the data - the range, points per cell, then copying
+  // each point into its cell's run. points with a NaN/inf/null coordinate
+  // are left out
+  PlotIndex *index = index_alloc(sizeof *index);
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  Bounds r = {INFINITY, -INFINITY, INFINITY, -INFINITY, false};
+  size_t kept = 0;
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
+  {
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_chunk(x, start, count, xs);
+    load_chunk(y, start, count, ys);
+    bounds_chunk(&r, xs, ys, count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      kept += isfinite(xs[i]) && isfinite(ys[i]);
+    }
+  }
+  if (kept == 0) { r.min_x = r.max_x = r.min_y = r.max_y = 0; }
+
+  int grid = (int)sqrt((double)kept / INDEX_CELL_POINTS);
+  if (grid < 1) { grid = 1; }
+  if (grid > INDEX_MAX_GRID) { grid = INDEX_MAX_GRID; }
+  size_t cells = (size_t)grid * grid;
+  index->n = kept;
+  index->grid = grid;
+  index->bounds = r;
+  index->cell_w = r.max_x > r.min_x ? (r.max_x - r.min_x) / grid : 1;
+  index->cell_h = r.max_y > r.min_y ? (r.max_y - r.min_y) / grid : 1;
+  index->x = index_alloc(kept * sizeof *index->x);
+  index->y = index_alloc(kept * sizeof *index->y);
+  index->start = index_alloc((cells + 1) * sizeof *index->start);
+  index->boxes = index_alloc(cells * sizeof *index->boxes);
+  memset(index->start, 0, (cells + 1) * sizeof *index->start);
+  for (size_t i = 0; i < cells; ++i)
+  {
+    index->boxes[i] = (Bounds){INFINITY, -INFINITY, INFINITY, -INFINITY,
+                               false};
+  }
+
+  // counts land one cell up so the running sum turns them into offsets
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
+  {
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_chunk(x, start, count, xs);
+    load_chunk(y, start, count, ys);
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (!isfinite(xs[i]) || !isfinite(ys[i])) { continue; }
+      ++index->start[cell_index(index, xs[i], ys[i]) + 1];
+    }
+  }
+  for (size_t i = 0; i < cells; ++i)
+  {
+    index->start[i + 1] += index->start[i];
+  }
+
+  // start[cell] is used as the write cursor, afterwards it's sitting on the
+  // next cell's start so everything shifts back up by one
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
+  {
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_chunk(x, start, count, xs);
+    load_chunk(y, start, count, ys);
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (!isfinite(xs[i]) || !isfinite(ys[i])) { continue; }
+      size_t cell = cell_index(index, xs[i], ys[i]);
+      size_t at = index->start[cell]++;
+      index->x[at] = xs[i];
+      index->y[at] = ys[i];
+      bounds_chunk(&index->boxes[cell], &xs[i], &ys[i], 1);
+    }
+  }
+  memmove(index->start + 1, index->start, cells * sizeof *index->start);
+  index->start[0] = 0;
+  sort_cells(index, cells);
+  return index;
+}
+
+void plot_index_free(PlotIndex *index)
+{
+  if (index == NULL) { return; }
+  trace_free(index->x);
+  trace_free(index->y);
+  trace_free(index->start);
+  trace_free(index->boxes);
+  trace_free(index);
+}
+
+size_t index_scatter(Canvas *c, const PlotIndex *index, Bounds b,
+                     Colour32 colour)
+{
+  // plots every cell overlapping the view. a cell wholly inside skips the
+  // cull, and if its box's corners fall on the same pixel every point in
+  // it does too (the axes are monotonic), so one stamp covers the lot
+  const Bounds window = cull_window(c, b);
+  const Bounds r = index->bounds;
+  const int grid = index->grid;
+  int cx0 = cell_of(window.min_x, r.min_x, index->cell_w, grid);
+  int cx1 = cell_of(window.max_x, r.min_x, index->cell_w, grid);
+  int cy0 = cell_of(window.min_y, r.min_y, index->cell_h, grid);
+  int cy1 = cell_of(window.max_y, r.min_y, index->cell_h, grid);
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  size_t drawn = 0;
+  // never reset between cells - a pixel it remembers really was stamped,
+  // and moving to another column clears it anyway
+  ColumnDedupe dedupe;
+  dedupe_reset(&dedupe);
+
+  for (int cy = cy0; cy <= cy1; ++cy)
+  {
+    for (int cx = cx0; cx <= cx1; ++cx)
+    {
+      size_t cell = (size_t)cy * grid + cx;
+      size_t first = index->start[cell], last = index->start[cell + 1];
+      const Bounds box = index->boxes[cell];
+      if (first == last || box.max_x < window.min_x ||
+          box.min_x > window.max_x || box.max_y < window.min_y ||
+          box.min_y > window.max_y)
+      {
+        continue;
+      }
+      bool inside = box.min_x >= window.min_x && box.max_x <= window.max_x &&
+                    box.min_y >= window.min_y && box.max_y <= window.max_y;
+      if (inside)
+      {
+        double corner_x[2] = {box.min_x, box.max_x};
+        double corner_y[2] = {box.min_y, box.max_y};
+        int32_t px[2], py[2];
+        pixel_chunk(c, b, corner_x, corner_y, 2, px, py);
+        if (px[0] == px[1] && py[0] == py[1] && px[0] != PIXEL_NONE &&
+            py[0] != PIXEL_NONE)
+        {
+          size_t count = last - first;
+          unsigned weight = count < UINT16_MAX ? (unsigned)count : UINT16_MAX;
+          if (stamp_weighted(c, px[0], py[0], weight, colour))
+          {
+            drawn += count;
+          }
+          continue;
+        }
+      }
+      for (size_t start = first; start < last; start += PLOT_CHUNK)
+      {
+        size_t count = last - start < PLOT_CHUNK ? last - start : PLOT_CHUNK;
+        memcpy(xs, index->x + start, count * sizeof *xs);
+        memcpy(ys, index->y + start, count * sizeof *ys);
+        drawn += scatter_chunk(c, b, xs, ys, count, inside ? NULL : &window,
+                               colour, &dedupe);
+      }
+    }
+  }
+  return drawn;
+}
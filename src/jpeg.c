@@ -0,0 +1,872 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// baseline jpeg encoder - integer colour conversion, the aan dct in 16 bit
+// integers (8 rows at a time with sse2) and quantisation folded into one
+// multiply per coefficient. a plot is mostly flat blocks, so a block that's
+// one value throughout skips the dct, and the entropy coder walks a bitmask
+// of the nonzero coefficients instead of all 63 of them. the image is cut
+// into bands of mcu rows with a restart marker between each, so the bands
+// encode on separate threads and only get joined end to end
+
+// natural order index of each zigzag position
+static const uint8_t zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// the example tables from annex k of the spec, natural order
+static const uint8_t luma_quant[64] = {
+    16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+static const uint8_t chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+// huffman tables as codes per length 1 to 16 then the symbols in order
+static const uint8_t dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1,
+                                         1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1,
+                                           1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3,
+                                         5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t ac_luma_values[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+    0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+    0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+    0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+static const uint8_t ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4,
+                                           7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t ac_chroma_values[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+    0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+    0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+// the aan dct leaves coefficient (v, u) scaled by 8 * s[v] * s[u], which
+// the quantiser takes back out
+static const double aan_scale[8] = {1.0,         1.387039845, 1.306562965,
+                                    1.175875602, 1.0,         0.785694958,
+                                    0.541196100, 0.275899379};
+
+// dct constants in q15, the 1.306 multiply is done as 0.306 plus one
+#define DCT_0_382 12540
+#define DCT_0_541 17734
+#define DCT_0_707 23170
+#define DCT_0_306 10045
+
+#define JPEG_MAX_CODED 1023  // largest magnitude a baseline ac code holds
+
+_Thread_local int jpeg_quality = 100;
+_Thread_local JpegSampling jpeg_sampling = JPEG_444;
+_Thread_local int jpeg_thread_count = 0;
+
+// restart bands an image is cut into, the most threads one image can use.
+// the cut doesn't depend on the thread count so neither does the file
+#define JPEG_BANDS 32
+// pixels below which another thread costs more to start than it saves, a
+// thumbnail is encoded on the calling thread whatever the count asked for
+#define JPEG_THREAD_PIXELS (1 << 17)
+
+typedef struct
+{
+  uint16_t code[256];
+  uint8_t size[256];
+} HuffTable;
+
+typedef struct
+{
+  uint8_t quant[2][64];  // zigzag order, as the header wants them
+  float scale[2][64];    // natural order, 1 / (quant * the dct's scale)
+  HuffTable dc[2], ac[2];
+} JpegTables;
+
+typedef struct
+{
+  uint8_t *out;
+  size_t len, cap;
+  uint64_t bits;  // pending bits, the oldest highest
+  int count;
+} JpegBits;
+
+#if defined(__GNUC__)
+static inline int bit_length(unsigned x)
+{
+  return x ? 32 - __builtin_clz(x) : 0;
+}
+#else
+static inline int bit_length(unsigned x)
+{
+  int n = 0;
+  while (x) { x >>= 1, ++n; }
+  return n;
+}
+#endif
+
+// USER FUNCTIONS
+void jpeg_options(int quality, JpegSampling sampling)
+{
+  if (quality < 1 || quality > 100)
+  {
+    printf("ERROR: jpeg quality must be 1 to 100\n");
+    exit(1);
+  }
+  jpeg_quality = quality;
+  jpeg_sampling = sampling;
+}
+
+void jpeg_threads(int threads)
+{
+  // threads to encode a .jpg with, 0 for one per core
+  jpeg_thread_count = threads < 0 ? 0 : threads;
+}
+
+// NON-USER FUNCTIONS
+static void build_huffman(HuffTable *t, const uint8_t *bits,
+                          const uint8_t *values)
+{
+  // the canonical codes for the counts per length (annex c)
+  unsigned code = 0;
+  int k = 0;
+  for (int len = 1; len <= 16; ++len)
+  {
+    for (int i = 0; i < bits[len - 1]; ++i, ++k)
+    {
+      t->code[values[k]] = (uint16_t)code++;
+      t->size[values[k]] = (uint8_t)len;
+    }
+    code <<= 1;
+  }
+}
+
+static void build_tables(JpegTables *t, int quality)
+{
+  // quality scales the annex k tables the way libjpeg does
+  quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+  int percent = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  const uint8_t *base[2] = {luma_quant, chroma_quant};
+  for (int c = 0; c < 2; ++c)
+  {
+    for (int k = 0; k < 64; ++k)
+    {
+      int natural = zigzag[k];
+      int q = (base[c][natural] * percent + 50) / 100;
+      q = q < 1 ? 1 : q > 255 ? 255 : q;
+      t->quant[c][k] = (uint8_t)q;
+      double dct = 8 * aan_scale[natural / 8] * aan_scale[natural % 8];
+      t->scale[c][natural] = (float)(1 / (q * dct));
+    }
+  }
+  build_huffman(&t->dc[0], dc_luma_bits, dc_values);
+  build_huffman(&t->dc[1], dc_chroma_bits, dc_values);
+  build_huffman(&t->ac[0], ac_luma_bits, ac_luma_values);
+  build_huffman(&t->ac[1], ac_chroma_bits, ac_chroma_values);
+}
+
+static void bits_reserve(JpegBits *w, size_t extra)
+{
+  if (w->len + extra <= w->cap) { return; }
+  size_t cap = w->cap ? w->cap * 2 : 1 << 16;
+  while (cap < w->len + extra) { cap *= 2; }
+  uint8_t *grown = trace_realloc(w->out, cap);
+  assert(grown != NULL);
+  w->out = grown;
+  w->cap = cap;
+}
+
+static void put_bytes(JpegBits *w, const void *data, size_t n)
+{
+  bits_reserve(w, n);
+  memcpy(w->out + w->len, data, n);
+  w->len += n;
+}
+
+static inline void put_bits(JpegBits *w, uint32_t value, int n)
+{
+  // n up to 27, whole bytes go out once 32 bits are waiting. a 0xFF in the
+  // entropy coded data gets a 0 after it so it can't read as a marker
+  w->bits = w->bits << n | value;
+  w->count += n;
+  if (w->count < 32) { return; }
+  uint32_t word = (uint32_t)(w->bits >> (w->count - 32));
+  uint8_t *at = w->out + w->len;
+  uint32_t inverse = ~word;
+  if (((inverse - 0x01010101u) & ~inverse & 0x80808080u) == 0)
+  {  // no 0xFF byte, the usual case
+    at[0] = (uint8_t)(word >> 24);
+    at[1] = (uint8_t)(word >> 16);
+    at[2] = (uint8_t)(word >> 8);
+    at[3] = (uint8_t)word;
+    w->len += 4;
+  }
+  else
+  {
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+      uint8_t byte = (uint8_t)(word >> shift);
+      w->out[w->len++] = byte;
+      if (byte == 0xFF) { w->out[w->len++] = 0; }
+    }
+  }
+  w->count -= 32;
+}
+
+static void flush_bits(JpegBits *w)
+{
+  // pads the last byte with ones, as the spec asks
+  int pad = (8 - w->count % 8) % 8;
+  put_bits(w, (1u << pad) - 1, pad);
+  while (w->count > 0)
+  {
+    uint8_t byte = (uint8_t)(w->bits >> (w->count - 8));
+    w->out[w->len++] = byte;
+    if (byte == 0xFF) { w->out[w->len++] = 0; }
+    w->count -= 8;
+  }
+}
+
+static inline void put_coded(JpegBits *w, const HuffTable *t, int symbol,
+                             int value, int size)
+{
+  // a huffman symbol then size bits of value, negatives as one less
+  uint32_t extra = (uint32_t)(value < 0 ? value - 1 : value);
+  extra &= (1u << size) - 1;
+  put_bits(w, (uint32_t)t->code[symbol] << size | extra,
+           t->size[symbol] + size);
+}
+
+#ifdef __SSE2__
+static inline __m128i dct_mul(__m128i x, short c)
+{
+  // x * c for a q15 constant - the shift keeps the product's top half
+  return _mm_mulhi_epi16(_mm_slli_epi16(x, 1), _mm_set1_epi16(c));
+}
+
+static void dct_pass(__m128i *d)
+{
+  // one 1d aan pass over 8 vectors, each lane its own row or column
+  __m128i tmp0 = _mm_add_epi16(d[0], d[7]), tmp7 = _mm_sub_epi16(d[0], d[7]);
+  __m128i tmp1 = _mm_add_epi16(d[1], d[6]), tmp6 = _mm_sub_epi16(d[1], d[6]);
+  __m128i tmp2 = _mm_add_epi16(d[2], d[5]), tmp5 = _mm_sub_epi16(d[2], d[5]);
+  __m128i tmp3 = _mm_add_epi16(d[3], d[4]), tmp4 = _mm_sub_epi16(d[3], d[4]);
+
+  __m128i tmp10 = _mm_add_epi16(tmp0, tmp3), tmp13 = _mm_sub_epi16(tmp0, tmp3);
+  __m128i tmp11 = _mm_add_epi16(tmp1, tmp2), tmp12 = _mm_sub_epi16(tmp1, tmp2);
+  d[0] = _mm_add_epi16(tmp10, tmp11);
+  d[4] = _mm_sub_epi16(tmp10, tmp11);
+  __m128i z1 = dct_mul(_mm_add_epi16(tmp12, tmp13), DCT_0_707);
+  d[2] = _mm_add_epi16(tmp13, z1);
+  d[6] = _mm_sub_epi16(tmp13, z1);
+
+  tmp10 = _mm_add_epi16(tmp4, tmp5);
+  tmp11 = _mm_add_epi16(tmp5, tmp6);
+  tmp12 = _mm_add_epi16(tmp6, tmp7);
+  __m128i z5 = dct_mul(_mm_sub_epi16(tmp10, tmp12), DCT_0_382);
+  __m128i z2 = _mm_add_epi16(dct_mul(tmp10, DCT_0_541), z5);
+  __m128i z4 = _mm_add_epi16(
+      _mm_add_epi16(dct_mul(tmp12, DCT_0_306), tmp12), z5);
+  __m128i z3 = dct_mul(tmp11, DCT_0_707);
+  __m128i z11 = _mm_add_epi16(tmp7, z3), z13 = _mm_sub_epi16(tmp7, z3);
+  d[5] = _mm_add_epi16(z13, z2);
+  d[3] = _mm_sub_epi16(z13, z2);
+  d[1] = _mm_add_epi16(z11, z4);
+  d[7] = _mm_sub_epi16(z11, z4);
+}
+
+static void transpose(__m128i *r)
+{
+  __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+  __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+  __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+  __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+  __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static void forward_dct(const int16_t *rows, ptrdiff_t stride,
+                        const float *scale, int16_t *out)
+{
+  // dct and quantise one block, out in natural order. the rows are
+  // transposed so each pass runs down the lanes
+  __m128i d[8];
+  for (int i = 0; i < 8; ++i)
+  {
+    d[i] = _mm_loadu_si128((const __m128i *)(rows + i * stride));
+  }
+  transpose(d);
+  dct_pass(d);
+  transpose(d);
+  dct_pass(d);
+  const __m128i limit = _mm_set1_epi16(JPEG_MAX_CODED);
+  for (int i = 0; i < 8; ++i)
+  {
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(d[i], d[i]), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(d[i], d[i]), 16);
+    __m128 flo = _mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_loadu_ps(scale + 8 * i));
+    __m128 fhi =
+        _mm_mul_ps(_mm_cvtepi32_ps(hi), _mm_loadu_ps(scale + 8 * i + 4));
+    __m128i q = _mm_packs_epi32(_mm_cvtps_epi32(flo), _mm_cvtps_epi32(fhi));
+    q = _mm_min_epi16(q, limit);
+    q = _mm_max_epi16(q, _mm_sub_epi16(_mm_setzero_si128(), limit));
+    _mm_storeu_si128((__m128i *)(out + 8 * i), q);
+  }
+}
+
+static bool flat_block(const int16_t *rows, ptrdiff_t stride)
+{
+  // every sample the same as the first
+  __m128i first = _mm_set1_epi16(rows[0]);
+  __m128i same = _mm_set1_epi16(-1);
+  for (int i = 0; i < 8; ++i)
+  {
+    __m128i row = _mm_loadu_si128((const __m128i *)(rows + i * stride));
+    same = _mm_and_si128(same, _mm_cmpeq_epi16(row, first));
+  }
+  return _mm_movemask_epi8(same) == 0xFFFF;
+}
+
+static uint64_t nonzero_mask(const int16_t *zz)
+{
+  // bit k set if zigzag coefficient k isn't zero
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; i += 16)
+  {
+    __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(zz + i)),
+                                zero);
+    __m128i b = _mm_cmpeq_epi16(
+        _mm_loadu_si128((const __m128i *)(zz + i + 8)), zero);
+    unsigned zeros = (unsigned)_mm_movemask_epi8(_mm_packs_epi16(a, b));
+    mask |= (uint64_t)(~zeros & 0xFFFF) << i;
+  }
+  return mask;
+}
+#else
+static inline int dct_mul(int x, int c) { return (x * c) >> 15; }
+
+static void dct_pass(int16_t *d, int step)
+{
+  // one 1d aan pass over d[0], d[step], ... d[7 * step]
+  int tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+  int tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+  int tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+  int tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+  int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+  int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+  d[0] = (int16_t)(tmp10 + tmp11);
+  d[4 * step] = (int16_t)(tmp10 - tmp11);
+  int z1 = dct_mul(tmp12 + tmp13, DCT_0_707);
+  d[2 * step] = (int16_t)(tmp13 + z1);
+  d[6 * step] = (int16_t)(tmp13 - z1);
+
+  tmp10 = tmp4 + tmp5;
+  tmp11 = tmp5 + tmp6;
+  tmp12 = tmp6 + tmp7;
+  int z5 = dct_mul(tmp10 - tmp12, DCT_0_382);
+  int z2 = dct_mul(tmp10, DCT_0_541) + z5;
+  int z4 = dct_mul(tmp12, DCT_0_306) + tmp12 + z5;
+  int z3 = dct_mul(tmp11, DCT_0_707);
+  int z11 = tmp7 + z3, z13 = tmp7 - z3;
+  d[5 * step] = (int16_t)(z13 + z2);
+  d[3 * step] = (int16_t)(z13 - z2);
+  d[step] = (int16_t)(z11 + z4);
+  d[7 * step] = (int16_t)(z11 - z4);
+}
+
+static void forward_dct(const int16_t *rows, ptrdiff_t stride,
+                        const float *scale, int16_t *out)
+{
+  for (int i = 0; i < 8; ++i)
+  {
+    memcpy(out + 8 * i, rows + i * stride, 8 * sizeof *out);
+    dct_pass(out + 8 * i, 1);
+  }
+  for (int i = 0; i < 8; ++i) { dct_pass(out + i, 8); }
+  for (int i = 0; i < 64; ++i)
+  {
+    long q = lrintf(out[i] * scale[i]);
+    if (q > JPEG_MAX_CODED) { q = JPEG_MAX_CODED; }
+    if (q < -JPEG_MAX_CODED) { q = -JPEG_MAX_CODED; }
+    out[i] = (int16_t)q;
+  }
+}
+
+static bool flat_block(const int16_t *rows, ptrdiff_t stride)
+{
+  for (int i = 0; i < 8; ++i)
+  {
+    for (int j = 0; j < 8; ++j)
+    {
+      if (rows[i * stride + j] != rows[0]) { return false; }
+    }
+  }
+  return true;
+}
+
+static uint64_t nonzero_mask(const int16_t *zz)
+{
+  uint64_t mask = 0;
+  for (int k = 0; k < 64; ++k) { mask |= (uint64_t)(zz[k] != 0) << k; }
+  return mask;
+}
+#endif
+
+#if defined(__GNUC__)
+static inline int lowest_bit(uint64_t x) { return __builtin_ctzll(x); }
+#else
+static inline int lowest_bit(uint64_t x)
+{
+  int n = 0;
+  while (!(x & 1)) { x >>= 1, ++n; }
+  return n;
+}
+#endif
+
+static void encode_block(JpegBits *w, const JpegTables *t, int c,
+                         const int16_t *rows, ptrdiff_t stride, int *dc)
+{
+  // one 8x8 block of component table c, dc is the previous block's
+  bits_reserve(w, 512);  // the most a block can take, stuffing and all
+  if (flat_block(rows, stride))
+  {  // only the dc term, which the dct would make 64 times the sample
+    long q = lrintf(64 * rows[0] * t->scale[c][0]);
+    q = q > JPEG_MAX_CODED ? JPEG_MAX_CODED : q;
+    q = q < -JPEG_MAX_CODED ? -JPEG_MAX_CODED : q;
+    int diff = (int)q - *dc;
+    *dc = (int)q;
+    int size = bit_length((unsigned)abs(diff));
+    put_coded(w, &t->dc[c], size, diff, size);
+    put_coded(w, &t->ac[c], 0x00, 0, 0);
+    return;
+  }
+  int16_t natural[64], zz[64];
+  forward_dct(rows, stride, t->scale[c], natural);
+  for (int k = 0; k < 64; ++k) { zz[k] = natural[zigzag[k]]; }
+
+  int diff = zz[0] - *dc;
+  *dc = zz[0];
+  int size = bit_length((unsigned)abs(diff));
+  put_coded(w, &t->dc[c], size, diff, size);
+
+  uint64_t mask = nonzero_mask(zz) & ~(uint64_t)1;
+  int last = 0;
+  while (mask != 0)
+  {
+    int k = lowest_bit(mask);
+    mask &= mask - 1;
+    int run = k - last - 1;
+    for (; run >= 16; run -= 16) { put_coded(w, &t->ac[c], 0xF0, 0, 0); }
+    size = bit_length((unsigned)abs(zz[k]));
+    put_coded(w, &t->ac[c], run << 4 | size, zz[k], size);
+    last = k;
+  }
+  if (last != 63) { put_coded(w, &t->ac[c], 0x00, 0, 0); }
+}
+
+#ifdef __SSE2__
+static inline __m128i channel_sum(__m128i rg, __m128i b, __m128i rg_weights,
+                                  __m128i b_weights)
+{
+  // four weighted sums of r, g and b in 15 bit fixed point, rg holding the
+  // pairs (r, g) and b the pairs (b, 0) in 16 bit lanes
+  return _mm_add_epi32(_mm_madd_epi16(rg, rg_weights),
+                       _mm_madd_epi16(b, b_weights));
+}
+
+static inline __m128i weights(int first, int second)
+{
+  return _mm_set1_epi32((int)((uint32_t)second << 16 | (uint16_t)first));
+}
+
+static inline __m128i load_pixels(const uint8_t *p)
+{
+  // four rgb pixels, one to each 32 bit lane with a stray byte on top
+  uint32_t px[4];
+  for (int i = 0; i < 4; ++i) { memcpy(&px[i], p + 3 * i, 4); }
+  return _mm_set_epi32((int)px[3], (int)px[2], (int)px[1], (int)px[0]);
+}
+#endif
+
+static inline bool repeats(const uint8_t *p)
+{
+  // the 8 rgb pixels at p are the 8 just before them
+  uint64_t now[3], before[3];
+  memcpy(now, p, sizeof now);
+  memcpy(before, p - sizeof before, sizeof before);
+  return ((now[0] ^ before[0]) | (now[1] ^ before[1]) |
+          (now[2] ^ before[2])) == 0;
+}
+
+static void convert_rows(const uint8_t *rgb, int w, int h, int y0, int rows,
+                         int padded, int16_t *planes[3])
+{
+  // rgb rows y0 on to centred y, cb and cr (jfif, 15 bit fixed point),
+  // repeating the last column and row out to the block edges
+  for (int r = 0; r < rows; ++r)
+  {
+    int y = y0 + r < h ? y0 + r : h - 1;
+    const uint8_t *p = rgb + (size_t)y * w * 3;
+    int16_t *luma = planes[0] + (size_t)r * padded;
+    int16_t *cb = planes[1] + (size_t)r * padded;
+    int16_t *cr = planes[2] + (size_t)r * padded;
+    int x = 0;
+#ifdef __SSE2__
+    // eight pixels at a time, red and green share one multiply-add. a load
+    // takes a byte past its pixel, so the last pixel of a row is left over
+    const __m128i y_rg = weights(9798, 19235), y_b = weights(3736, 0);
+    const __m128i cb_rg = weights(-5529, -10855), cb_b = weights(16384, 0);
+    const __m128i cr_rg = weights(16384, -13720), cr_b = weights(-2664, 0);
+    const __m128i low = _mm_set1_epi32(0xFF), high = _mm_set1_epi32(0xFF0000);
+    const __m128i round = _mm_set1_epi32(1 << 14);
+    const __m128i centre = _mm_set1_epi16(128);
+    for (; x + 8 < w; x += 8)
+    {
+      if (x > 0 && repeats(p + 3 * x))
+      {  // the same eight pixels as last time, a flat stretch of the plot
+        for (int c = 0; c < 3; ++c)
+        {
+          int16_t *plane = c == 0 ? luma : c == 1 ? cb : cr;
+          memcpy(plane + x, plane + x - 8, 8 * sizeof *plane);
+        }
+        continue;
+      }
+      __m128i sums[3][2];
+      for (int half = 0; half < 2; ++half)
+      {
+        __m128i px = load_pixels(p + 3 * (x + 4 * half));
+        __m128i rg = _mm_or_si128(_mm_and_si128(px, low),
+                                  _mm_and_si128(_mm_slli_epi32(px, 8), high));
+        __m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), low);
+        sums[0][half] = channel_sum(rg, b, y_rg, y_b);
+        sums[1][half] = channel_sum(rg, b, cb_rg, cb_b);
+        sums[2][half] = channel_sum(rg, b, cr_rg, cr_b);
+      }
+      __m128i out[3];
+      for (int c = 0; c < 3; ++c)
+      {
+        out[c] = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_add_epi32(sums[c][0], round), 15),
+            _mm_srai_epi32(_mm_add_epi32(sums[c][1], round), 15));
+      }
+      _mm_storeu_si128((__m128i *)(luma + x), _mm_sub_epi16(out[0], centre));
+      _mm_storeu_si128((__m128i *)(cb + x), out[1]);
+      _mm_storeu_si128((__m128i *)(cr + x), out[2]);
+    }
+#endif
+    for (; x < w; ++x)
+    {
+      int red = p[3 * x], green = p[3 * x + 1], blue = p[3 * x + 2];
+      luma[x] =
+          (int16_t)(((9798 * red + 19235 * green + 3736 * blue + (1 << 14)) >>
+                     15) -
+                    128);
+      cb[x] = (int16_t)((-5529 * red - 10855 * green + 16384 * blue +
+                         (1 << 14)) >>
+                        15);
+      cr[x] = (int16_t)((16384 * red - 13720 * green - 2664 * blue +
+                         (1 << 14)) >>
+                        15);
+    }
+    for (; x < padded; ++x)
+    {
+      luma[x] = luma[w - 1];
+      cb[x] = cb[w - 1];
+      cr[x] = cr[w - 1];
+    }
+  }
+}
+
+static void subsample(int16_t *plane, int padded)
+{
+  // 16 rows down to 8 rows of half the width in place, each the rounded
+  // mean of a 2x2 square
+  for (int r = 0; r < 8; ++r)
+  {
+    const int16_t *top = plane + (size_t)(2 * r) * padded;
+    const int16_t *bottom = top + padded;
+    int16_t *out = plane + (size_t)r * padded;
+    int x = 0;
+#ifdef __SSE2__
+    // pairs summed by a multiply-add with ones, 8 outputs a go. the writes
+    // stay behind the reads, row 0 being done in place
+    const __m128i ones = _mm_set1_epi16(1), two = _mm_set1_epi32(2);
+    for (; x + 8 <= padded / 2; x += 8)
+    {
+      __m128i sums[2];
+      for (int i = 0; i < 2; ++i)
+      {
+        __m128i t = _mm_loadu_si128((const __m128i *)(top + 2 * x + 8 * i));
+        __m128i b =
+            _mm_loadu_si128((const __m128i *)(bottom + 2 * x + 8 * i));
+        sums[i] = _mm_add_epi32(_mm_madd_epi16(t, ones),
+                                _mm_madd_epi16(b, ones));
+        sums[i] = _mm_srai_epi32(_mm_add_epi32(sums[i], two), 2);
+      }
+      _mm_storeu_si128((__m128i *)(out + x),
+                       _mm_packs_epi32(sums[0], sums[1]));
+    }
+#endif
+    for (; x < padded / 2; ++x)
+    {
+      int sum = top[2 * x] + top[2 * x + 1] + bottom[2 * x] +
+                bottom[2 * x + 1];
+      out[x] = (int16_t)((sum + 2) >> 2);
+    }
+  }
+}
+
+static void put_marker(JpegBits *w, uint8_t marker, const uint8_t *data,
+                       int len)
+{
+  uint8_t head[4] = {0xFF, marker, (uint8_t)((len + 2) >> 8),
+                     (uint8_t)(len + 2)};
+  put_bytes(w, head, 4);
+  put_bytes(w, data, len);
+}
+
+static void put_huffman(JpegBits *w, int id, const uint8_t *bits,
+                        const uint8_t *values, int count)
+{
+  uint8_t table[1 + 16 + 162];
+  table[0] = (uint8_t)id;
+  memcpy(table + 1, bits, 16);
+  memcpy(table + 17, values, count);
+  put_marker(w, 0xC4, table, 17 + count);
+}
+
+static void put_headers(JpegBits *w, const JpegTables *t, int width,
+                        int height, bool subsampled, int restart)
+{
+  // restart is the mcus between restart markers, 0 for none
+  static const uint8_t soi[2] = {0xFF, 0xD8};
+  static const uint8_t jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0,
+                                   0,   1,   0,   1,   0, 0};
+  put_bytes(w, soi, 2);
+  put_marker(w, 0xE0, jfif, 14);
+  uint8_t dqt[2 * 65];
+  for (int c = 0; c < 2; ++c)
+  {
+    dqt[65 * c] = (uint8_t)c;
+    memcpy(dqt + 65 * c + 1, t->quant[c], 64);
+  }
+  put_marker(w, 0xDB, dqt, 2 * 65);
+  uint8_t sof[15] = {8,
+                     (uint8_t)(height >> 8),
+                     (uint8_t)height,
+                     (uint8_t)(width >> 8),
+                     (uint8_t)width,
+                     3,
+                     1,
+                     subsampled ? 0x22 : 0x11,
+                     0,
+                     2,
+                     0x11,
+                     1,
+                     3,
+                     0x11,
+                     1};
+  put_marker(w, 0xC0, sof, 15);
+  put_huffman(w, 0x00, dc_luma_bits, dc_values, 12);
+  put_huffman(w, 0x10, ac_luma_bits, ac_luma_values, 162);
+  put_huffman(w, 0x01, dc_chroma_bits, dc_values, 12);
+  put_huffman(w, 0x11, ac_chroma_bits, ac_chroma_values, 162);
+  if (restart > 0)
+  {
+    uint8_t dri[2] = {(uint8_t)(restart >> 8), (uint8_t)restart};
+    put_marker(w, 0xDD, dri, 2);
+  }
+  static const uint8_t sos[10] = {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+  put_marker(w, 0xDA, sos, 10);
+}
+
+typedef struct
+{
+  const uint8_t *rgb;
+  int w, h;
+  const JpegTables *t;
+  bool subsampled;
+  int band_rows;  // pixel rows in a band, a whole number of mcus
+  int bands;
+  JpegBits *out;  // each band's entropy coded bytes
+  atomic_int next_band;
+} JpegJob;
+
+static void encode_band(const JpegJob *job, int band, int16_t **planes)
+{
+  // one restart interval - the dc predictions start over from 0 and the
+  // last byte is padded out so a marker can follow it
+  const bool subsampled = job->subsampled;
+  const int mcu = subsampled ? 16 : 8;
+  const int padded = (job->w + mcu - 1) / mcu * mcu;
+  const JpegTables *t = job->t;
+  JpegBits *bits = &job->out[band];
+  int dc[3] = {0, 0, 0};
+  int y0 = band * job->band_rows;
+  int y1 = y0 + job->band_rows < job->h ? y0 + job->band_rows : job->h;
+  for (int y = y0; y < y1; y += mcu)
+  {
+    convert_rows(job->rgb, job->w, job->h, y, mcu, padded, planes);
+    if (subsampled)
+    {
+      subsample(planes[1], padded);
+      subsample(planes[2], padded);
+    }
+    for (int x = 0; x < padded; x += mcu)
+    {
+      const int16_t *luma = planes[0] + x;
+      encode_block(bits, t, 0, luma, padded, &dc[0]);
+      if (subsampled)
+      {
+        encode_block(bits, t, 0, luma + 8, padded, &dc[0]);
+        encode_block(bits, t, 0, luma + 8 * padded, padded, &dc[0]);
+        encode_block(bits, t, 0, luma + 8 * padded + 8, padded, &dc[0]);
+      }
+      int cx = subsampled ? x / 2 : x;
+      encode_block(bits, t, 1, planes[1] + cx, padded, &dc[1]);
+      encode_block(bits, t, 1, planes[2] + cx, padded, &dc[2]);
+    }
+  }
+  bits_reserve(bits, 16);
+  flush_bits(bits);
+}
+
+static void *jpeg_worker(void *arg)
+{
+  // takes a band at a time until they run out, with its own rows of
+  // converted samples
+  JpegJob *job = arg;
+  const int mcu = job->subsampled ? 16 : 8;
+  const size_t plane = (size_t)mcu * ((job->w + mcu - 1) / mcu * mcu);
+  int16_t *buffer = trace_malloc(3 * plane * sizeof *buffer);
+  assert(buffer != NULL);
+  int16_t *planes[3] = {buffer, buffer + plane, buffer + 2 * plane};
+  for (;;)
+  {
+    int band = atomic_fetch_add(&job->next_band, 1);
+    if (band >= job->bands) { break; }
+    encode_band(job, band, planes);
+  }
+  trace_free(buffer);
+  return NULL;
+}
+
+uint8_t *encode_jpeg(const uint8_t *rgb, int w, int h, int quality,
+                     JpegSampling sampling, int threads, size_t *len)
+{
+  // a baseline jfif file using up to threads threads (0 for one per core),
+  // free the result with trace_free()
+  uint64_t t0 = trace_begin();
+  JpegTables t;
+  build_tables(&t, quality);
+  bool subsampled = sampling == JPEG_420;
+  const int mcu = subsampled ? 16 : 8;
+  const int mcu_cols = (w + mcu - 1) / mcu;
+  const int mcu_rows = (h + mcu - 1) / mcu;
+  int band_mcus = (mcu_rows + JPEG_BANDS - 1) / JPEG_BANDS;
+  if (band_mcus * mcu_cols > 0xFFFF) { band_mcus = 0xFFFF / mcu_cols; }
+  const int bands = (mcu_rows + band_mcus - 1) / band_mcus;
+  JpegJob job = {rgb, w, h, &t, subsampled, band_mcus * mcu, bands, NULL, 0};
+  job.out = trace_malloc(bands * sizeof *job.out);
+  assert(job.out != NULL);
+  memset(job.out, 0, bands * sizeof *job.out);
+
+  if (threads < 1) { threads = cpu_count(); }
+  if (threads > bands) { threads = bands; }
+  int most = (int)((size_t)w * h / JPEG_THREAD_PIXELS);
+  if (threads > most) { threads = most > 1 ? most : 1; }
+  pthread_t workers[JPEG_BANDS];
+  int started = 0;
+  for (; started < threads - 1 && started < JPEG_BANDS; ++started)
+  {
+    if (pthread_create(&workers[started], NULL, jpeg_worker, &job) != 0)
+    {  // fewer threads is fine, the rest of the bands still get done
+      break;
+    }
+  }
+  jpeg_worker(&job);
+  for (int i = 0; i < started; ++i) { pthread_join(workers[i], NULL); }
+
+  JpegBits bits = {0};
+  put_headers(&bits, &t, w, h, subsampled,
+              bands > 1 ? band_mcus * mcu_cols : 0);
+  size_t total = 2;
+  for (int i = 0; i < bands; ++i) { total += job.out[i].len + 2; }
+  bits_reserve(&bits, total);
+  for (int i = 0; i < bands; ++i)
+  {
+    if (i > 0)
+    {  // rst0 to rst7 in turn
+      uint8_t rst[2] = {0xFF, (uint8_t)(0xD0 + (i - 1) % 8)};
+      put_bytes(&bits, rst, 2);
+    }
+    put_bytes(&bits, job.out[i].out, job.out[i].len);
+    trace_free(job.out[i].out);
+  }
+  static const uint8_t eoi[2] = {0xFF, 0xD9};
+  put_bytes(&bits, eoi, 2);
+  trace_free(job.out);
+
+  *len = bits.len;
+  trace_count(COUNT_ENCODED, bits.len);
+  trace_end(TRACE_ENCODE, t0);
+  return bits.out;
+}
@@ -0,0 +1,241 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+static void add_span(Stamp *stamp, int dy, int dx0, int dx1)
+{
+  stamp->spans[stamp->count++] = (Span){(int8_t)dy, (int8_t)dx0, (int8_t)dx1};
+  if (abs(dy) > stamp->radius) { stamp->radius = abs(dy); }
+  if (-dx0 > stamp->radius) { stamp->radius = -dx0; }
+  if (dx1 > stamp->radius) { stamp->radius = dx1; }
+}
+
+void build_stamp(Marker shape, int size, Stamp *stamp)
+{
+  // turning a marker shape of the given size (distance from the centre to
+  // the edge in pixels) into its row spans
+  if (size < 0) { size = 0; }
+  if (size > STAMP_MAX_RADIUS) { size = STAMP_MAX_RADIUS; }
+  int half_width = size / 4;  // line thickness of the plus and cross
+  stamp->count = 0;
+  stamp->radius = 0;
+
+  if (shape == MARKER_PIXEL)
+  {
+    add_span(stamp, 0, 0, 0);
+    return;
+  }
+  for (int dy = -size; dy <= size; ++dy)
+  {
+    int ady = abs(dy);
+    switch (shape)
+    {
+    case MARKER_CIRCLE:
+    {
+      int dx = (int)sqrt((size + 0.5) * (size + 0.5) - dy * dy);
+      add_span(stamp, dy, -dx, dx);
+      break;
+    }
+    case MARKER_CROSS:
+      if (ady <= half_width)
+      {  // the two arms overlap near the centre
+        add_span(stamp, dy, -ady - half_width, ady + half_width);
+      }
+      else
+      {
+        add_span(stamp, dy, -ady - half_width, -ady + half_width);
+        add_span(stamp, dy, ady - half_width, ady + half_width);
+      }
+      break;
+    case MARKER_PLUS:
+      if (ady <= half_width) { add_span(stamp, dy, -size, size); }
+      else { add_span(stamp, dy, -half_width, half_width); }
+      break;
+    case MARKER_DIAMOND:
+      add_span(stamp, dy, -(size - ady), size - ady);
+      break;
+    case MARKER_SQUARE:
+    default:
+      add_span(stamp, dy, -size, size);
+      break;
+    }
+  }
+}
+
+static inline void fill_span(const StampTarget *target, ptrdiff_t at, int x0,
+                             int x1, Colour32 colour)
+{
+  // one run of a stamp, at is the row start's offset into the image
+  if (target->counts == NULL && target->indices != NULL)
+  {
+    uint8_t *row = target->indices + at;
+    for (int x = x0; x <= x1; ++x) { row[x] = target->index; }
+  }
+  else if (target->counts == NULL)
+  {
+    Colour32 *row = target->pixels + at;
+    for (int x = x0; x <= x1; ++x) { row[x] = colour; }
+  }
+  else
+  {  // saturating so a very dense pixel can't wrap back to empty
+    uint16_t *row = target->counts + at;
+    const unsigned w = target->weight;
+    for (int x = x0; x <= x1; ++x)
+    {
+      unsigned hits = row[x] + w;
+      row[x] = (uint16_t)(hits < UINT16_MAX ? hits : UINT16_MAX);
+    }
+  }
+}
+
+size_t stamp_points(const StampTarget *target, const Stamp *stamp,
+                    const int32_t *xval, const int32_t *yval, size_t n,
+                    Colour32 colour)
+{
+  // stamps every point onto the target, returns how many landed in the
+  // clip rectangle. a stamp that fits inside the clip is written span by
+  // span with no checks, only ones hanging over an edge get trimmed.
+  const Rect clip = target->clip;
+  const int r = stamp->radius;
+  const Span *spans = stamp->spans;
+  const int count = stamp->count;
+  size_t drawn = 0;
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (xval[i] == PIXEL_NONE || yval[i] == PIXEL_NONE) { continue; }
+    int cx = target->origin_x + xval[i];
+    int cy = target->origin_y - yval[i];
+    if (cx + r < clip.x0 || cx - r > clip.x1 || cy + r < clip.y0 ||
+        cy - r > clip.y1)
+    {  // nothing of it is visible
+      continue;
+    }
+    ++drawn;
+
+    if (cx - r >= clip.x0 && cx + r <= clip.x1 && cy - r >= clip.y0 &&
+        cy + r <= clip.y1)
+    {
+      for (int s = 0; s < count; ++s)
+      {
+        ptrdiff_t at = (ptrdiff_t)(cy + spans[s].dy) * target->stride + cx;
+        fill_span(target, at, spans[s].dx0, spans[s].dx1, colour);
+      }
+      continue;
+    }
+
+    for (int s = 0; s < count; ++s)
+    {
+      int y = cy + spans[s].dy;
+      if (y < clip.y0 || y > clip.y1) { continue; }
+      int x0 = cx + spans[s].dx0, x1 = cx + spans[s].dx1;
+      if (x0 < clip.x0) { x0 = clip.x0; }
+      if (x1 > clip.x1) { x1 = clip.x1; }
+      fill_span(target, (ptrdiff_t)y * target->stride, x0, x1, colour);
+    }
+  }
+  return drawn;
+}
+
+bool stamp_column(const StampTarget *target, const Stamp *stamp, int32_t xval,
+                  int32_t y0, int32_t y1, Colour32 colour)
+{
+  // the marker dragged from plot row y0 up to y1 in one go, each image row
+  // written once so a translucent column is a single hit. a row takes the
+  // widest reach of every stamp row that passes over it, exact for the
+  // convex shapes and a touch generous at the ends of a plus or cross
+  const Rect clip = target->clip;
+  const int r = stamp->radius;
+  int reach0[2 * STAMP_MAX_RADIUS + 1], reach1[2 * STAMP_MAX_RADIUS + 1];
+  for (int dy = -r; dy <= r; ++dy)
+  {
+    reach0[dy + r] = INT32_MAX;
+    reach1[dy + r] = INT32_MIN;
+  }
+  for (int s = 0; s < stamp->count; ++s)
+  {
+    const Span span = stamp->spans[s];
+    if (span.dx0 < reach0[span.dy + r]) { reach0[span.dy + r] = span.dx0; }
+    if (span.dx1 > reach1[span.dy + r]) { reach1[span.dy + r] = span.dx1; }
+  }
+
+  int cx = target->origin_x + xval;
+  int top = target->origin_y - y1, bottom = target->origin_y - y0;
+  int first = top - r > clip.y0 ? top - r : clip.y0;
+  int last = bottom + r < clip.y1 ? bottom + r : clip.y1;
+  if (cx + r < clip.x0 || cx - r > clip.x1 || first > last) { return false; }
+  for (int y = first; y <= last; ++y)
+  {
+    // stamp rows dy with y - dy inside [top, bottom]
+    int lo = y - bottom > -r ? y - bottom : -r;
+    int hi = y - top < r ? y - top : r;
+    int x0 = INT32_MAX, x1 = INT32_MIN;
+    for (int dy = lo; dy <= hi; ++dy)
+    {
+      if (reach0[dy + r] < x0) { x0 = reach0[dy + r]; }
+      if (reach1[dy + r] > x1) { x1 = reach1[dy + r]; }
+    }
+    if (x0 > x1) { continue; }
+    x0 = cx + x0 > clip.x0 ? cx + x0 : clip.x0;
+    x1 = cx + x1 < clip.x1 ? cx + x1 : clip.x1;
+    if (x0 <= x1)
+    {
+      fill_span(target, (ptrdiff_t)y * target->stride, x0, x1, colour);
+    }
+  }
+  return true;
+}
+
+void dedupe_reset(ColumnDedupe *dedupe)
+{
+  memset(dedupe->rows, 0, sizeof dedupe->rows);
+  dedupe->column = PIXEL_NONE;
+  dedupe->marked_count = 0;
+}
+
+size_t dedupe_columns(ColumnDedupe *dedupe, const StampTarget *target,
+                      int32_t *xval, int32_t *yval, size_t n,
+                      size_t *duplicates)
+{
+  // compacts the points in place, dropping ones whose centre pixel was
+  // already stamped in the current column. only points centred inside the
+  // clip are tracked, so every dropped one would have been drawn
+  const Rect clip = target->clip;
+  size_t kept = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    int32_t x = xval[i], y = yval[i];
+    if (x == PIXEL_NONE || y == PIXEL_NONE) { continue; }
+    int cx = target->origin_x + x, row = target->origin_y - y;
+    if (cx >= clip.x0 && cx <= clip.x1 && row >= clip.y0 && row <= clip.y1 &&
+        row < DEDUPE_MAX_ROWS)
+    {
+      if (x != dedupe->column)
+      {  // new column, only the bits the last one set need clearing
+        for (int m = 0; m < dedupe->marked_count; ++m)
+        {
+          dedupe->rows[dedupe->marked[m] >> 6] = 0;
+        }
+        dedupe->marked_count = 0;
+        dedupe->column = x;
+      }
+      uint64_t bit = 1ull << (row & 63);
+      if (dedupe->rows[row >> 6] & bit)
+      {
+        ++*duplicates;
+        continue;
+      }
+      dedupe->rows[row >> 6] |= bit;
+      dedupe->marked[dedupe->marked_count++] = (uint16_t)row;
+    }
+    xval[kept] = x;
+    yval[kept] = y;
+    ++kept;
+  }
+  return kept;
+}
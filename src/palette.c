@@ -0,0 +1,99 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// palette canvases - a chart has a handful of colours, so a byte per pixel
+// indexing them is enough and fills and stamps move a quarter of the
+// memory. the colours only come back out when the image is written, or
+// when a 257th one (translucent blends can make a lot) turns up, at which
+// point the canvas copies itself into pixels and carries on from there
+
+_Thread_local bool indexed_on = false;
+
+// USER FUNCTIONS
+void indexed_colour(bool on) { indexed_on = on; }
+
+// NON-USER FUNCTIONS
+void palette_reset(Palette *p)
+{
+  p->count = 0;
+  p->overflowed = false;
+  memset(p->slots, 0, sizeof p->slots);
+  p->last_index = -1;
+}
+
+int palette_index(Palette *p, Colour32 colour)
+{
+  // colour's index, added if it's new. -1 if the palette is full
+  if (p->last_index >= 0 && colour == p->last) { return p->last_index; }
+  uint32_t h = (colour * 2654435761u) >> 23;
+  while (p->slots[h] != 0 && p->keys[h] != colour)
+  {
+    h = (h + 1) & (PALETTE_SLOTS - 1);
+  }
+  if (p->slots[h] == 0)
+  {
+    if (p->count == 256) { return -1; }
+    p->keys[h] = colour;
+    p->colours[p->count] = colour;
+    p->slots[h] = (uint16_t)++p->count;
+  }
+  p->last = colour;
+  p->last_index = p->slots[h] - 1;
+  return p->last_index;
+}
+
+bool canvas_indexed(const Canvas *c)
+{
+  return c->palette != NULL && !c->palette->overflowed;
+}
+
+int canvas_ink(Canvas *c, Colour32 colour)
+{
+  // the index to draw colour with, or -1 to draw it into pixels - either
+  // the canvas isn't indexed or colour didn't fit and now it isn't
+  if (!canvas_indexed(c)) { return -1; }
+  int index = palette_index(c->palette, colour);
+  if (index < 0) { canvas_expand(c); }
+  return index;
+}
+
+void canvas_expand(Canvas *c)
+{
+  // every index into its colour in pixels, which is drawn on from now on
+  canvas_pixels(c);
+  const Colour32 *colours = c->palette->colours;
+  for (int y = 0; y < c->height; ++y)
+  {
+    const uint8_t *in = c->indices + (ptrdiff_t)y * c->stride;
+    Colour32 *out = c->pixels + (ptrdiff_t)y * c->stride;
+    for (int x = 0; x < c->width; ++x) { out[x] = colours[in[x]]; }
+  }
+  c->palette->overflowed = true;
+}
+
+void expand_rgb(const Canvas *c, uint8_t *rgb)
+{
+  // pack_rgb() for an indexed canvas at 1x
+  uint8_t table[256][3];
+  for (int i = 0; i < c->palette->count; ++i)
+  {
+    Colour32 colour = c->palette->colours[i];
+    table[i][0] = (uint8_t)colour;
+    table[i][1] = (uint8_t)(colour >> 8);
+    table[i][2] = (uint8_t)(colour >> 16);
+  }
+  for (int y = 0; y < c->height; ++y)
+  {
+    const uint8_t *in = c->indices + (ptrdiff_t)y * c->stride;
+    for (int x = 0; x < c->width; ++x, rgb += 3)
+    {
+      memcpy(rgb, table[in[x]], 3);
+    }
+  }
+}
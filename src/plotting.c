@@ -9,25 +9,46 @@
 
 #define STBI_MSC_SECURE_CRT
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBIW_MALLOC(size) trace_malloc(size)
+#define STBIW_REALLOC(p, size) trace_realloc(p, size)
+#define STBIW_FREE(p) trace_free(p)
 #include "font.h"
 #include "plotting.h"
+#include "plotting_internal.h"
 #include "stb_image_write.h"
 
-static Colour32 image[HEIGHT][WIDTH];  // define image size
 const int width = WIDTH;
 const int height = HEIGHT;
-int array_length;
-int grid_on = 0;
-int g_density = GRID_DENSITY;
-const float f_plot_size = PLOT_WIDTH;
-char file_path[] = DEFAULT_FILE_PATH;
-char plot_title[40] = DEFAULT_TITLE;
-char plot_xlabel[40] = DEFAULT_X_LABEL;
-char plot_ylabel[40] = DEFAULT_Y_LABEL;
 const int plot_area = PLOT_WIDTH;
-const int border_area = BORDER_AREA;
 const int label_font_size = 4;
 const int title_font_size = 6;
+const int tick_font_size = 2;
+// what the next plot looks like - each thread has its own, and threads
+// drawing part of a plot take on the settings of the one that called it
+_Thread_local int grid_on = 0;
+_Thread_local int g_density = GRID_DENSITY;
+_Thread_local char file_path[260] = DEFAULT_FILE_PATH;
+_Thread_local char plot_title[40] = DEFAULT_TITLE;
+_Thread_local char plot_xlabel[40] = DEFAULT_X_LABEL;
+_Thread_local char plot_ylabel[40] = DEFAULT_Y_LABEL;
+_Thread_local TimeUnit x_time = TIME_OFF;
+_Thread_local AxisScale x_scale = SCALE_LINEAR;
+_Thread_local AxisScale y_scale = SCALE_LINEAR;
+// symlog is close to linear within this of zero
+_Thread_local double symlog_linear = 1;
+_Thread_local bool x_declared_sorted = false;
+// NaN ends are automatic
+_Thread_local Bounds axis_limits = {NAN, NAN, NAN, NAN, false};
+_Thread_local Colour32 series_colour = COLOR_PURPLE;
+_Thread_local Stamp point_stamp;
+_Thread_local int point_stamp_scale = 0;  // canvas scale it's for, 0 = none
+_Thread_local Marker point_shape = MARKER_SQUARE;
+_Thread_local int point_size = DOT_SIZE;
+_Thread_local int aa_scale = 1;
+
+// what plot_canvas() hands out, kept between the plots made on a thread
+static _Thread_local Canvas plot_image;
+static _Thread_local Palette plot_palette;
 
 // USER FUNCTIONS
 void xlabel(const char *text)
@@ -45,7 +66,16 @@ void title(const char *text)
   if (text[0] != '\0') { strcpy(plot_title, text); }
 }
 
-void path(char *new_path) { strcpy(file_path, new_path); }
+void path(char *new_path)
+{
+  if (strlen(new_path) >= sizeof file_path)
+  {
+    printf("ERROR: path is too long - keep it under %d chars\n",
+           (int)sizeof file_path);
+    exit(1);
+  }
+  strcpy(file_path, new_path);
+}
 
 void grid(int input_density)
 {
@@ -53,60 +83,385 @@ void grid(int input_density)
   grid_on = 1;
 }
 
+void time_axis(TimeUnit unit) { x_time = unit; }
+
+void xscale(AxisScale scale) { x_scale = scale; }
+
+void yscale(AxisScale scale) { y_scale = scale; }
+
+void sorted_x(bool sorted) { x_declared_sorted = sorted; }
+
+static void set_limits(double min, double max, double *lo, double *hi,
+                       const char *name)
+{
+  if (!isnan(min) && !isnan(max) && !(min < max))
+  {
+    printf("ERROR: %s needs min below max\n", name);
+    exit(1);
+  }
+  if (isinf(min) || isinf(max))
+  {
+    printf("ERROR: %s limits have to be finite (or NAN for automatic)\n",
+           name);
+    exit(1);
+  }
+  *lo = min;
+  *hi = max;
+}
+
+void xlim(double min, double max)
+{
+  set_limits(min, max, &axis_limits.min_x, &axis_limits.max_x, "xlim");
+}
+
+void ylim(double min, double max)
+{
+  set_limits(min, max, &axis_limits.min_y, &axis_limits.max_y, "ylim");
+}
+
+void symlog_threshold(double threshold)
+{
+  if (!(threshold > 0) || isinf(threshold))
+  {
+    printf("ERROR: symlog threshold must be a positive number\n");
+    exit(1);
+  }
+  symlog_linear = threshold;
+}
+
+void colour(Colour32 c) { series_colour = c; }
+
+void alpha(float a)
+{
+  if (a < 0) { a = 0; }
+  if (a > 1) { a = 1; }
+  Colour32 alpha_byte = (Colour32)(a * 255 + 0.5f);
+  series_colour = (series_colour & 0x00FFFFFF) | alpha_byte << 24;
+}
+
+void marker(Marker shape, int size)
+{
+  point_shape = shape;
+  point_size = size < 0 ? 0 : size > MARKER_MAX_SIZE ? MARKER_MAX_SIZE : size;
+  point_stamp_scale = 0;  // rebuilt at the canvas scale when drawn
+}
+
+void antialias(int factor)
+{
+  if (factor != 1 && factor != 2 && factor != 4)
+  {
+    printf("ERROR: antialias factor must be 1, 2 or 4\n");
+    exit(1);
+  }
+  aa_scale = factor;
+}
+
+void plot_free(void)
+{
+  // frees the image buffers this thread keeps between plots, the next plot
+  // makes them again
+  trace_free(plot_image.pixels);
+  trace_free(plot_image.counts);
+  trace_free(plot_image.indices);
+  plot_image = (Canvas){0};
+}
+
 // NON-USER FUNCTIONS
-void draw_grid(Colour32 colour)
+Canvas *plot_canvas(void)
 {
-  // drawing the grid according to the given density
-  if (grid_on == 0)
-  {  // check if grid() has been called
-    return;
+  // the render target for the current antialias() factor. its buffers are
+  // kept for this thread's next plot until the factor changes or plot_free()
+  // is called, and each is only made once something needs it - an indexed
+  // plot has no full colour buffer unless its palette overflows, and only
+  // translucent series count hits
+  size_t len = strlen(file_path);
+  bool svg = len >= 4 && strcmp(file_path + len - 4, ".svg") == 0;
+  const int s = svg ? 1 : aa_scale;  // vectors don't need supersampling
+  const bool indexed = indexed_on && !svg;
+
+  if (plot_image.scale != s)
+  {
+    trace_free(plot_image.pixels);
+    trace_free(plot_image.counts);
+    trace_free(plot_image.indices);
+    plot_image.pixels = NULL;
+    plot_image.counts = NULL;
+    plot_image.indices = NULL;
   }
-  for (int i = 1; i < g_density; ++i)
+  plot_image = (Canvas){
+      .pixels = plot_image.pixels,
+      .counts = plot_image.counts,
+      .indices = plot_image.indices,
+      .width = WIDTH * s,
+      .height = HEIGHT * s,
+      .stride = WIDTH * s,
+      .scale = s,
+  };
+  frame_canvas(&plot_image, image_frame());
+  if (svg)
   {
-    for (size_t coord = BORDER; coord < WIDTH - BORDER; ++coord)
+    plot_image.svg = svg_open(file_path, WIDTH, HEIGHT);
+    if (plot_image.svg == NULL)
     {
-      if (coord % 2 == 0) { continue; }
-      image[BORDER + i * (border_area / g_density)][coord] = colour;
-      image[coord][BORDER + i * (border_area / g_density)] = colour;
+      printf("ERROR: invalid path - couldn't create %s, check the folder "
+             "exists\n",
+             file_path);
+      exit(1);
+    }
+  }
+  if (indexed)
+  {
+    if (plot_image.indices == NULL)
+    {
+      plot_image.indices =
+          trace_malloc((size_t)plot_image.stride * plot_image.height);
+      assert(plot_image.indices != NULL);
     }
+    palette_reset(&plot_palette);
+    plot_image.palette = &plot_palette;
+  }
+  else { canvas_pixels(&plot_image); }
+  return &plot_image;
+}
+
+void canvas_pixels(Canvas *c)
+{
+  // makes the canvas' full colour buffer if it hasn't got one
+  if (c->pixels != NULL) { return; }
+  c->pixels = trace_malloc((size_t)c->stride * c->height * sizeof *c->pixels);
+  if (c->pixels == NULL)
+  {
+    printf("ERROR: not enough memory for the image\n");
+    exit(1);
   }
 }
 
-void draw_background(Colour32 color)
+void canvas_counts(Canvas *c)
 {
-  for (size_t y = 0; y < HEIGHT; ++y)
+  // makes the canvas' hit counts, all zero, if it hasn't got them.
+  // resolve_scatter() leaves them zero again for the next series
+  if (c->counts != NULL) { return; }
+  size_t bytes = (size_t)c->stride * c->height * sizeof *c->counts;
+  c->counts = trace_malloc(bytes);
+  if (c->counts == NULL)
   {
-    for (size_t x = 0; x < WIDTH; ++x) { image[y][x] = color; }
+    printf("ERROR: not enough memory for the image\n");
+    exit(1);
   }
+  memset(c->counts, 0, bytes);
+}
+
+Frame image_frame(void)
+{
+  // the frame filling the whole image
+  return (Frame){WIDTH,           BORDER,          PLOT_BORDER,
+                 label_font_size, title_font_size, tick_font_size};
+}
+
+Frame panel_frame(int size)
+{
+  // a frame size pixels across - the borders and fonts shrink with it
+  // (fonts no smaller than 1), but the border keeps room for the y label
+  // and four characters of tick labels. at the image's size it's the same
+  // as image_frame()
+  Frame f = {
+      .size = size,
+      .plot_border = size * PLOT_BORDER / WIDTH,
+      .label_font = size * label_font_size / WIDTH,
+      .title_font = size * title_font_size / WIDTH,
+      .tick_font = size * tick_font_size / WIDTH,
+  };
+  if (f.label_font < 1) { f.label_font = 1; }
+  if (f.title_font < 1) { f.title_font = 1; }
+  if (f.tick_font < 1) { f.tick_font = 1; }
+  int room = 6 + size * 16 / WIDTH + 7 * f.label_font + 24 * f.tick_font;
+  f.border = size * BORDER / WIDTH;
+  if (f.border < room) { f.border = room; }
+  return f;
+}
+
+void frame_canvas(Canvas *c, Frame f)
+{
+  // lays the frame out on the canvas, which is where the axis bounds and
+  // the clip for the points follow from
+  const int s = c->scale;
+  c->frame = f;
+  c->clip = (Rect){(f.border + 1) * s, (f.border + 1) * s,
+                   (f.size - f.border) * s - 1, (f.size - f.border) * s - 1};
+  c->origin_x = (f.plot_border + f.border) * s;
+  c->origin_y = (f.size - f.plot_border - f.border) * s;
+  c->plot_px = f.size - 2 * f.plot_border - 2 * f.border;
+  c->pad = f.plot_border;
+}
+
+void settings_save(PlotSettings *s)
+{
+  // the calling thread's settings, for another thread to draw with
+  *s = (PlotSettings){
+      .grid_on = grid_on,
+      .g_density = g_density,
+      .x_time = x_time,
+      .x_scale = x_scale,
+      .y_scale = y_scale,
+      .symlog_linear = symlog_linear,
+      .x_declared_sorted = x_declared_sorted,
+      .axis_limits = axis_limits,
+      .series_colour = series_colour,
+      .point_shape = point_shape,
+      .point_size = point_size,
+      .aa_scale = aa_scale,
+      .indexed_on = indexed_on,
+      .jpeg_quality = jpeg_quality,
+      .jpeg_sampling = jpeg_sampling,
+      .jpeg_thread_count = jpeg_thread_count,
+      .tile_kind = tile_kind,
+      .tile_background = tile_background,
+  };
+  strcpy(s->file_path, file_path);
+  strcpy(s->title, plot_title);
+  strcpy(s->xlabel, plot_xlabel);
+  strcpy(s->ylabel, plot_ylabel);
+}
+
+void settings_load(const PlotSettings *s)
+{
+  // the calling thread takes on saved settings
+  grid_on = s->grid_on;
+  g_density = s->g_density;
+  strcpy(file_path, s->file_path);
+  strcpy(plot_title, s->title);
+  strcpy(plot_xlabel, s->xlabel);
+  strcpy(plot_ylabel, s->ylabel);
+  x_time = s->x_time;
+  x_scale = s->x_scale;
+  y_scale = s->y_scale;
+  symlog_linear = s->symlog_linear;
+  x_declared_sorted = s->x_declared_sorted;
+  axis_limits = s->axis_limits;
+  series_colour = s->series_colour;
+  point_shape = s->point_shape;
+  point_size = s->point_size;
+  point_stamp_scale = 0;  // rebuilt from these when next drawn
+  aa_scale = s->aa_scale;
+  indexed_on = s->indexed_on;
+  jpeg_quality = s->jpeg_quality;
+  jpeg_sampling = s->jpeg_sampling;
+  jpeg_thread_count = s->jpeg_thread_count;
+  tile_kind = s->tile_kind;
+  tile_background = s->tile_background;
 }
 
-void draw_border(Colour32 colour)
+void fill_cells(Canvas *c, int x0, int y0, int x1, int y1, Colour32 colour)
 {
-  for (size_t x = BORDER; x < WIDTH - BORDER; ++x)
+  // fills an inclusive rectangle given in output pixels, each one covering
+  // scale x scale canvas pixels
+  if (c->svg != NULL)
+  {
+    svg_rect(c->svg, x0, y0, x1, y1, colour);
+    return;
+  }
+  int ink = canvas_ink(c, colour);
+  for (int y = y0 * c->scale; y < (y1 + 1) * c->scale; ++y)
   {
-    image[BORDER][x] = colour;
-    image[HEIGHT - BORDER][x] = colour;
+    if (ink >= 0)
+    {
+      memset(c->indices + (ptrdiff_t)y * c->stride + x0 * c->scale, ink,
+             (size_t)(x1 - x0 + 1) * c->scale);
+      continue;
+    }
+    Colour32 *row = c->pixels + (ptrdiff_t)y * c->stride;
+    for (int x = x0 * c->scale; x < (x1 + 1) * c->scale; ++x)
+    {
+      row[x] = colour;
+    }
+  }
+}
+
+Rect plot_rect(const Canvas *c)
+{
+  // canvas pixels inside the border, where the points go
+  return c->clip;
+}
+
+void draw_grid(Canvas *c, Colour32 colour)
+{
+  // drawing the grid according to the given density
+  if (grid_on == 0)
+  {  // check if grid() has been called
+    return;
   }
-  for (size_t y = BORDER; y < HEIGHT - BORDER; ++y)
+  const int border = c->frame.border, size = c->frame.size;
+  const int area = size - 2 * border;
+  for (int i = 1; i < g_density; ++i)
   {
-    image[y][BORDER] = colour;
-    image[y][WIDTH - BORDER] = colour;
+    int line = border + i * (area / g_density);
+    if (c->svg != NULL)
+    {  // the odd pixels along each line as a dashed one
+      int first = border | 1, last = (size - border - 1) | 1;
+      if (last > size - border - 1) { last -= 2; }
+      svg_dotted(c->svg, first, line, last, line, colour);
+      svg_dotted(c->svg, line, first, line, last, colour);
+      continue;
+    }
+    for (int coord = border; coord < size - border; ++coord)
+    {
+      if (coord % 2 == 0) { continue; }
+      fill_cells(c, coord, line, coord, line, colour);
+      fill_cells(c, line, coord, line, coord, colour);
+    }
   }
 }
 
-void save_image_as_png(const char *path)
+void draw_background(Canvas *c, Colour32 color)
+{
+  fill_cells(c, 0, 0, c->frame.size - 1, c->frame.size - 1, color);
+}
+
+void draw_border(Canvas *c, Colour32 colour)
 {
-  uint8_t *image_write;
-  int image_size = width * height * CHANNEL_NUM;
-  image_write = malloc(image_size * sizeof(uint8_t));
+  const int b = c->frame.border, far = c->frame.size - c->frame.border;
+  fill_cells(c, b, b, far - 1, b, colour);
+  fill_cells(c, b, far, far - 1, far, colour);
+  fill_cells(c, b, b, b, far - 1, colour);
+  fill_cells(c, far, b, far, far - 1, colour);
+}
+
+uint8_t *pack_rgb(const Canvas *c)
+{
+  // pack_rgb_into() a new buffer, free it with trace_free()
+  const int out_w = c->width / c->scale, out_h = c->height / c->scale;
+  uint8_t *image_write = trace_malloc((size_t)out_w * out_h * CHANNEL_NUM);
   assert(image_write != NULL);
+  pack_rgb_into(c, image_write);
+  return image_write;
+}
+
+void pack_rgb_into(const Canvas *c, uint8_t *image_write)
+{
+  // converting the canvas to the packed rgb bytes the encoders want,
+  // averaging it down to the output size when supersampled
+  uint64_t t = trace_begin();
+  const int out_w = c->width / c->scale, out_h = c->height / c->scale;
+  if (c->scale > 1)
+  {
+    if (canvas_indexed(c)) { downsample_indexed(c, image_write); }
+    else { downsample_rgb(c, image_write); }
+    trace_end(TRACE_PACK, t);
+    return;
+  }
+  if (canvas_indexed(c))
+  {
+    expand_rgb(c, image_write);
+    trace_end(TRACE_PACK, t);
+    return;
+  }
   int index = 0;
 
-  for (int y = 0; y < height; ++y)
+  for (int y = 0; y < out_h; ++y)
   {
-    for (int x = 0; x < width; ++x)
+    for (int x = 0; x < out_w; ++x)
     {
-      uint32_t pixel = image[y][x];
+      uint32_t pixel = c->pixels[y * c->stride + x];
       uint8_t bytes[3] = {
           (pixel & 0x0000FF) >> 8 * 0,
           (pixel & 0x00FF00) >> 8 * 1,
@@ -118,59 +473,322 @@ void save_image_as_png(const char *path)
       image_write[index++] = bytes[2];
     }
   }
+  trace_end(TRACE_PACK, t);
+}
+
+int write_file(const char *path, const uint8_t *data, size_t len)
+{
+  uint64_t t = trace_begin();
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) { return 0; }
+  size_t written = fwrite(data, 1, len, f);
+  int ok = fclose(f) == 0 && written == len;
+  trace_end(TRACE_WRITE, t);
+  return ok;
+}
+
+uint8_t *encode_png(const uint8_t *rgb, int w, int h, int *len)
+{
+  uint64_t t = trace_begin();
+  uint8_t *encoded =
+      stbi_write_png_to_mem(rgb, w * CHANNEL_NUM, w, h, CHANNEL_NUM, len);
+  assert(encoded != NULL);
+  // every scanline goes into deflate with its filter byte in front
+  trace_count(COUNT_DEFLATE_IN, (uint64_t)(w * CHANNEL_NUM + 1) * h);
+  trace_count(COUNT_ENCODED, *len);
+  trace_end(TRACE_ENCODE, t);
+  return encoded;
+}
+
+static uint8_t *png_chunk(uint8_t *at, const char *type, const uint8_t *data,
+                          uint32_t size)
+{
+  // length, type, data, then the crc of type and data. returns the end
+  uint8_t *start = at;
+  for (int i = 3; i >= 0; --i) { *at++ = (uint8_t)(size >> (8 * i)); }
+  memcpy(at, type, 4);
+  if (size > 0) { memcpy(at + 4, data, size); }
+  at += 4 + size;
+  uint32_t crc = stbiw__crc32(start + 4, (int)size + 4);
+  for (int i = 3; i >= 0; --i) { *at++ = (uint8_t)(crc >> (8 * i)); }
+  return at;
+}
 
-  int p_len = (int)strlen(path);
-  char jpg[] = ".jpg";
-  char png[] = ".png";
-  int i, j;
-  for (i = 0; i < 4; ++i)
+uint8_t *encode_palette_png(const uint8_t *indices, int w, int h,
+                            const Colour32 *palette, int colours, int *len)
+{
+  // an 8 bit indexed png, a third of the scanline bytes of rgb. rows go in
+  // unfiltered (filters don't help palette images) through the run-only
+  // zlib encoder
+  uint64_t t = trace_begin();
+  size_t row = (size_t)w + 1;
+  uint8_t *scanlines = trace_malloc(row * h);
+  assert(scanlines != NULL);
+  for (int y = 0; y < h; ++y)
   {
-    if (path[p_len + i - 4] != jpg[i]) { break; }
+    scanlines[y * row] = 0;
+    memcpy(scanlines + y * row + 1, indices + (size_t)y * w, w);
   }
-  if (i == 4)
+  size_t zlen;
+  uint8_t *zlib = zlib_rle(scanlines, row * h, 1, (int)row, &zlen);
+  trace_free(scanlines);
+  assert(zlib != NULL);
+
+  uint8_t header[13] = {(uint8_t)(w >> 24), (uint8_t)(w >> 16),
+                        (uint8_t)(w >> 8),  (uint8_t)w,
+                        (uint8_t)(h >> 24), (uint8_t)(h >> 16),
+                        (uint8_t)(h >> 8),  (uint8_t)h,
+                        8, 3, 0, 0, 0};  // 8 bits, palette
+  uint8_t plte[3 * 256];
+  for (int i = 0; i < colours; ++i)
   {
-    stbi_write_jpg(path, WIDTH, HEIGHT, 3, image_write, 100);
-    printf("-- JPEG file successfully created and saved as %s --\n", path);
-    free(image_write);
+    plte[3 * i] = palette[i] & 0xFF;
+    plte[3 * i + 1] = (palette[i] >> 8) & 0xFF;
+    plte[3 * i + 2] = (palette[i] >> 16) & 0xFF;
+  }
+  static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  size_t total = 8 + 12 + 13 + 12 + 3 * colours + 12 + zlen + 12;
+  uint8_t *out = trace_malloc(total);
+  assert(out != NULL);
+  memcpy(out, signature, 8);
+  uint8_t *at = png_chunk(out + 8, "IHDR", header, 13);
+  at = png_chunk(at, "PLTE", plte, 3 * colours);
+  at = png_chunk(at, "IDAT", zlib, (uint32_t)zlen);
+  png_chunk(at, "IEND", NULL, 0);
+  trace_free(zlib);
+
+  *len = (int)total;
+  trace_count(COUNT_DEFLATE_IN, row * h);
+  trace_count(COUNT_ENCODED, total);
+  trace_end(TRACE_ENCODE, t);
+  return out;
+}
+
+void save_image_as_png(Canvas *c, const char *path)
+{
+  if (c->svg != NULL)
+  {  // everything but the points is already in the file
+    uint64_t t = trace_begin();
+    size_t bytes = svg_close(c, point_shape, series_colour);
+    trace_count(COUNT_ENCODED, bytes);
+    trace_end(TRACE_WRITE, t);
+    if (bytes == 0)
+    {
+      printf("ERROR: couldn't write %s\n", path);
+      exit(1);
+    }
+    printf("-- SVG file successfully created and saved as %s --\n", path);
     return;
   }
+  const char *format;
+  const ImageFormat *f = image_format(path);
+  if (canvas_indexed(c) && c->scale == 1 && f != NULL &&
+      f->encode_indexed != NULL)
+  {  // the indices go straight into the file
+    format = write_indexed_image(path, c->indices, c->palette);
+  }
+  else
+  {
+    uint8_t *image_write = pack_rgb(c);
+    format = write_image(path, image_write);
+    trace_free(image_write);
+  }
+  if (format == NULL)
+  {
+    printf(
+        "ERROR: invalid path - ensure the path string ends in .png, .jpg, "
+        ".bmp, .ppm, .rgba, .qoi or .svg and the folder exists\n");
+    exit(1);
+  }
+  printf("-- %s file successfully created and saved as %s --\n", format, path);
+}
+
+void load_chunk(PlotArray arr, size_t start, size_t count, double *out)
+{
+  // converting count elements of arr to doubles, reading through the stride
+  const char *p = (const char *)arr.data + start * arr.stride;
+  switch (arr.type)
+  {
+  case PLOT_F32:
+    for (size_t i = 0; i < count; ++i, p += arr.stride)
+    {
+      float v;
+      memcpy(&v, p, sizeof v);
+      out[i] = v;
+    }
+    break;
+  case PLOT_F64:
+    for (size_t i = 0; i < count; ++i, p += arr.stride)
+    {
+      memcpy(&out[i], p, sizeof out[i]);
+    }
+    break;
+  case PLOT_I32:
+    for (size_t i = 0; i < count; ++i, p += arr.stride)
+    {
+      int32_t v;
+      memcpy(&v, p, sizeof v);
+      out[i] = v;
+    }
+    break;
+  case PLOT_I64:
+    for (size_t i = 0; i < count; ++i, p += arr.stride)
+    {
+      int64_t v;
+      memcpy(&v, p, sizeof v);
+      out[i] = (double)v;
+    }
+    break;
+  case PLOT_U16:
+    for (size_t i = 0; i < count; ++i, p += arr.stride)
+    {
+      uint16_t v;
+      memcpy(&v, p, sizeof v);
+      out[i] = v;
+    }
+    break;
+  }
+  if (arr.validity == NULL) { return; }
+  // nulls become NaN so every kernel skips them with its NaN check
+  size_t bit = arr.validity_offset + start;
+  for (size_t i = 0; i < count; ++i, ++bit)
+  {
+    if (!((arr.validity[bit >> 3] >> (bit & 7)) & 1)) { out[i] = NAN; }
+  }
+}
 
-  for (j = 0; j < 4; ++j)
+void load_axis_chunk(PlotArray arr, size_t start, size_t count,
+                     AxisScale scale, double *out)
+{
+  // load_chunk() then the axis transform, so every pass sees the same
+  // transformed values
+  load_chunk(arr, start, count, out);
+  if (scale != SCALE_LINEAR)
   {
-    if (path[p_len + j - 4] != png[j]) { break; }
+    transform_chunk(out, count, scale, symlog_linear);
   }
-  if (j == 4)
+}
+
+void bounds_chunk(Bounds *b, const double *x, const double *y, size_t n)
+{
+  // widening the bounds by one chunk, points with a NaN/inf coordinate are
+  // skipped so they can't poison the axis range
+  for (size_t i = 0; i < n; ++i)
   {
-    stbi_write_png(path, WIDTH, WIDTH, CHANNEL_NUM, image_write,
-                   WIDTH * CHANNEL_NUM);
-    printf("-- PNG file successfully created and saved as %s --\n", path);
-    free(image_write);
-    return;
+    if (!isfinite(x[i]) || !isfinite(y[i])) { continue; }
+    if (x[i] < b->min_x) { b->min_x = x[i]; }
+    if (x[i] > b->max_x) { b->max_x = x[i]; }
+    if (y[i] < b->min_y) { b->min_y = y[i]; }
+    if (y[i] > b->max_y) { b->max_y = y[i]; }
   }
-  printf("ERROR: invalid path - ensure the path string ends in .png or .jpg\n");
-  exit(1);
 }
 
-float max_value(float *input_array)
+static bool limits_set(void)
 {
-  // finding the maximum value of the given array
-  float max = *input_array;
-  for (int i = 0; i < array_length; ++i)
+  return !isnan(axis_limits.min_x) || !isnan(axis_limits.max_x) ||
+         !isnan(axis_limits.min_y) || !isnan(axis_limits.max_y);
+}
+
+static void pin_axis(double *min, double *max, double lo, double hi,
+                     AxisScale scale)
+{
+  // lo/hi are data values, NaN leaves that end to the data
+  lo = axis_value(lo, scale, symlog_linear);
+  hi = axis_value(hi, scale, symlog_linear);
+  if (!isnan(lo)) { *min = lo; }
+  if (!isnan(hi)) { *max = hi; }
+  if (*max <= *min && (!isnan(lo) || !isnan(hi)))
+  {  // one end pinned past all the data
+    if (isnan(hi)) { *max = *min + 1; }
+    else { *min = *max - 1; }
+  }
+}
+
+bool sorted_chunk(const double *x, size_t n, double *last)
+{
+  // whether x keeps going up from *last, NaN anywhere breaks it
+  double prev = *last;
+  for (size_t i = 0; i < n; ++i)
   {
-    if (*(input_array + i) > max) { max = *(input_array + i); }
+    if (!(x[i] >= prev)) { return false; }
+    prev = x[i];
   }
-  return max;
+  *last = prev;
+  return true;
 }
 
-float min_value(float *input_array)
+Bounds compute_bounds(PlotArray x, PlotArray y, size_t n)
 {
-  // finding the minimum value of the given array
-  float min = *input_array;
-  for (int i = 0; i < array_length; ++i)
+  // one pass over the data to find the axis ranges (in axis scale units),
+  // noting on the way whether x is sorted
+  Bounds b = {INFINITY, -INFINITY, INFINITY, -INFINITY, true};
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  double last_x = -INFINITY;
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
   {
-    if (*(input_array + i) < min) { min = *(input_array + i); }
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_axis_chunk(x, start, count, x_scale, xs);
+    load_axis_chunk(y, start, count, y_scale, ys);
+    bounds_chunk(&b, xs, ys, count);
+    if (b.x_sorted) { b.x_sorted = sorted_chunk(xs, count, &last_x); }
+  }
+  b.x_sorted = b.x_sorted || x_declared_sorted;
+  if (b.min_x > b.max_x)
+  {  // nothing finite to plot
+    b.min_x = b.max_x = b.min_y = b.max_y = 0;
   }
-  return min;
+  return b;
+}
+
+static bool bounds_need_data(void)
+{
+  // false when xlim()/ylim() pin all four ends, so the data needn't be read
+  Bounds lim = axis_limits;
+  return isnan(lim.min_x) || isnan(lim.max_x) || isnan(lim.min_y) ||
+         isnan(lim.max_y) ||
+         isnan(axis_value(lim.min_x, x_scale, symlog_linear)) ||
+         isnan(axis_value(lim.min_y, y_scale, symlog_linear));
+}
+
+static Bounds pin_bounds(Bounds b)
+{
+  pin_axis(&b.min_x, &b.max_x, axis_limits.min_x, axis_limits.max_x,
+           x_scale);
+  pin_axis(&b.min_y, &b.max_y, axis_limits.min_y, axis_limits.max_y,
+           y_scale);
+  return b;
+}
+
+Bounds axis_bounds(PlotArray x, PlotArray y, size_t n)
+{
+  // the data bounds with any xlim()/ylim() ends pinned over them. with all
+  // four pinned the data doesn't need reading at all
+  Bounds b = {0, 0, 0, 0, x_declared_sorted};
+  if (bounds_need_data()) { b = compute_bounds(x, y, n); }
+  return pin_bounds(b);
+}
+
+static void cull_range(const Canvas *c, double min, double max,
+                       AxisScale scale, double *lo, double *hi)
+{
+  // data values that can still reach the plot along one axis, points hang
+  // over the edge by the padding plus a marker
+  *lo = -INFINITY;
+  *hi = INFINITY;
+  if (!(max > min)) { return; }
+  double margin = (c->pad + point_size + 1) * (max - min) / c->plot_px;
+  *lo = axis_inverse(min - margin, scale, symlog_linear);
+  *hi = axis_inverse(max + margin, scale, symlog_linear);
+}
+
+Bounds cull_window(const Canvas *c, Bounds b)
+{
+  // the data values (before transforms) whose points can show up on c with
+  // axis bounds b
+  Bounds window = {0, 0, 0, 0, false};
+  cull_range(c, b.min_x, b.max_x, x_scale, &window.min_x, &window.max_x);
+  cull_range(c, b.min_y, b.max_y, y_scale, &window.min_y, &window.max_y);
+  return window;
 }
 
 void check_length(int len, const char *spec)
@@ -194,99 +812,1266 @@ void check_length(int len, const char *spec)
   }
 }
 
-void plot_scatter(float *x, float *y, Colour32 colour)
+void scale_chunk(const double *v, size_t n, double min, double max, int size,
+                 int32_t *out)
 {
-  // plots the given points individually
-  int xval, yval;
-
-  for (int i = 0; i < array_length; ++i)
+  // mapping values onto size pixels, a flat range goes in the middle
+  double scale = max > min ? size / (max - min) : 0;
+  for (size_t i = 0; i < n; ++i)
   {
-    float min_x = min_value(x);
-    float max_x = max_value(x);
-    float min_y = min_value(y);
-    float max_y = max_value(y);
-
-    if (min_x == max_x) { xval = plot_area / 2; }
-    else { xval = ((*(x + 1) - min_x) / (max_x - min_x)) * f_plot_size; }
-    if (min_y == max_y) { yval = plot_area / 2; }
-    else { yval = ((*(y + 1) - min_y) / (max_y - min_y)) * f_plot_size; }
+    double pixel = scale == 0 ? size / 2 : (v[i] - min) * scale;
+    // written so NaN fails the test too, far off points would overflow
+    if (!(fabs(pixel) < PIXEL_LIMIT) || !isfinite(v[i]))
+    {
+      out[i] = PIXEL_NONE;
+    }
+    else { out[i] = (int32_t)pixel; }
+  }
+}
 
-    for (int j = -DOT_SIZE; j <= DOT_SIZE; ++j)
+const Stamp *marker_stamp(int scale)
+{
+  // the current marker at a canvas scale, rebuilt when the scale changes.
+  // like the settings it's built from, each thread has its own
+  if (point_stamp_scale != scale)
+  {  // a supersampled marker covers about the same area as the 1x one, a
+     // single pixel becomes a small square so it doesn't average away
+    Marker shape = point_shape;
+    int size = point_size;
+    if (scale > 1 && shape == MARKER_PIXEL)
     {
-      for (int k = -DOT_SIZE; k <= DOT_SIZE; ++k)
-      {
-        image[HEIGHT - PLOT_BORDER - BORDER - yval + j]
-             [PLOT_BORDER + BORDER + xval + k] = colour;
-      }
+      shape = MARKER_SQUARE;
+      size = 0;
     }
+    build_stamp(shape, (2 * size + 1) * scale / 2, &point_stamp);
+    point_stamp_scale = scale;
   }
+  return &point_stamp;
 }
 
-void draw_text(const char *label, const int font_size, int ypos, int xpos,
-               char orientation)
+static StampTarget stamp_target(Canvas *c, Colour32 colour)
 {
-  int label_len = (int)strlen(label);
-  check_length(label_len, label);
-  if (orientation == 'h')
+  // where the marker goes for this colour, translucent colours only count
+  // hits and resolve_scatter() blends them in afterwards
+  marker_stamp(c->scale);
+  bool opaque = colour >> 24 == 0xFF;
+  int ink = opaque ? canvas_ink(c, colour) : -1;
+  if (!opaque) { canvas_counts(c); }
+  return (StampTarget){
+      .pixels = c->pixels,
+      .counts = opaque ? NULL : c->counts,
+      .indices = ink >= 0 ? c->indices : NULL,
+      .index = ink >= 0 ? (uint8_t)ink : 0,
+      .stride = c->stride,
+      .clip = plot_rect(c),
+      .origin_x = c->origin_x,
+      .origin_y = c->origin_y,
+      .weight = 1,
+  };
+}
+
+size_t stamp_chunk(Canvas *c, int32_t *xval, int32_t *yval, size_t n,
+                   Colour32 colour, ColumnDedupe *dedupe)
+{
+  // draws the current marker for every point, clipped to inside the border,
+  // returns how many were drawn. opaque points repeating a pixel are
+  // dropped first when there's a dedupe (sorted x)
+  if (c->svg != NULL) { return svg_stamp(c, xval, yval, n); }
+  StampTarget target = stamp_target(c, colour);
+  size_t duplicates = 0;
+  if (dedupe != NULL && target.counts == NULL)
   {
-    xpos = xpos - (label_len * font_size * 6) / 2;
+    n = dedupe_columns(dedupe, &target, xval, yval, n, &duplicates);
+  }
+  return duplicates +
+         stamp_points(&target, &point_stamp, xval, yval, n, colour);
+}
+
+bool stamp_weighted(Canvas *c, int32_t xval, int32_t yval, unsigned weight,
+                    Colour32 colour)
+{
+  // one marker standing in for weight points on the same pixel, a
+  // translucent one adds all their hits at once
+  if (c->svg != NULL) { return svg_stamp(c, &xval, &yval, 1) != 0; }
+  StampTarget target = stamp_target(c, colour);
+  target.weight = weight;
+  return stamp_points(&target, &point_stamp, &xval, &yval, 1, colour) != 0;
+}
 
-    for (int i = 0; i < label_len; ++i, xpos += 6 * font_size)
+void fill_rect(Canvas *c, Rect r, Colour32 colour)
+{
+  // an inclusive rectangle of canvas pixels, translucent colours count a
+  // hit on each for resolve_scatter() like a stamp does
+  if (c->svg != NULL)
+  {
+    svg_rect(c->svg, r.x0, r.y0, r.x1, r.y1, colour);
+    return;
+  }
+  if (colour >> 24 != 0xFF)
+  {
+    canvas_counts(c);
+    for (int y = r.y0; y <= r.y1; ++y)
     {
-      for (int x = 0; x < 5 * font_size; ++x)
+      uint16_t *hits = c->counts + (ptrdiff_t)y * c->stride;
+      for (int x = r.x0; x <= r.x1; ++x)
       {
-        for (int y = 0; y < 6 * font_size; ++y)
-        {
-          if (default_glyphs[(unsigned)*(label + i)][y / font_size]
-                            [x / font_size])
-          {
-            image[y + ypos][x + xpos] = COLOR_BLACK;
-          }
-        }
+        if (hits[x] < UINT16_MAX) { ++hits[x]; }
       }
     }
+    return;
   }
-  else if (orientation == 'v')
+  int ink = canvas_ink(c, colour);
+  for (int y = r.y0; y <= r.y1; ++y)
   {
-    ypos = 500 + (label_len * font_size * 5) / 2;
-    xpos = 50;
-    for (int i = 0; i < label_len; ++i, ypos -= 6 * font_size)
+    if (ink >= 0)
     {
-      for (int x = 0; x < 6 * font_size; ++x)
-      {
-        for (int y = 0; y < 5 * font_size; ++y)
-        {
-          if (default_glyphs[(unsigned)*(label + i)][x / font_size]
-                            [4 - y / font_size])
-          {
-            image[ypos + y][xpos + x] = COLOR_BLACK;
-          }
-        }
-      }
+      memset(c->indices + (ptrdiff_t)y * c->stride + r.x0, ink,
+             (size_t)(r.x1 - r.x0 + 1));
+      continue;
     }
+    Colour32 *row = c->pixels + (ptrdiff_t)y * c->stride;
+    for (int x = r.x0; x <= r.x1; ++x) { row[x] = colour; }
   }
 }
 
-void add_text(const char *xlabel, const char *ylabel, const char *title)
+void draw_bar(Canvas *c, Bounds b, double left, double right, double base,
+              double top, Colour32 colour)
 {
-  // function draws all the required text
-  draw_text(xlabel, label_font_size, 920, 500, 'h');  // adding an x-axis label
-  draw_text(ylabel, label_font_size, 50, 500, 'v');   // adding a y-axis label
-  draw_text(title, title_font_size, 50, 500, 'h');    // adding a title
+  // a bar from left to right and base up (or down) to top, all in axis
+  // units, clipped to the plot. one wide enough keeps a pixel clear on its
+  // right so its neighbour stands apart
+  const int size = c->plot_px * c->scale;
+  double sx = size / (b.max_x - b.min_x), sy = size / (b.max_y - b.min_y);
+  double x0 = floor((left - b.min_x) * sx);
+  double x1 = floor((right - b.min_x) * sx) - 1;
+  if (x1 - x0 >= 3 * c->scale) { x1 -= c->scale; }
+  if (x1 < x0) { x1 = x0; }
+  double y0 = floor((base - b.min_y) * sy), y1 = floor((top - b.min_y) * sy);
+  if (y1 < y0)
+  {
+    double swap = y0;
+    y0 = y1;
+    y1 = swap;
+  }
+  // to canvas pixels, clamped while still doubles so far ends can't
+  // overflow
+  const Rect clip = plot_rect(c);
+  double cx0 = fmax(c->origin_x + x0, clip.x0);
+  double cx1 = fmin(c->origin_x + x1, clip.x1);
+  double cy0 = fmax(c->origin_y - y1, clip.y0);
+  double cy1 = fmin(c->origin_y - y0, clip.y1);
+  if (!(cx0 <= cx1 && cy0 <= cy1)) { return; }  // off the plot, or NaN
+  fill_rect(c, (Rect){(int)cx0, (int)cy0, (int)cx1, (int)cy1}, colour);
 }
 
-/*--------------------------------------------------------------*/
-/*--------------------MAIN PLOTTING FUNCTION--------------------*/
-/*--------------------------------------------------------------*/
+void resolve_scatter(Canvas *c, Colour32 colour)
+{
+  // one blending pass for a translucent series once all its points are in
+  if (colour >> 24 == 0xFF || c->svg != NULL) { return; }
+  if (c->counts == NULL) { return; }  // nothing was drawn
+  if (canvas_indexed(c)) { resolve_indexed(c, plot_rect(c), colour); }
+  else
+  {
+    resolve_coverage(c->pixels, c->counts, c->stride, plot_rect(c), colour);
+  }
+}
 
-void plot(float *xarr, float *yarr, int size_array)
+void pixel_chunk(const Canvas *c, Bounds b, double *x, double *y, size_t n,
+                 int32_t *xval, int32_t *yval)
 {
-  // input should be of the form - plot(x array, y array, size of array)
-  array_length = size_array;
-  draw_background(COLOR_GREY);                     // fill in background
-  draw_border(COLOR_BLACK);                        // draw a plot area
-  draw_grid(COLOR_DARKGREY);                       // draw a grid if requested
-  add_text(plot_xlabel, plot_ylabel, plot_title);  // wonder what this one does
-  plot_scatter(xarr, yarr, COLOR_PURPLE);          // plot individual points
-  save_image_as_png(file_path);  // convert image to a png output
+  // data values to plot pixels - transformed in place then scaled
+  if (x_scale != SCALE_LINEAR)
+  {
+    transform_chunk(x, n, x_scale, symlog_linear);
+  }
+  if (y_scale != SCALE_LINEAR)
+  {
+    transform_chunk(y, n, y_scale, symlog_linear);
+  }
+  scale_chunk(x, n, b.min_x, b.max_x, c->plot_px * c->scale, xval);
+  scale_chunk(y, n, b.min_y, b.max_y, c->plot_px * c->scale, yval);
+}
+
+size_t scatter_chunk(Canvas *c, Bounds b, double *x, double *y, size_t n,
+                     const Bounds *window, Colour32 colour,
+                     ColumnDedupe *dedupe)
+{
+  // plots one chunk of loaded points individually, dropping the ones
+  // outside window first if there is one. x and y get overwritten
+  int32_t xval[PLOT_CHUNK], yval[PLOT_CHUNK];
+  if (window != NULL) { n = cull_chunk(x, y, n, *window); }
+  pixel_chunk(c, b, x, y, n, xval, yval);
+  return stamp_chunk(c, xval, yval, n, colour, dedupe);
+}
+
+size_t sorted_search(PlotArray x, size_t n, double value, bool after)
+{
+  // binary search over sorted x for the first index at or (with after)
+  // past value
+  size_t lo = 0, hi = n;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    double v;
+    load_chunk(x, mid, 1, &v);
+    if (after ? !(v > value) : !(v >= value)) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+  return lo;
+}
+
+void plot_scatter(Canvas *c, PlotArray x, PlotArray y, size_t n, Bounds b,
+                  Colour32 colour)
+{
+  // plots the given points, converting a chunk at a time. with axis
+  // limits set, points that can't reach the plot are culled before they're
+  // transformed. sorted x only reads the slice that can reach the plot and
+  // dedupes per column
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  size_t drawn = 0;
+  size_t begin = 0, end = n;
+  bool cull = limits_set();
+  Bounds window = cull_window(c, b);
+  ColumnDedupe dedupe;
+  if (b.x_sorted)
+  {
+    begin = sorted_search(x, n, window.min_x, false);
+    end = sorted_search(x, n, window.max_x, true);
+    dedupe_reset(&dedupe);
+  }
+  for (size_t start = begin; start < end; start += PLOT_CHUNK)
+  {
+    size_t count = end - start < PLOT_CHUNK ? end - start : PLOT_CHUNK;
+    load_chunk(x, start, count, xs);
+    load_chunk(y, start, count, ys);
+    drawn += scatter_chunk(c, b, xs, ys, count, cull ? &window : NULL, colour,
+                           b.x_sorted ? &dedupe : NULL);
+  }
+  trace_count(COUNT_POINTS_DRAWN, drawn);
+  trace_count(COUNT_POINTS_CULLED, n - drawn);
+}
+
+static void fill_block(Canvas *c, int x, int y, int size, Colour32 colour)
+{
+  // a size x size square of canvas pixels, clipped to the canvas
+  int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+  int x1 = x + size > c->width ? c->width : x + size;
+  int y1 = y + size > c->height ? c->height : y + size;
+  int ink = canvas_ink(c, colour);
+  for (int row = y0; row < y1; ++row)
+  {
+    if (ink >= 0 && x0 < x1)
+    {
+      memset(c->indices + (ptrdiff_t)row * c->stride + x0, ink, x1 - x0);
+      continue;
+    }
+    Colour32 *p = c->pixels + (ptrdiff_t)row * c->stride;
+    for (int col = x0; col < x1; ++col) { p[col] = colour; }
+  }
+}
+
+void draw_text(Canvas *c, const char *label, int font_size, int ypos,
+               int xpos, char orientation)
+{
+  // positions are in output pixels. 'h' is centred on xpos and 'r' ends at
+  // it, both with their top at ypos. 'v' reads upwards, centred on ypos with
+  // its left edge at xpos. every lit font pixel is filled as one block
+  int label_len = (int)strlen(label);
+  check_length(label_len, label);
+  if (c->svg != NULL)
+  {
+    svg_text(c->svg, label, font_size, ypos, xpos, orientation);
+    return;
+  }
+  int size = font_size * c->scale;
+  ypos *= c->scale;
+  xpos *= c->scale;
+  if (orientation == 'h') { xpos -= (label_len * size * 6) / 2; }
+  else if (orientation == 'r') { xpos -= label_len * size * 6 - size; }
+  else if (orientation == 'v')
+  {
+    ypos += (6 * label_len * size - 11 * size) / 2;
+  }
+
+  for (int i = 0; i < label_len; ++i)
+  {
+    char(*glyph)[FONT_WIDTH] = default_glyphs[(unsigned char)label[i] & 127];
+    for (int gy = 0; gy < FONT_HEIGHT; ++gy)
+    {
+      for (int gx = 0; gx < 5; ++gx)
+      {
+        if (!glyph[gy][gx]) { continue; }
+        if (orientation == 'v')
+        {  // turned a quarter anticlockwise
+          fill_block(c, xpos + gy * size, ypos - i * 6 * size + (4 - gx) * size,
+                     size, COLOR_BLACK);
+        }
+        else
+        {
+          fill_block(c, xpos + (i * 6 + gx) * size, ypos + gy * size, size,
+                     COLOR_BLACK);
+        }
+      }
+    }
+  }
+}
+
+void add_text(Canvas *c, const char *xlabel, const char *ylabel,
+              const char *title)
+{
+  // function draws all the required text
+  const Frame f = c->frame;
+  const int mid = f.size / 2;
+  draw_text(c, xlabel, f.label_font, f.size * 94 / 100, mid, 'h');  // x label
+  draw_text(c, ylabel, f.label_font, mid, f.size * 16 / WIDTH, 'v');
+  draw_text(c, title, f.title_font, f.size * 5 / 100, mid, 'h');
+}
+
+void draw_ticks(Canvas *c, Bounds b, bool x_ticks, Colour32 colour)
+{
+  // numeric ticks and labels along the left edge, and the bottom unless
+  // that's a time axis with its own
+  Tick ticks[MAX_TICKS];
+  const Frame f = c->frame;
+  const int border = f.border, bottom = f.size - f.border;
+  int char_width = 6 * f.tick_font;
+  int line_height = 6 * f.tick_font;
+  int origin_x = border + f.plot_border, origin_y = bottom - f.plot_border;
+
+  if (x_ticks)
+  {
+    int n = axis_ticks(b.min_x, b.max_x, x_scale, symlog_linear, c->plot_px,
+                       4 * char_width, char_width, ticks);
+    for (int i = 0; i < n; ++i)
+    {
+      int xpos = origin_x + (int)lround(ticks[i].pos);
+      fill_cells(c, xpos, bottom - 7, xpos, bottom, colour);
+      draw_text(c, ticks[i].label, f.tick_font, bottom + 6, xpos, 'h');
+    }
+  }
+
+  int n = axis_ticks(b.min_y, b.max_y, y_scale, symlog_linear, c->plot_px,
+                     4 * line_height, 0, ticks);
+  // the labels sit between the y label and the border, smaller if needed
+  int room = border - 6 - (f.size * 16 / WIDTH + 7 * f.label_font);
+  int widest = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    int len = (int)strlen(ticks[i].label);
+    if (len > widest) { widest = len; }
+  }
+  int font_size = widest * char_width <= room ? f.tick_font : 1;
+  for (int i = 0; i < n; ++i)
+  {
+    int ypos = origin_y - (int)lround(ticks[i].pos);
+    fill_cells(c, border, ypos, border + 7, ypos, colour);
+    draw_text(c, ticks[i].label, font_size, ypos - 3 * font_size, border - 6,
+              'r');
+  }
+}
+
+/*--------------------------------------------------------------*/
+/*-----------------------TIMESTAMP X AXIS-----------------------*/
+/*--------------------------------------------------------------*/
+
+static const int64_t ns_per_unit[] = {
+    [TIME_S] = 1000000000, [TIME_MS] = 1000000, [TIME_US] = 1000,
+    [TIME_NS] = 1,
+};
+
+void load_time_chunk(PlotArray arr, size_t start, size_t count, int64_t *out,
+                     double *y)
+{
+  // reading timestamps without going through a double, a null timestamp
+  // drops the point by turning its y into NaN
+  const char *p = (const char *)arr.data + start * arr.stride;
+  for (size_t i = 0; i < count; ++i, p += arr.stride)
+  {
+    if (arr.type == PLOT_I64) { memcpy(&out[i], p, sizeof out[i]); }
+    else
+    {
+      int32_t v;
+      memcpy(&v, p, sizeof v);
+      out[i] = v;
+    }
+  }
+  if (arr.validity == NULL) { return; }
+  size_t bit = arr.validity_offset + start;
+  for (size_t i = 0; i < count; ++i, ++bit)
+  {
+    if (!((arr.validity[bit >> 3] >> (bit & 7)) & 1)) { y[i] = NAN; }
+  }
+}
+
+TimeScale time_scale(int64_t t_min, int64_t t_max, int size)
+{
+  // the window [t_min, t_max] across size pixels
+  TimeScale ts = {.start = t_min, .end = t_max, .size = size};
+  // shifting the span down to 24 bits keeps the 32.32 multiply in range and
+  // still leaves a few hundred steps per pixel
+  uint64_t span = (uint64_t)t_max - (uint64_t)t_min;
+  while ((span >> ts.shift) >= (1u << 24)) { ++ts.shift; }
+  uint64_t shifted = span >> ts.shift;
+  ts.mul = shifted ? ((uint64_t)size << 32) / shifted : 0;
+  return ts;
+}
+
+static inline int32_t time_pixel(TimeScale ts, int64_t t)
+{
+  // pixels from the start of the window, never decreasing with t
+  uint64_t offset = (uint64_t)t - (uint64_t)ts.start;
+  if (ts.mul == 0) { return ts.size / 2; }
+  return (int32_t)(((offset >> ts.shift) * ts.mul) >> 32);
+}
+
+Bounds compute_time_bounds(PlotArray x, PlotArray y, size_t n, int size,
+                           TimeScale *ts)
+{
+  // bounds pass for a timestamp axis - exact int64 range for x, usual y
+  Bounds b = {0, 0, INFINITY, -INFINITY, true};
+  int64_t t_min = INT64_MAX, t_max = INT64_MIN, t_last = INT64_MIN;
+  int64_t ts_buf[PLOT_CHUNK];
+  double ys[PLOT_CHUNK];
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
+  {
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_axis_chunk(y, start, count, y_scale, ys);
+    load_time_chunk(x, start, count, ts_buf, ys);
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (!isfinite(ys[i])) { continue; }
+      if (ts_buf[i] < t_last) { b.x_sorted = false; }
+      t_last = ts_buf[i];
+      if (ts_buf[i] < t_min) { t_min = ts_buf[i]; }
+      if (ts_buf[i] > t_max) { t_max = ts_buf[i]; }
+      if (ys[i] < b.min_y) { b.min_y = ys[i]; }
+      if (ys[i] > b.max_y) { b.max_y = ys[i]; }
+    }
+  }
+  b.x_sorted = b.x_sorted || x_declared_sorted;
+  if (t_min > t_max)
+  {  // nothing to plot
+    t_min = t_max = 0;
+    b.min_y = b.max_y = 0;
+  }
+
+  *ts = time_scale(t_min, t_max, size);
+  b.max_x = (double)((uint64_t)t_max - (uint64_t)t_min);
+  return b;
+}
+
+void time_scale_chunk(const int64_t *t, const double *y, size_t n,
+                      TimeScale ts, int32_t *out)
+{
+  // integer version of scale_chunk for timestamps, relative to the window
+  for (size_t i = 0; i < n; ++i)
+  {
+    out[i] = isfinite(y[i]) ? time_pixel(ts, t[i]) : PIXEL_NONE;
+  }
+}
+
+void plot_time_scatter(Canvas *c, PlotArray x, PlotArray y, size_t n,
+                       Bounds b, TimeScale ts, Colour32 colour)
+{
+  // plot_scatter for a timestamp x axis
+  int64_t ts_buf[PLOT_CHUNK];
+  double ys[PLOT_CHUNK];
+  int32_t xval[PLOT_CHUNK], yval[PLOT_CHUNK];
+  size_t drawn = 0;
+  ColumnDedupe dedupe;
+  if (b.x_sorted) { dedupe_reset(&dedupe); }
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
+  {
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_axis_chunk(y, start, count, y_scale, ys);
+    load_time_chunk(x, start, count, ts_buf, ys);
+    time_scale_chunk(ts_buf, ys, count, ts, xval);
+    scale_chunk(ys, count, b.min_y, b.max_y, c->plot_px * c->scale, yval);
+    drawn += stamp_chunk(c, xval, yval, count, colour,
+                         b.x_sorted ? &dedupe : NULL);
+  }
+  trace_count(COUNT_POINTS_DRAWN, drawn);
+  trace_count(COUNT_POINTS_CULLED, n - drawn);
+}
+
+// days <-> civil date, proleptic gregorian (howard hinnant's algorithms)
+void civil_from_days(int64_t z, int *year, int *month, int *day)
+{
+  z += 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  int64_t doe = z - era * 146097;
+  int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int64_t mp = (5 * doy + 2) / 153;
+  *day = (int)(doy - (153 * mp + 2) / 5 + 1);
+  *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+  *year = (int)(yoe + era * 400 + (*month <= 2));
+}
+
+int64_t days_from_civil(int year, int month, int day)
+{
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yoe = year - era * 400;
+  int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+  int64_t q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static int64_t month_start(int month_index)
+{
+  // day of the first of month year * 12 + month - 1, floored so months
+  // before year 0 count back from december
+  int64_t year = floor_div(month_index, 12);
+  return days_from_civil((int)year, (int)(month_index - year * 12) + 1, 1);
+}
+
+// candidate tick spacings - fixed lengths in ns, or a number of months
+typedef struct
+{
+  int64_t ns;
+  int months;
+} TimeStep;
+
+#define NS_SEC 1000000000LL
+#define NS_DAY (86400 * NS_SEC)
+static const TimeStep time_steps[] = {
+    {1, 0}, {2, 0}, {5, 0}, {10, 0}, {20, 0}, {50, 0}, {100, 0}, {200, 0},
+    {500, 0}, {1000, 0}, {2000, 0}, {5000, 0}, {10000, 0}, {20000, 0},
+    {50000, 0}, {100000, 0}, {200000, 0}, {500000, 0}, {1000000, 0},
+    {2000000, 0}, {5000000, 0}, {10000000, 0}, {20000000, 0}, {50000000, 0},
+    {100000000, 0}, {200000000, 0}, {500000000, 0}, {NS_SEC, 0},
+    {2 * NS_SEC, 0}, {5 * NS_SEC, 0}, {10 * NS_SEC, 0}, {15 * NS_SEC, 0},
+    {30 * NS_SEC, 0}, {60 * NS_SEC, 0}, {120 * NS_SEC, 0}, {300 * NS_SEC, 0},
+    {600 * NS_SEC, 0}, {900 * NS_SEC, 0}, {1800 * NS_SEC, 0},
+    {3600 * NS_SEC, 0}, {7200 * NS_SEC, 0}, {10800 * NS_SEC, 0},
+    {21600 * NS_SEC, 0}, {43200 * NS_SEC, 0}, {NS_DAY, 0}, {2 * NS_DAY, 0},
+    {7 * NS_DAY, 0}, {14 * NS_DAY, 0}, {0, 1}, {0, 2}, {0, 3}, {0, 6},
+    {0, 12}, {0, 24}, {0, 60}, {0, 120}, {0, 240}, {0, 600}, {0, 1200},
+};
+
+int time_label_length(TimeStep step)
+{
+  // characters in a label for this spacing, see format_time_label
+  if (step.months >= 12) { return 4; }  // 2024
+  if (step.months > 0) { return 7; }    // 2024-03
+  if (step.ns >= NS_DAY) { return 10; }  // 2024-03-15
+  if (step.ns >= 60 * NS_SEC) { return 5; }  // 14:30
+  if (step.ns >= NS_SEC) { return 8; }   // 14:30:05
+  int digits = 9;                        // 05.250
+  for (int64_t s = step.ns; s % 10 == 0; s /= 10) { --digits; }
+  return 3 + digits;
+}
+
+void format_time_label(char *buf, size_t size, int64_t t, TimeUnit unit,
+                       TimeStep step)
+{
+  // writes the calendar label of timestamp t, precise to the tick spacing
+  int64_t units_per_day = NS_DAY / ns_per_unit[unit];
+  int64_t days = floor_div(t, units_per_day);
+  int64_t in_day = (t - days * units_per_day) * ns_per_unit[unit];
+  int year, month, day;
+  civil_from_days(days, &year, &month, &day);
+  int hour = (int)(in_day / (3600 * NS_SEC));
+  int minute = (int)(in_day / (60 * NS_SEC) % 60);
+  int second = (int)(in_day / NS_SEC % 60);
+  int len = time_label_length(step);
+
+  if (step.months >= 12) { snprintf(buf, size, "%04d", year); }
+  else if (step.months > 0) { snprintf(buf, size, "%04d-%02d", year, month); }
+  else if (step.ns >= NS_DAY)
+  {
+    snprintf(buf, size, "%04d-%02d-%02d", year, month, day);
+  }
+  else if (step.ns >= 60 * NS_SEC)
+  {
+    snprintf(buf, size, "%02d:%02d", hour, minute);
+  }
+  else if (step.ns >= NS_SEC)
+  {
+    snprintf(buf, size, "%02d:%02d:%02d", hour, minute, second);
+  }
+  else
+  {
+    long long frac = in_day % NS_SEC;
+    for (int d = 9; d > len - 3; --d) { frac /= 10; }
+    snprintf(buf, size, "%02d.%0*lld", second, len - 3, frac);
+  }
+}
+
+void draw_time_ticks(Canvas *c, TimeScale ts, TimeUnit unit, Colour32 colour)
+{
+  // calendar aligned ticks and labels under the plot area
+  int64_t unit_ns = ns_per_unit[unit];
+  double span_ns = ((double)ts.end - (double)ts.start) * (double)unit_ns;
+  const Frame f = c->frame;
+  const int bottom = f.size - f.border;
+  int char_width = 6 * f.tick_font;
+
+  // smallest spacing whose labels fit side by side
+  size_t s = 0;
+  for (; s + 1 < sizeof time_steps / sizeof time_steps[0]; ++s)
+  {
+    TimeStep step = time_steps[s];
+    if (step.ns != 0 && step.ns % unit_ns != 0) { continue; }
+    double step_ns = step.months ? step.months * 30.44 * NS_DAY : step.ns;
+    double ticks = span_ns / step_ns + 1;
+    double label_px = (time_label_length(step) + 2) * char_width;
+    if (ticks * label_px <= c->plot_px) { break; }
+  }
+  TimeStep step = time_steps[s];
+
+  int64_t t;
+  int64_t units_per_day = NS_DAY / unit_ns;
+  int month_index = 0;
+  if (step.months)
+  {  // first month boundary that's a multiple of the step
+    int year, month, day;
+    civil_from_days(floor_div(ts.start, units_per_day), &year, &month, &day);
+    month_index = year * 12 + month - 1;
+    if (day != 1 || ts.start % units_per_day != 0) { ++month_index; }
+    month_index += (step.months - month_index % step.months) % step.months;
+    t = month_start(month_index) * units_per_day;
+  }
+  else
+  {
+    int64_t step_units = step.ns / unit_ns;
+    t = floor_div(ts.start, step_units) * step_units;
+    if (t < ts.start) { t += step_units; }
+  }
+
+  while (t <= ts.end)
+  {
+    int32_t xval;
+    double y = 0;
+    time_scale_chunk(&t, &y, 1, ts, &xval);
+    int xpos = (f.plot_border + f.border) + xval / c->scale;
+    fill_cells(c, xpos, bottom - 7, xpos, bottom, colour);
+
+    char label[24];
+    format_time_label(label, sizeof label, t, unit, step);
+    draw_text(c, label, f.tick_font, bottom + 6, xpos, 'h');
+
+    // stepping without overflowing when the window ends near int64 max
+    if (step.months)
+    {
+      month_index += step.months;
+      int64_t d = month_start(month_index);
+      if (d > floor_div(ts.end, units_per_day)) { break; }
+      t = d * units_per_day;
+    }
+    else if (ts.end - t < step.ns / unit_ns) { break; }
+    else { t += step.ns / unit_ns; }
+  }
+}
+
+PlotArray arrow_array(const struct ArrowArray *array,
+                      const struct ArrowSchema *schema)
+{
+  // wrapping the buffers of a primitive arrow array without copying them
+  const char *format = schema->format;
+  PlotArray arr = {0};
+  if (strcmp(format, "f") == 0) { arr.type = PLOT_F32; }
+  else if (strcmp(format, "g") == 0) { arr.type = PLOT_F64; }
+  else if (strcmp(format, "i") == 0 || strcmp(format, "tdD") == 0)
+  {
+    arr.type = PLOT_I32;
+  }
+  else if (strcmp(format, "l") == 0 || strcmp(format, "tdm") == 0 ||
+           strncmp(format, "ts", 2) == 0)
+  {  // timestamps are int64 with a unit and optional timezone after "ts"
+    arr.type = PLOT_I64;
+  }
+  else if (strcmp(format, "S") == 0) { arr.type = PLOT_U16; }
+  else
+  {
+    printf("ERROR: unsupported arrow format \"%s\" - use f, g, i, l, S or ts\n",
+           format);
+    exit(1);
+  }
+  if (array->n_buffers != 2 || array->buffers[1] == NULL)
+  {
+    printf("ERROR: arrow array is not a primitive array\n");
+    exit(1);
+  }
+
+  const size_t sizes[] = {
+      [PLOT_F32] = 4, [PLOT_F64] = 8, [PLOT_I32] = 4,
+      [PLOT_I64] = 8, [PLOT_U16] = 2,
+  };
+  arr.stride = sizes[arr.type];
+  arr.data = (const char *)array->buffers[1] + array->offset * arr.stride;
+  if (array->null_count != 0 && array->buffers[0] != NULL)
+  {
+    arr.validity = array->buffers[0];
+    arr.validity_offset = (size_t)array->offset;
+  }
+  return arr;
+}
+
+void plot_arrow(const struct ArrowArray *x, const struct ArrowSchema *x_schema,
+                const struct ArrowArray *y, const struct ArrowSchema *y_schema)
+{
+  // plot() for arrow arrays, nulls in either array drop the point
+  if (x->length != y->length)
+  {
+    printf("ERROR: arrow arrays have different lengths (%lld and %lld)\n",
+           (long long)x->length, (long long)y->length);
+    exit(1);
+  }
+  // arrow timestamps carry their unit, so they get a time axis for free
+  const char *format = x_schema->format;
+  TimeUnit previous = x_time;
+  if (strncmp(format, "ts", 2) == 0)
+  {
+    x_time = format[2] == 's'   ? TIME_S
+             : format[2] == 'm' ? TIME_MS
+             : format[2] == 'u' ? TIME_US
+                                : TIME_NS;
+  }
+  plot_arrays(arrow_array(x, x_schema), arrow_array(y, y_schema),
+              (size_t)x->length);
+  x_time = previous;
+}
+
+/*--------------------------------------------------------------*/
+/*--------------------MAIN PLOTTING FUNCTION--------------------*/
+/*--------------------------------------------------------------*/
+
+static void draw_frame(Canvas *c, Bounds b, const TimeScale *ts)
+{
+  // everything but the points, ts is set for a time axis
+  uint64_t t = trace_begin();
+  draw_background(c, COLOR_GREY);  // fill in background
+  draw_border(c, COLOR_BLACK);      // draw a plot area
+  trace_end(TRACE_BACKGROUND, t);
+  t = trace_begin();
+  draw_grid(c, COLOR_DARKGREY);  // draw a grid if requested
+  trace_end(TRACE_GRID, t);
+  t = trace_begin();
+  add_text(c, plot_xlabel, plot_ylabel, plot_title);  // wonder what this does
+  draw_ticks(c, b, ts == NULL, COLOR_BLACK);
+  if (ts != NULL) { draw_time_ticks(c, *ts, x_time, COLOR_BLACK); }
+  trace_end(TRACE_TEXT, t);
+}
+
+static void draw_points(Canvas *c, PlotArray x, PlotArray y, size_t size_array)
+{
+  // plot() drawn on c, the points with their frame
+  trace_count(COUNT_POINTS_IN, size_array);
+
+  uint64_t t = trace_begin();
+  TimeScale ts;
+  Bounds bounds =
+      x_time ? compute_time_bounds(x, y, size_array, c->plot_px * c->scale, &ts)
+             : axis_bounds(x, y, size_array);
+  if (x_time)
+  {
+    pin_axis(&bounds.min_y, &bounds.max_y, axis_limits.min_y,
+             axis_limits.max_y, y_scale);
+  }
+  trace_end(TRACE_BOUNDS, t);
+
+  draw_frame(c, bounds, x_time ? &ts : NULL);
+
+  t = trace_begin();
+  if (series_colour >> 24 != 0)
+  {  // a fully transparent series has nothing to draw
+    if (x_time)
+    {
+      plot_time_scatter(c, x, y, size_array, bounds, ts, series_colour);
+    }
+    else { plot_scatter(c, x, y, size_array, bounds, series_colour); }
+    resolve_scatter(c, series_colour);
+  }
+  trace_end(TRACE_SCATTER, t);
+}
+
+void plot_arrays(PlotArray x, PlotArray y, size_t size_array)
+{
+  // input should be of the form - plot(x array, y array, size of array)
+  Panel panel = {.kind = PANEL_POINTS, .x = x, .y = y, .n = size_array};
+  check_panel(&panel);
+  if (subplot_add(panel)) { return; }
+  uint64_t plot_start = trace_begin();
+
+  Canvas *c = plot_canvas();
+  draw_points(c, x, y, size_array);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+Bounds index_bounds(const PlotIndex *index)
+{
+  // axis_bounds() for an index - on linear axes the range from the build
+  // stands in for the pass over the data
+  if (x_scale != SCALE_LINEAR || y_scale != SCALE_LINEAR)
+  {  // the stored range is raw values, log axes need the smallest positive
+    return axis_bounds(plot_array(index->x), plot_array(index->y), index->n);
+  }
+  Bounds b = index->bounds;
+  b.x_sorted = false;
+  pin_axis(&b.min_x, &b.max_x, axis_limits.min_x, axis_limits.max_x,
+           x_scale);
+  pin_axis(&b.min_y, &b.max_y, axis_limits.min_y, axis_limits.max_y,
+           y_scale);
+  return b;
+}
+
+void plot_index(const PlotIndex *index)
+{
+  // plot() for a built index, only the cells the view overlaps are read
+  if (x_time != TIME_OFF)
+  {
+    printf("ERROR: an index can't be drawn on a time axis\n");
+    exit(1);
+  }
+  subplot_check("plot_index()");
+  uint64_t plot_start = trace_begin();
+  trace_count(COUNT_POINTS_IN, index->n);
+
+  Canvas *c = plot_canvas();
+
+  uint64_t t = trace_begin();
+  Bounds bounds = index_bounds(index);
+  trace_end(TRACE_BOUNDS, t);
+
+  draw_frame(c, bounds, NULL);
+
+  t = trace_begin();
+  if (series_colour >> 24 != 0)
+  {
+    size_t drawn = index_scatter(c, index, bounds, series_colour);
+    trace_count(COUNT_POINTS_DRAWN, drawn);
+    trace_count(COUNT_POINTS_CULLED, index->n - drawn);
+    resolve_scatter(c, series_colour);
+  }
+  trace_end(TRACE_SCATTER, t);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+static size_t column_end(const TimePyramid *p, TimeScale ts, size_t begin,
+                         size_t end, int32_t column)
+{
+  // first sample in [begin, end) landing right of the column
+  while (begin < end)
+  {
+    size_t mid = begin + (end - begin) / 2;
+    if (time_pixel(ts, p->t[mid]) <= column) { begin = mid + 1; }
+    else { end = mid; }
+  }
+  return begin;
+}
+
+void plot_pyramid(const TimePyramid *p, int64_t start, int64_t end)
+{
+  // plot() of a pyramid's samples from start to end (inclusive, in the
+  // time_axis() unit). each pixel column is one range query giving the
+  // lowest and highest value in it, drawn as the marker swept between the
+  // two, so the work goes with the width of the plot and not the samples
+  if (x_time == TIME_OFF)
+  {
+    printf("ERROR: plot_pyramid() needs a time_axis()\n");
+    exit(1);
+  }
+  if (y_scale != SCALE_LINEAR)
+  {
+    printf("ERROR: plot_pyramid() only does a linear y axis so far\n");
+    exit(1);
+  }
+  if (start > end)
+  {
+    printf("ERROR: plot_pyramid() window ends before it starts\n");
+    exit(1);
+  }
+  subplot_check("plot_pyramid()");
+  uint64_t plot_start = trace_begin();
+  size_t first = pyramid_find(p, start);
+  size_t last = end == INT64_MAX ? pyramid_length(p) : pyramid_find(p, end + 1);
+  trace_count(COUNT_POINTS_IN, last - first);
+
+  Canvas *c = plot_canvas();
+
+  uint64_t t = trace_begin();
+  TimeScale ts = time_scale(start, end, c->plot_px * c->scale);
+  MinMax range = pyramid_range(p, first, last);
+  if (range.min > range.max) { range.min = range.max = 0; }
+  Bounds bounds = {0, (double)((uint64_t)end - (uint64_t)start), range.min,
+                   range.max, true};
+  pin_axis(&bounds.min_y, &bounds.max_y, axis_limits.min_y, axis_limits.max_y,
+           y_scale);
+  trace_end(TRACE_BOUNDS, t);
+
+  draw_frame(c, bounds, &ts);
+
+  t = trace_begin();
+  if (series_colour >> 24 != 0)
+  {
+    StampTarget target = stamp_target(c, series_colour);
+    const Stamp *stamp = marker_stamp(c->scale);
+    size_t drawn = 0;
+    for (size_t i = first; i < last;)
+    {
+      int32_t column = time_pixel(ts, p->t[i]);
+      size_t next = column_end(p, ts, i, last, column);
+      MinMax m = pyramid_range(p, i, next);
+      if (m.min <= m.max)
+      {
+        double v[2] = {m.min, m.max};
+        int32_t y[2];
+        scale_chunk(v, 2, bounds.min_y, bounds.max_y,
+                    c->plot_px * c->scale, y);
+        bool hit;
+        if (c->svg != NULL) { hit = svg_column(c, column, y[0], y[1]); }
+        else if (y[0] == y[1])
+        {
+          hit = stamp_points(&target, stamp, &column, y, 1, series_colour);
+        }
+        else
+        {
+          hit = stamp_column(&target, stamp, column, y[0], y[1],
+                             series_colour);
+        }
+        if (hit) { drawn += next - i; }
+      }
+      i = next;
+    }
+    trace_count(COUNT_POINTS_DRAWN, drawn);
+    trace_count(COUNT_POINTS_CULLED, last - first - drawn);
+    resolve_scatter(c, series_colour);
+  }
+  trace_end(TRACE_SCATTER, t);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+void plot_file(PlotFileArray x, PlotFileArray y)
+{
+  // plot() straight from files too big to load - one streamed pass for the
+  // bounds and one to draw, holding a few windows of each file at a time.
+  // the shorter file sets how many points there are
+  if (x_time != TIME_OFF)
+  {
+    printf("ERROR: plot_file() doesn't do time axes yet\n");
+    exit(1);
+  }
+  subplot_check("plot_file()");
+  uint64_t plot_start = trace_begin();
+  StreamArray xs, ys;
+  stream_open(&xs, x);
+  stream_open(&ys, y);
+  size_t n = xs.n < ys.n ? xs.n : ys.n;
+  trace_count(COUNT_POINTS_IN, n);
+
+  Canvas *c = plot_canvas();
+
+  uint64_t t = trace_begin();
+  Bounds bounds = {0, 0, 0, 0, x_declared_sorted};
+  if (bounds_need_data()) { bounds = stream_bounds(&xs, &ys, n); }
+  bounds = pin_bounds(bounds);
+  trace_end(TRACE_BOUNDS, t);
+
+  draw_frame(c, bounds, NULL);
+
+  t = trace_begin();
+  if (series_colour >> 24 != 0)
+  {
+    size_t drawn = stream_scatter(c, &xs, &ys, n, bounds, limits_set(),
+                                  series_colour);
+    trace_count(COUNT_POINTS_DRAWN, drawn);
+    trace_count(COUNT_POINTS_CULLED, n - drawn);
+    resolve_scatter(c, series_colour);
+  }
+  trace_end(TRACE_SCATTER, t);
+  stream_close(&xs);
+  stream_close(&ys);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+void plot_gorilla(const char *path)
+{
+  // plot() of a series gorilla_write() compressed, on a time axis if one's
+  // set and plain numbers otherwise. the points are decoded a chunk at a
+  // time right into the drawing
+  if (x_time != TIME_OFF && x_scale != SCALE_LINEAR)
+  {
+    printf("ERROR: a time axis can't use a log or symlog scale\n");
+    exit(1);
+  }
+  if (x_time != TIME_OFF &&
+      (!isnan(axis_limits.min_x) || !isnan(axis_limits.max_x)))
+  {
+    printf("ERROR: xlim() doesn't work with a time axis yet\n");
+    exit(1);
+  }
+  subplot_check("plot_gorilla()");
+  uint64_t plot_start = trace_begin();
+  GorillaFile g;
+  gorilla_open(&g, path);
+  trace_count(COUNT_POINTS_IN, g.count);
+
+  Canvas *c = plot_canvas();
+
+  uint64_t t = trace_begin();
+  TimeScale ts;
+  Bounds bounds =
+      gorilla_bounds(&g, x_time ? &ts : NULL, c->plot_px * c->scale);
+  if (x_time)
+  {
+    pin_axis(&bounds.min_y, &bounds.max_y, axis_limits.min_y,
+             axis_limits.max_y, y_scale);
+  }
+  else { bounds = pin_bounds(bounds); }
+  trace_end(TRACE_BOUNDS, t);
+
+  draw_frame(c, bounds, x_time ? &ts : NULL);
+
+  t = trace_begin();
+  if (series_colour >> 24 != 0)
+  {
+    size_t drawn = gorilla_scatter(c, &g, bounds, x_time ? &ts : NULL,
+                                   limits_set(), series_colour);
+    trace_count(COUNT_POINTS_DRAWN, drawn);
+    trace_count(COUNT_POINTS_CULLED, g.count - drawn);
+    resolve_scatter(c, series_colour);
+  }
+  trace_end(TRACE_SCATTER, t);
+  gorilla_close(&g);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+static void draw_hist(Canvas *c, PlotArray values, size_t n, int bins)
+{
+  // plot_hist() drawn on c
+  trace_count(COUNT_POINTS_IN, n);
+
+  uint64_t t = trace_begin();
+  Bounds bounds = {0, 1, 0, 1, false};
+  if (isnan(axis_limits.min_x) || isnan(axis_limits.max_x))
+  {
+    if (hist_range(values, n, &bounds.min_x, &bounds.max_x) &&
+        !(bounds.max_x > bounds.min_x))
+    {  // every value the same, it gets a bin one wide
+      bounds.min_x -= 0.5;
+      bounds.max_x += 0.5;
+    }
+  }
+  pin_axis(&bounds.min_x, &bounds.max_x, axis_limits.min_x,
+           axis_limits.max_x, x_scale);
+  trace_end(TRACE_BOUNDS, t);
+
+  t = trace_begin();
+  if (bins == 0) { bins = hist_bins(n); }
+  uint64_t *counts = trace_malloc(bins * sizeof *counts);
+  assert(counts != NULL);
+  size_t binned =
+      hist_count(values, n, bounds.min_x, bounds.max_x, bins, counts);
+  uint64_t most = 0;
+  for (int i = 0; i < bins; ++i)
+  {
+    if (counts[i] > most) { most = counts[i]; }
+  }
+  // the bars stand on 0, which is also where a count of 1 sits on a log
+  // axis
+  bounds.max_y = most > 0 ? axis_value((double)most, y_scale, symlog_linear)
+                          : 1;
+  if (!(bounds.max_y > 0)) { bounds.max_y = 1; }
+  pin_axis(&bounds.min_y, &bounds.max_y, axis_limits.min_y,
+           axis_limits.max_y, y_scale);
+  trace_end(TRACE_SCATTER, t);
+
+  draw_frame(c, bounds, NULL);
+
+  t = trace_begin();
+  if (series_colour >> 24 != 0)
+  {
+    double width = (bounds.max_x - bounds.min_x) / bins;
+    for (int i = 0; i < bins; ++i)
+    {
+      if (counts[i] == 0) { continue; }
+      double left = bounds.min_x + i * width;
+      draw_bar(c, bounds, left, left + width, 0,
+               axis_value((double)counts[i], y_scale, symlog_linear),
+               series_colour);
+    }
+    resolve_scatter(c, series_colour);
+  }
+  trace_count(COUNT_POINTS_DRAWN, binned);
+  trace_count(COUNT_POINTS_CULLED, n - binned);
+  trace_end(TRACE_SCATTER, t);
+  trace_free(counts);
+}
+
+void plot_hist(PlotArray values, size_t n, int bins)
+{
+  // a histogram of values along x as bars of the series colour, bins of
+  // 0 picks a count from n. xlim() sets the range binned, otherwise it's
+  // the range of the finite values. on a log x axis the bins are equal in
+  // log units, and a log y axis shows the counts' logs
+  Panel panel = {.kind = PANEL_HIST, .x = values, .n = n, .bins = bins};
+  check_panel(&panel);
+  if (subplot_add(panel)) { return; }
+  uint64_t plot_start = trace_begin();
+
+  Canvas *c = plot_canvas();
+  draw_hist(c, values, n, bins);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+static void draw_bars(Canvas *c, PlotArray heights, size_t n)
+{
+  // plot_bars() drawn on c
+  trace_count(COUNT_POINTS_IN, n);
+
+  uint64_t t = trace_begin();
+  double base = axis_value(0, y_scale, symlog_linear);  // NaN on a log axis
+  double hs[PLOT_CHUNK];
+  Bounds bounds = {-0.5, n - 0.5, INFINITY, -INFINITY, true};
+  if (!isnan(base)) { bounds.min_y = bounds.max_y = base; }
+  for (size_t start = 0; start < n; start += PLOT_CHUNK)
+  {
+    size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+    load_axis_chunk(heights, start, count, y_scale, hs);
+    for (size_t i = 0; i < count; ++i)
+    {  // x is fixed by n, only the heights widen the range
+      if (!isfinite(hs[i])) { continue; }
+      if (hs[i] < bounds.min_y) { bounds.min_y = hs[i]; }
+      if (hs[i] > bounds.max_y) { bounds.max_y = hs[i]; }
+    }
+  }
+  if (bounds.min_y > bounds.max_y) { bounds.min_y = bounds.max_y = 0; }
+  if (!(bounds.max_y > bounds.min_y)) { bounds.max_y = bounds.min_y + 1; }
+  if (n == 0) { bounds.max_x = 0.5; }
+  bounds = pin_bounds(bounds);
+  trace_end(TRACE_BOUNDS, t);
+
+  draw_frame(c, bounds, NULL);
+
+  t = trace_begin();
+  size_t drawn = 0;
+  if (series_colour >> 24 != 0)
+  {
+    if (isnan(base)) { base = bounds.min_y; }
+    for (size_t start = 0; start < n; start += PLOT_CHUNK)
+    {
+      size_t count = n - start < PLOT_CHUNK ? n - start : PLOT_CHUNK;
+      load_axis_chunk(heights, start, count, y_scale, hs);
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (!isfinite(hs[i])) { continue; }
+        double x = (double)(start + i);
+        draw_bar(c, bounds, x - 0.4, x + 0.4, base, hs[i], series_colour);
+        ++drawn;
+      }
+    }
+    resolve_scatter(c, series_colour);
+  }
+  trace_count(COUNT_POINTS_DRAWN, drawn);
+  trace_count(COUNT_POINTS_CULLED, n - drawn);
+  trace_end(TRACE_SCATTER, t);
+}
+
+void plot_bars(PlotArray heights, size_t n)
+{
+  // a bar chart, bar i centred on x = i and reaching from 0 to heights[i]
+  // (from the bottom on a log y axis)
+  Panel panel = {.kind = PANEL_BARS, .x = heights, .n = n};
+  check_panel(&panel);
+  if (subplot_add(panel)) { return; }
+  uint64_t plot_start = trace_begin();
+
+  Canvas *c = plot_canvas();
+  draw_bars(c, heights, n);
+
+  save_image_as_png(c, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
+
+bool panel_problem(const Panel *panel, char *message, size_t size)
+{
+  // true with why in message if the current settings can't draw the panel.
+  // only the arrays' types are looked at, not their data
+  const char *why = NULL;
+  switch (panel->kind)
+  {
+  case PANEL_POINTS:
+    if (x_time != TIME_OFF && panel->x.type != PLOT_I64 &&
+        panel->x.type != PLOT_I32)
+    {
+      why = "time_axis() needs int64_t or int32_t x values";
+    }
+    else if (x_time != TIME_OFF && x_scale != SCALE_LINEAR)
+    {
+      why = "a time axis can't use a log or symlog scale";
+    }
+    else if (x_time != TIME_OFF &&
+             (!isnan(axis_limits.min_x) || !isnan(axis_limits.max_x)))
+    {
+      why = "xlim() doesn't work with a time axis yet";
+    }
+    break;
+  case PANEL_HIST:
+    if (x_time != TIME_OFF) { why = "plot_hist() doesn't do time axes"; }
+    else if (panel->bins < 0 || panel->bins > plot_area)
+    {
+      snprintf(message, size,
+               "plot_hist() takes 1 to %d bins, or 0 to pick", plot_area);
+      return true;
+    }
+    break;
+  case PANEL_BARS:
+    if (x_time != TIME_OFF || x_scale != SCALE_LINEAR)
+    {
+      why = "plot_bars() needs a plain linear x axis";
+    }
+    break;
+  }
+  if (why == NULL) { return false; }
+  snprintf(message, size, "%s", why);
+  return true;
+}
+
+void check_panel(const Panel *panel)
+{
+  // stops with an error if the current settings can't draw the panel
+  char message[80];
+  if (panel_problem(panel, message, sizeof message))
+  {
+    printf("ERROR: %s\n", message);
+    exit(1);
+  }
+}
+
+void draw_panel(Canvas *c, const Panel *panel)
+{
+  // one panel of a subplot grid or chart of a batch, with its settings
+  // already taken on
+  switch (panel->kind)
+  {
+  case PANEL_POINTS:
+    draw_points(c, panel->x, panel->y, panel->n);
+    break;
+  case PANEL_HIST:
+    draw_hist(c, panel->x, panel->n, panel->bins);
+    break;
+  case PANEL_BARS:
+    draw_bars(c, panel->x, panel->n);
+    break;
+  }
 }
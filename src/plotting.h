@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -22,7 +24,9 @@
 #define DEFAULT_X_LABEL "x-axis"
 #define DEFAULT_Y_LABEL "y-axis"
 #define DOT_SIZE 2
+#define MARKER_MAX_SIZE 16
 #define GRID_DENSITY 10
+#define PLOT_CHUNK 1024  // points converted per pass of the kernels
 
 // colours in hex 
 // 0xAABBGGRR
@@ -38,11 +42,254 @@
 // useless typedef
 typedef uint32_t Colour32;
 
+// element types plot() can read directly
+typedef enum
+{
+  PLOT_F32,
+  PLOT_F64,
+  PLOT_I32,
+  PLOT_I64,
+  PLOT_U16,
+} PlotType;
+
+// typed view over caller memory - stride is in bytes so a field of an array
+// of structs can be read in place, nothing gets copied
+typedef struct
+{
+  const void *data;
+  size_t stride;
+  PlotType type;
+  const uint8_t *validity;  // optional arrow bitmap, 0 bits get skipped
+  size_t validity_offset;   // bit index of element 0 in the bitmap
+} PlotArray;
+
+#define PLOT_TYPE_OF(ptr)            \
+  _Generic((ptr),                    \
+      float *: PLOT_F32,             \
+      const float *: PLOT_F32,       \
+      double *: PLOT_F64,            \
+      const double *: PLOT_F64,      \
+      int32_t *: PLOT_I32,           \
+      const int32_t *: PLOT_I32,     \
+      int64_t *: PLOT_I64,           \
+      const int64_t *: PLOT_I64,     \
+      uint16_t *: PLOT_U16,          \
+      const uint16_t *: PLOT_U16)
+
+// plot_array(ptr) - contiguous array of float/double/int32/int64/uint16
+// plot_array_strided(ptr, stride) - every stride bytes starting at ptr
+// plot_field(records, field) - one member of an array of structs
+#define plot_array_strided(ptr, step) \
+  ((PlotArray){.data = (ptr), .stride = (step), .type = PLOT_TYPE_OF(ptr)})
+#define plot_array(ptr) plot_array_strided((ptr), sizeof *(ptr))
+#define plot_field(records, field) \
+  plot_array_strided(&(records)->field, sizeof *(records))
+
+// a column of values in a binary file for plot_file() - element i is at
+// offset + i * stride bytes, stride 0 meaning packed. the file is read
+// where it lies, in the machine's byte order
+typedef struct
+{
+  const char *path;
+  size_t offset;
+  size_t stride;
+  PlotType type;
+} PlotFileArray;
+
+#define plot_file_array(file, elem) \
+  ((PlotFileArray){.path = (file), .type = (elem)})
+
+// marker shapes for the points
+typedef enum
+{
+  MARKER_SQUARE,
+  MARKER_CIRCLE,
+  MARKER_CROSS,
+  MARKER_PLUS,
+  MARKER_DIAMOND,
+  MARKER_PIXEL,
+} Marker;
+
+// units for int64 timestamp x values (time since the unix epoch, utc)
+typedef enum
+{
+  TIME_OFF,
+  TIME_S,
+  TIME_MS,
+  TIME_US,
+  TIME_NS,
+} TimeUnit;
+
+// how values map onto an axis - symlog is log10(1 + |v| / threshold) with
+// the sign kept, so it's linear around zero and handles negatives
+typedef enum
+{
+  SCALE_LINEAR,
+  SCALE_LOG,
+  SCALE_SYMLOG,
+} AxisScale;
+
+// stages recorded by the tracer
+typedef enum
+{
+  TRACE_PLOT,
+  TRACE_BOUNDS,
+  TRACE_BACKGROUND,
+  TRACE_GRID,
+  TRACE_TEXT,
+  TRACE_SCATTER,
+  TRACE_PACK,
+  TRACE_ENCODE,
+  TRACE_WRITE,
+  TRACE_STAGE_COUNT,
+} TraceStage;
+
+// totals since the last trace_reset()
+typedef struct
+{
+  uint64_t stage_ns[TRACE_STAGE_COUNT];     // time spent in each stage
+  uint64_t stage_calls[TRACE_STAGE_COUNT];  // times each stage ran
+  uint64_t points_in;                       // points handed to plot()
+  uint64_t points_drawn;                    // points that got stamped
+  uint64_t points_culled;                   // NaN/null/off-plot points
+  uint64_t deflate_in_bytes;                // filtered scanlines into deflate
+  uint64_t encoded_bytes;                   // bytes out of the encoders
+  uint64_t heap_bytes;                      // live tracked allocations
+  uint64_t heap_peak_bytes;                 // high water mark of heap_bytes
+  uint64_t allocations;                     // tracked malloc/realloc calls
+} TraceStats;
+
+// arrow c data interface, layout fixed by the arrow spec
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+  const char *format;
+  const char *name;
+  const char *metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema **children;
+  struct ArrowSchema *dictionary;
+  void (*release)(struct ArrowSchema *);
+  void *private_data;
+};
+
+struct ArrowArray
+{
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void **buffers;
+  struct ArrowArray **children;
+  struct ArrowArray *dictionary;
+  void (*release)(struct ArrowArray *);
+  void *private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+// a dataset sorted into grid cells once so it can be drawn over and over
+// (panning, zooming) reading only what's in view
+typedef struct PlotIndex PlotIndex;
+
+// a time series kept in a file with the min/max of every power of two run
+// of samples, so any window of it draws in time with the plot's width
+typedef struct TimePyramid TimePyramid;
+
+// slippy map tiles of an index - level z splits the data range into
+// 2^z x 2^z tiles of TILE_SIZE pixels, x from the left and y from the top
+#define TILE_SIZE 256
+#define TILE_MAX_ZOOM 20
+#define TILE_PYRAMID_MAX_ZOOM 12
+
+typedef enum
+{
+  TILE_PNG,
+  TILE_PALETTE,  // 8 bit palette png, rgb for a tile with over 256 colours
+} TileFormat;
+
+// chroma sampling of jpg output
+typedef enum
+{
+  JPEG_444,  // colour at full resolution
+  JPEG_420,  // colour at half resolution both ways, a lot less to encode
+} JpegSampling;
+
 // user functions
 void xlabel(const char text[]);
 void ylabel(const char text[]);
 void title(const char text[]);
 void grid(int input_density);
 void path(char * new_path);
-void plot(float * xarr, float * yarr, int size_array);
+void time_axis(TimeUnit unit);
+void xscale(AxisScale scale);
+void yscale(AxisScale scale);
+void symlog_threshold(double threshold);
+void sorted_x(bool sorted);
+void xlim(double min, double max);
+void ylim(double min, double max);
+void colour(Colour32 c);
+void alpha(float a);
+void marker(Marker shape, int size);
+void antialias(int factor);
+void plot_free(void);
+void indexed_colour(bool on);
+void jpeg_options(int quality, JpegSampling sampling);
+void jpeg_threads(int threads);
+void trace(bool on);
+void trace_reset(void);
+TraceStats trace_stats(void);
+const char *trace_stage_name(TraceStage stage);
+int trace_dump(const char *path);
+void plot_arrays(PlotArray x, PlotArray y, size_t size_array);
+PlotArray arrow_array(const struct ArrowArray *array,
+                      const struct ArrowSchema *schema);
+void plot_arrow(const struct ArrowArray *x, const struct ArrowSchema *x_schema,
+                const struct ArrowArray *y, const struct ArrowSchema *y_schema);
+PlotIndex *plot_index_build(PlotArray x, PlotArray y, size_t n);
+void plot_index(const PlotIndex *index);
+void plot_index_free(PlotIndex *index);
+void tile_format(TileFormat format, Colour32 background);
+void plot_tile(const PlotIndex *index, int z, int x, int y, const char *path);
+size_t plot_tiles(const PlotIndex *index, int max_zoom, const char *dir,
+                  int threads);
+TimePyramid *pyramid_open(const char *path);
+void pyramid_append(TimePyramid *p, const int64_t *t, const double *v,
+                    size_t n);
+size_t pyramid_length(const TimePyramid *p);
+void pyramid_close(TimePyramid *p);
+void plot_pyramid(const TimePyramid *p, int64_t start, int64_t end);
+void plot_file(PlotFileArray x, PlotFileArray y);
+size_t gorilla_write(const char *path, const int64_t *t, const double *v,
+                     size_t n);
+void plot_gorilla(const char *path);
+void plot_hist(PlotArray values, size_t n, int bins);
+void plot_bars(PlotArray heights, size_t n);
+void subplots(int rows, int cols);
+void subplots_save(void);
+size_t plot_batch(const char *manifest, int threads);
+
+// plot(x array, y array, size) - arrays can be any of the types above and
+// don't need to match each other
+#define plot(xarr, yarr, size_array) \
+  plot_arrays(plot_array(xarr), plot_array(yarr), (size_array))
+
+// build_index(x array, y array, size) - plot_index_build() for plain arrays
+#define build_index(xarr, yarr, size_array) \
+  plot_index_build(plot_array(xarr), plot_array(yarr), (size_array))
+
+// hist(values array, size, bins) - plot_hist() for a plain array, bins 0
+// picks a count from the size
+#define hist(arr, size_array, bins) \
+  plot_hist(plot_array(arr), (size_array), (bins))
 
+// bars(heights array, size) - plot_bars() for a plain array
+#define bars(arr, size_array) plot_bars(plot_array(arr), (size_array))
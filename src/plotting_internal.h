@@ -0,0 +1,480 @@
+#pragma once
+
+#include "plotting.h"
+
+// the stages plot() runs, in order - not part of the user api but exposed so
+// the benchmarks can time them one by one
+
+typedef struct
+{
+  double min_x, max_x, min_y, max_y;
+  bool x_sorted;  // x never decreases and has no NaNs
+} Bounds;
+
+#define PIXEL_NONE INT32_MIN  // marks a point that shouldn't be drawn
+#define PIXEL_LIMIT 1e7       // further off the plot than this is dropped
+
+typedef struct
+{
+  int x0, y0, x1, y1;  // inclusive
+} Rect;
+
+typedef struct SvgWriter SvgWriter;
+
+// the colours of a canvas drawn as a byte per pixel, at most 256 of them.
+// colours are looked up through a small open addressed table
+#define PALETTE_SLOTS 512
+
+typedef struct
+{
+  Colour32 colours[256];
+  int count;
+  bool overflowed;                // a 257th colour came, pixels took over
+  uint32_t keys[PALETTE_SLOTS];   // the colour in each slot
+  uint16_t slots[PALETTE_SLOTS];  // its index + 1, 0 for a free slot
+  Colour32 last;                  // the last colour looked up, and its index
+  int last_index;
+} Palette;
+
+// where a plot's border, ticks and text go, in output pixels from the
+// canvas' top left. the whole image is one frame, subplots() lays smaller
+// ones out over it
+typedef struct
+{
+  int size;         // across and down, frames are square
+  int border;       // from the edge in to the border line
+  int plot_border;  // from the border line in to the axis bounds
+  int label_font, title_font, tick_font;
+} Frame;
+
+// what the stages draw on - the output image, or a scale times larger
+// supersampled one that pack_rgb() averages back down. the points' side of
+// it says where the axis bounds land so a tile can reuse the same stages
+typedef struct
+{
+  Colour32 *pixels;        // NULL until canvas_pixels() when indexed
+  uint16_t *counts;        // hit counts for translucent series, same layout,
+                           // NULL until canvas_counts()
+  int width, height;       // in canvas pixels
+  int stride;              // pixels per row
+  int scale;               // canvas pixels per output pixel along each axis
+  Rect clip;               // canvas pixels the points are drawn inside
+  int origin_x, origin_y;  // canvas position of plot pixel (0, 0), y goes up
+  int plot_px;             // output pixels the axis bounds span
+  int pad;                 // output pixels from the bounds out to the clip
+  SvgWriter *svg;          // if set, everything is drawn into an svg instead
+  uint8_t *indices;        // with a palette, each pixel's index into it
+  Palette *palette;        // if set, drawn as indices and pixels is unused
+  Frame frame;             // the frame's layout, unused by tiles
+} Canvas;
+
+Canvas *plot_canvas(void);
+void canvas_pixels(Canvas *c);
+void canvas_counts(Canvas *c);
+Frame image_frame(void);
+Frame panel_frame(int size);
+void frame_canvas(Canvas *c, Frame f);
+Bounds compute_bounds(PlotArray x, PlotArray y, size_t n);
+Bounds axis_bounds(PlotArray x, PlotArray y, size_t n);
+void draw_background(Canvas *c, Colour32 color);
+void draw_border(Canvas *c, Colour32 colour);
+void draw_grid(Canvas *c, Colour32 colour);
+void add_text(Canvas *c, const char *xlabel, const char *ylabel,
+              const char *title);
+void draw_ticks(Canvas *c, Bounds b, bool x_ticks, Colour32 colour);
+void plot_scatter(Canvas *c, PlotArray x, PlotArray y, size_t n, Bounds b,
+                  Colour32 colour);
+void resolve_scatter(Canvas *c, Colour32 colour);
+uint8_t *pack_rgb(const Canvas *c);
+void pack_rgb_into(const Canvas *c, uint8_t *rgb);
+void save_image_as_png(Canvas *c, const char *path);
+
+// baseline jpeg encoder (jpeg.c), jpeg_options() and jpeg_threads() set
+// what .jpg uses. threads only changes how fast, not the bytes
+extern _Thread_local int jpeg_quality;
+extern _Thread_local JpegSampling jpeg_sampling;
+extern _Thread_local int jpeg_thread_count;
+uint8_t *encode_jpeg(const uint8_t *rgb, int w, int h, int quality,
+                     JpegSampling sampling, int threads, size_t *len);
+
+// cores online (tiles.c)
+int cpu_count(void);
+
+// output formats (formats.c) - write_image() encodes with whichever one the
+// path's extension names and returns its name, NULL if there isn't one or
+// the file couldn't be written
+typedef struct
+{
+  const char *extension;  // with the dot
+  const char *name;
+  uint8_t *(*encode)(const uint8_t *rgb, int w, int h, size_t *len);
+  // straight from palette indices, NULL if the format has no indexed form
+  uint8_t *(*encode_indexed)(const uint8_t *indices, int w, int h,
+                             const Colour32 *palette, int colours,
+                             size_t *len);
+} ImageFormat;
+
+const ImageFormat *image_format(const char *path);
+const char *write_image(const char *path, const uint8_t *rgb);
+const char *write_indexed_image(const char *path, const uint8_t *indices,
+                                const Palette *palette);
+
+// the encoders write_image() uses, for images other than the plot. free the
+// result with trace_free()
+uint8_t *encode_png(const uint8_t *rgb, int w, int h, int *len);
+uint8_t *encode_palette_png(const uint8_t *indices, int w, int h,
+                            const Colour32 *palette, int colours, int *len);
+int write_file(const char *path, const uint8_t *data, size_t len);
+
+// zlib stream of runs only (zlib_rle.c) - quick on images that are mostly
+// flat colour, matches repeat the pixel to the left or the one above
+uint8_t *zlib_rle(const uint8_t *data, size_t len, int period, int row,
+                  size_t *out_len);
+
+// tracing hooks (trace.c) - trace_begin() returns 0 while tracing is off and
+// trace_end() ignores a 0 start, so the pair costs a flag check when unused
+typedef enum
+{
+  COUNT_POINTS_IN,
+  COUNT_POINTS_DRAWN,
+  COUNT_POINTS_CULLED,
+  COUNT_DEFLATE_IN,
+  COUNT_ENCODED,
+  COUNTER_COUNT,
+} TraceCounter;
+
+uint64_t trace_now_ns(void);
+uint64_t trace_begin(void);
+void trace_end(TraceStage stage, uint64_t start);
+void trace_count(TraceCounter counter, uint64_t amount);
+
+// heap allocations that show up in the trace's heap accounting, stb's
+// encoders allocate through these too
+void *trace_malloc(size_t size);
+void *trace_realloc(void *p, size_t size);
+void trace_free(void *p);
+
+// marker stamps (markers.c) - a marker is stored as one or two horizontal
+// spans per row so stamping is a few runs of stores instead of a test per
+// pixel. the radius limit leaves room for the largest marker at 4x
+#define STAMP_MAX_RADIUS (4 * (2 * MARKER_MAX_SIZE + 1) / 2)
+#define STAMP_MAX_SPANS (2 * (2 * STAMP_MAX_RADIUS + 1))
+
+typedef struct
+{
+  int8_t dy, dx0, dx1;  // inclusive offsets from the centre
+} Span;
+
+typedef struct
+{
+  Span spans[STAMP_MAX_SPANS];
+  int count;
+  int radius;  // furthest any span reaches from the centre
+} Stamp;
+
+// where stamps land - image pixels plus the rectangle they're clipped to
+typedef struct
+{
+  Colour32 *pixels;
+  uint16_t *counts;        // if set, stamps count hits here instead
+  uint8_t *indices;        // if set, stamps write index here instead
+  uint8_t index;
+  int stride;              // pixels per image row (counts use it too)
+  Rect clip;               // nothing outside this gets written
+  int origin_x, origin_y;  // image position of plot pixel (0, 0), y goes up
+  unsigned weight;         // hits one stamp adds to counts
+} StampTarget;
+
+void build_stamp(Marker shape, int size, Stamp *stamp);
+size_t stamp_points(const StampTarget *target, const Stamp *stamp,
+                    const int32_t *xval, const int32_t *yval, size_t n,
+                    Colour32 colour);
+bool stamp_column(const StampTarget *target, const Stamp *stamp, int32_t xval,
+                  int32_t y0, int32_t y1, Colour32 colour);
+
+// with x sorted every point in a pixel column arrives in one run, so an
+// opaque point landing on a pixel its column already stamped can be dropped
+// before it's drawn again. the state carries over between chunks
+#define DEDUPE_MAX_ROWS (4 * HEIGHT)
+
+typedef struct
+{
+  int32_t column;  // plot x of the column being filled
+  uint64_t rows[DEDUPE_MAX_ROWS / 64 + 1];  // image rows stamped in it
+  uint16_t marked[DEDUPE_MAX_ROWS];         // set bits, to clear them again
+  int marked_count;
+} ColumnDedupe;
+
+void dedupe_reset(ColumnDedupe *dedupe);
+size_t dedupe_columns(ColumnDedupe *dedupe, const StampTarget *target,
+                      int32_t *xval, int32_t *yval, size_t n,
+                      size_t *duplicates);
+
+// blending translucent series and downsampling (composite.c)
+void resolve_coverage(Colour32 *pixels, uint16_t *counts, int stride,
+                      Rect area, Colour32 colour);
+void resolve_indexed(Canvas *c, Rect area, Colour32 colour);
+void downsample_rgb(const Canvas *c, uint8_t *rgb);
+void downsample_indexed(const Canvas *c, uint8_t *rgb);
+
+// palette canvases (palette.c) - with indexed_colour() on, canvases draw a
+// palette index per pixel and only turn them into colours on output. if
+// a 257th colour turns up the canvas goes over to pixels for good
+extern _Thread_local bool indexed_on;
+void palette_reset(Palette *p);
+int palette_index(Palette *p, Colour32 colour);
+bool canvas_indexed(const Canvas *c);
+int canvas_ink(Canvas *c, Colour32 colour);
+void canvas_expand(Canvas *c);
+void expand_rgb(const Canvas *c, uint8_t *rgb);
+
+// axis scales (transform.c) - in place, values with no place on the axis
+// (non-positive ones on a log axis) become NaN
+void transform_chunk(double *v, size_t n, AxisScale scale, double threshold);
+double axis_value(double v, AxisScale scale, double threshold);
+double axis_inverse(double u, AxisScale scale, double threshold);
+
+// viewport culling (cull.c) - window is in data values, before transforms
+size_t cull_chunk(double *x, double *y, size_t n, Bounds window);
+
+// numeric axis ticks (ticks.c)
+#define MAX_TICKS 32
+#define TICK_LABEL_MAX 24
+
+typedef struct
+{
+  double pos;  // pixels along the axis from the low end
+  char label[TICK_LABEL_MAX];
+} Tick;
+
+int format_decimal(char *out, int64_t mant, int exp10);
+int axis_ticks(double min, double max, AxisScale scale, double threshold,
+               int length, int gap, int char_px, Tick *ticks);
+
+// the pieces of plot_scatter() other drawing paths share (plotting.c)
+void load_chunk(PlotArray arr, size_t start, size_t count, double *out);
+void load_axis_chunk(PlotArray arr, size_t start, size_t count,
+                     AxisScale scale, double *out);
+bool sorted_chunk(const double *x, size_t n, double *last);
+size_t sorted_search(PlotArray x, size_t n, double value, bool after);
+void bounds_chunk(Bounds *b, const double *x, const double *y, size_t n);
+const Stamp *marker_stamp(int scale);
+Bounds cull_window(const Canvas *c, Bounds b);
+void scale_chunk(const double *v, size_t n, double min, double max, int size,
+                 int32_t *out);
+size_t stamp_chunk(Canvas *c, int32_t *xval, int32_t *yval, size_t n,
+                   Colour32 colour, ColumnDedupe *dedupe);
+void pixel_chunk(const Canvas *c, Bounds b, double *x, double *y, size_t n,
+                 int32_t *xval, int32_t *yval);
+size_t scatter_chunk(Canvas *c, Bounds b, double *x, double *y, size_t n,
+                     const Bounds *window, Colour32 colour,
+                     ColumnDedupe *dedupe);
+bool stamp_weighted(Canvas *c, int32_t xval, int32_t yval, unsigned weight,
+                    Colour32 colour);
+void fill_rect(Canvas *c, Rect r, Colour32 colour);
+void draw_bar(Canvas *c, Bounds b, double left, double right, double base,
+              double top, Colour32 colour);
+
+// histogram binning (hist.c) - values in x axis units, over every core
+// unless hist_thread_count says otherwise (0 for one per core)
+extern _Thread_local int hist_thread_count;
+bool hist_range(PlotArray values, size_t n, double *min, double *max);
+size_t hist_count(PlotArray values, size_t n, double min, double max,
+                  int bins, uint64_t *counts);
+int hist_bins(size_t n);
+
+// spatial index (index.c) - points copied out cell by cell over a uniform
+// grid, each cell knowing where its run starts and the tight box around
+// its points, so a render only reads the cells that overlap the view
+struct PlotIndex
+{
+  size_t n;        // finite points kept
+  double *x, *y;   // the points, grouped by cell
+  int grid;        // cells along each side
+  Bounds bounds;   // data range, raw values
+  double cell_w, cell_h;
+  size_t *start;   // grid * grid + 1 offsets, cell i is [start[i], start[i+1])
+  Bounds *boxes;   // per cell, empty cells have min > max
+};
+
+Bounds index_bounds(const PlotIndex *index);
+size_t index_scatter(Canvas *c, const PlotIndex *index, Bounds b,
+                     Colour32 colour);
+
+// x range of a timestamp axis, kept as integers so nanosecond data doesn't
+// get rounded through a float on the way to the screen (plotting.c)
+typedef struct
+{
+  int64_t start, end;  // window in the axis unit
+  int shift;           // offsets are shifted down by this before scaling
+  uint64_t mul;        // pixels per shifted unit in 32.32 fixed point
+  int size;            // pixels across the axis
+} TimeScale;
+
+TimeScale time_scale(int64_t t_min, int64_t t_max, int size);
+void time_scale_chunk(const int64_t *t, const double *y, size_t n,
+                      TimeScale ts, int32_t *out);
+
+// time series pyramid (pyramid.c) - the mapped file's samples plus a
+// min/max per aligned run of 2^k of them for every level k
+typedef struct
+{
+  double min, max;  // min > max when the run has no values
+} MinMax;
+
+struct TimePyramid
+{
+  int fd;
+  void *map;  // the whole file
+  size_t bytes;
+  int64_t *t;          // sample times, never decreasing
+  double *v;           // sample values, NaN for a gap
+  MinMax *level[64];   // level[k][i] covers samples [i << k, (i + 1) << k)
+  int levels;          // highest k there is
+};
+
+size_t pyramid_find(const TimePyramid *p, int64_t t);
+MinMax pyramid_range(const TimePyramid *p, size_t begin, size_t end);
+
+// out of core passes (stream.c) - a column file mapped whole with a few
+// windows of it resident around the cursor
+typedef struct
+{
+  int fd;
+  uint8_t *map;
+  size_t bytes;      // file size
+  size_t offset;     // of element 0
+  size_t n;          // whole elements in the file
+  PlotArray array;   // view over the mapping
+  size_t released;   // everything before this has been dropped
+  size_t prefetched; // read ahead asked for up to here
+} StreamArray;
+
+void stream_map(StreamArray *s, const char *path);
+void stream_open(StreamArray *s, PlotFileArray file);
+void stream_close(StreamArray *s);
+void stream_seek(StreamArray *s, size_t i);
+void stream_advance(StreamArray *s, size_t i);
+Bounds stream_bounds(StreamArray *x, StreamArray *y, size_t n);
+size_t stream_scatter(Canvas *c, StreamArray *x, StreamArray *y, size_t n,
+                      Bounds b, bool cull, Colour32 colour);
+
+// gorilla compressed series (gorilla.c) - the index entry for a block of
+// points, then a decoder working through one block
+typedef struct
+{
+  uint64_t offset, bytes;  // where the block's bits are in the file
+  uint64_t count;          // points in it
+  int64_t t_first, t_last;
+  int64_t t_min, t_max;    // over the points with a finite value
+  double v_min, v_max;     // min > max when there are none
+  uint64_t sorted;         // time never goes backwards inside it
+} GorillaBlock;
+
+typedef struct
+{
+  StreamArray file;
+  const char *path;  // for errors
+  size_t count, blocks;
+  const GorillaBlock *index;  // in the mapping
+} GorillaFile;
+
+typedef struct
+{
+  const uint8_t *at, *end;
+  const char *path;  // the file's, for errors
+  uint64_t bits;  // the next count bits to read, from the top down
+  int count;
+  size_t left;    // points still to come
+  bool started;
+  uint64_t t, delta, v;
+  int lead, trail;  // the current window of changing value bits
+} GorillaDecoder;
+
+void gorilla_open(GorillaFile *g, const char *path);
+void gorilla_close(GorillaFile *g);
+void gorilla_start(GorillaDecoder *d, const GorillaFile *g, size_t block);
+size_t gorilla_decode(GorillaDecoder *d, int64_t *t, double *v, size_t max);
+Bounds gorilla_bounds(GorillaFile *g, TimeScale *ts, int size);
+size_t gorilla_scatter(Canvas *c, GorillaFile *g, Bounds b,
+                       const TimeScale *ts, bool cull, Colour32 colour);
+
+// svg output (svg.c) - a canvas with a writer sends its frame to the file
+// and only marks where marker centres land, svg_close() writes those out
+SvgWriter *svg_open(const char *path, int width, int height);
+void svg_rect(SvgWriter *w, int x0, int y0, int x1, int y1, Colour32 colour);
+void svg_dotted(SvgWriter *w, int x0, int y0, int x1, int y1,
+                Colour32 colour);
+void svg_text(SvgWriter *w, const char *label, int font_size, int ypos,
+              int xpos, char orientation);
+size_t svg_stamp(Canvas *c, const int32_t *xval, const int32_t *yval,
+                 size_t n);
+bool svg_column(Canvas *c, int32_t xval, int32_t y0, int32_t y1);
+size_t svg_close(Canvas *c, Marker shape, Colour32 colour);
+
+// settings other files draw with (plotting.c). they're per thread, so a
+// worker drawing for a plot starts by taking on its caller's with
+// settings_load()
+extern _Thread_local Colour32 series_colour;
+extern _Thread_local Marker point_shape;
+extern _Thread_local int point_size;
+extern _Thread_local int aa_scale;
+extern _Thread_local AxisScale x_scale, y_scale;
+extern _Thread_local double symlog_linear;
+extern _Thread_local TimeUnit x_time;
+extern _Thread_local bool x_declared_sorted;
+extern _Thread_local char file_path[260];
+extern _Thread_local TileFormat tile_kind;  // tiles.c
+extern _Thread_local Colour32 tile_background;
+
+typedef struct
+{
+  int grid_on, g_density;
+  char file_path[260];
+  char title[40], xlabel[40], ylabel[40];
+  TimeUnit x_time;
+  AxisScale x_scale, y_scale;
+  double symlog_linear;
+  bool x_declared_sorted;
+  Bounds axis_limits;
+  Colour32 series_colour;
+  Marker point_shape;
+  int point_size;
+  int aa_scale;
+  bool indexed_on;
+  int jpeg_quality;
+  JpegSampling jpeg_sampling;
+  int jpeg_thread_count;
+  TileFormat tile_kind;
+  Colour32 tile_background;
+} PlotSettings;
+
+void settings_save(PlotSettings *s);
+void settings_load(const PlotSettings *s);
+
+// subplot grids (subplots.c) - while one is open each plot call becomes
+// its next panel, the panels are drawn side by side on every core once the
+// last one is in
+typedef enum
+{
+  PANEL_POINTS,
+  PANEL_HIST,
+  PANEL_BARS,
+} PanelKind;
+
+typedef struct
+{
+  PanelKind kind;
+  PlotArray x, y;  // y only for points
+  size_t n;
+  int bins;        // for a histogram
+  PlotSettings settings;
+} Panel;
+
+bool subplot_add(Panel panel);
+void subplot_check(const char *name);
+
+// a panel on a canvas of its own (plotting.c), for subplots and batches
+bool panel_problem(const Panel *panel, char *message, size_t size);
+void check_panel(const Panel *panel);
+void draw_panel(Canvas *c, const Panel *panel);
@@ -0,0 +1,284 @@
+#define _POSIX_C_SOURCE 200809L  // mmap, ftruncate
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// time series pyramid - a file holding the samples themselves plus, for
+// every power of two k, the min and max of each run of 2^k samples. any
+// range of samples splits into O(log n) whole aligned runs, so a column of
+// the plot costs a binary search and a handful of reads however many
+// samples fall in it. the file is mapped, not read, so opening one is free
+//
+// layout: header, then t[capacity] and v[capacity], then level 1's
+// capacity / 2 min/max pairs, level 2's capacity / 4 and so on. capacity
+// doubles when an append runs out, moving the levels up the file
+
+#define PYRAMID_MAGIC "PLOTPYR1"
+#define PYRAMID_MIN_CAPACITY 1024
+
+typedef struct
+{
+  char magic[8];
+  uint64_t count;     // samples appended
+  uint64_t capacity;  // samples there's room for, a power of two
+  uint64_t reserved[5];
+} PyramidHeader;
+
+static size_t pyramid_bytes(uint64_t capacity)
+{
+  // header, samples, then capacity - 1 pairs over all the levels
+  return sizeof(PyramidHeader) +
+         capacity * (sizeof(int64_t) + sizeof(double)) +
+         (capacity - 1) * sizeof(MinMax);
+}
+
+static void pyramid_point(TimePyramid *p)
+{
+  // sets the level pointers for the current mapping
+  PyramidHeader *h = p->map;
+  uint64_t capacity = h->capacity;
+  p->t = (int64_t *)(h + 1);
+  p->v = (double *)(p->t + capacity);
+  MinMax *at = (MinMax *)(p->v + capacity);
+  p->levels = 0;
+  for (uint64_t size = capacity / 2; size >= 1; size /= 2)
+  {
+    p->level[++p->levels] = at;
+    at += size;
+  }
+}
+
+#ifdef _WIN32
+TimePyramid *pyramid_open(const char *path)
+{
+  (void)path;
+  printf("ERROR: pyramids need mmap, which isn't set up on windows yet\n");
+  exit(1);
+}
+
+static void pyramid_grow(TimePyramid *p, uint64_t capacity)
+{
+  (void)p;
+  (void)capacity;
+}
+
+void pyramid_close(TimePyramid *p) { (void)p; }
+#else
+static void *pyramid_map(TimePyramid *p, size_t bytes)
+{
+  void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, p->fd, 0);
+  if (map == MAP_FAILED)
+  {
+    printf("ERROR: couldn't map the pyramid file\n");
+    exit(1);
+  }
+  return map;
+}
+
+TimePyramid *pyramid_open(const char *path)
+{
+  // opens a pyramid file, making an empty one if it isn't there
+  TimePyramid *p = trace_malloc(sizeof *p);
+  if (p == NULL)
+  {
+    printf("ERROR: not enough memory for the pyramid\n");
+    exit(1);
+  }
+  p->fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (p->fd < 0 || fstat(p->fd, &st) != 0)
+  {
+    printf("ERROR: couldn't open %s\n", path);
+    exit(1);
+  }
+  if (st.st_size == 0)
+  {  // brand new
+    p->bytes = pyramid_bytes(PYRAMID_MIN_CAPACITY);
+    if (ftruncate(p->fd, (off_t)p->bytes) != 0)
+    {
+      printf("ERROR: couldn't size %s\n", path);
+      exit(1);
+    }
+    p->map = pyramid_map(p, p->bytes);
+    PyramidHeader *h = p->map;
+    memcpy(h->magic, PYRAMID_MAGIC, sizeof h->magic);
+    h->count = 0;
+    h->capacity = PYRAMID_MIN_CAPACITY;
+  }
+  else
+  {
+    PyramidHeader h;
+    if ((size_t)st.st_size < sizeof h ||
+        pread(p->fd, &h, sizeof h, 0) != (ssize_t)sizeof h ||
+        memcmp(h.magic, PYRAMID_MAGIC, sizeof h.magic) != 0 ||
+        h.capacity < PYRAMID_MIN_CAPACITY ||
+        (h.capacity & (h.capacity - 1)) != 0 || h.count > h.capacity ||
+        (size_t)st.st_size != pyramid_bytes(h.capacity))
+    {
+      printf("ERROR: %s isn't a pyramid file\n", path);
+      exit(1);
+    }
+    p->bytes = (size_t)st.st_size;
+    p->map = pyramid_map(p, p->bytes);
+  }
+  pyramid_point(p);
+  return p;
+}
+
+static void pyramid_grow(TimePyramid *p, uint64_t capacity)
+{
+  // remaps at the bigger size and moves everything to where it now goes.
+  // a level's new spot starts past the end of every level below it, so
+  // going from the top level down never writes over one not yet moved
+  uint64_t old = ((PyramidHeader *)p->map)->capacity;
+  size_t bytes = pyramid_bytes(capacity);
+  munmap(p->map, p->bytes);
+  if (ftruncate(p->fd, (off_t)bytes) != 0)
+  {
+    printf("ERROR: couldn't grow the pyramid file\n");
+    exit(1);
+  }
+  p->map = pyramid_map(p, bytes);
+  p->bytes = bytes;
+  PyramidHeader *h = p->map;
+  uint8_t *base = p->map;
+  size_t old_v = sizeof *h + old * sizeof(int64_t);
+  size_t old_levels = old_v + old * sizeof(double);
+  size_t new_levels =
+      sizeof *h + capacity * (sizeof(int64_t) + sizeof(double));
+
+  size_t old_at = old_levels, new_at = new_levels;
+  size_t old_off[64], new_off[64];
+  int levels = 0;
+  for (uint64_t size = old / 2; size >= 1; size /= 2, ++levels)
+  {  // capacity can be any power of two bigger, not just double
+    old_off[levels] = old_at;
+    new_off[levels] = new_at;
+    old_at += size * sizeof(MinMax);
+    new_at += (capacity >> (levels + 1)) * sizeof(MinMax);
+  }
+  for (int k = levels - 1; k >= 0; --k)
+  {
+    memmove(base + new_off[k], base + old_off[k],
+            (old >> (k + 1)) * sizeof(MinMax));
+  }
+  memmove(base + sizeof *h + capacity * sizeof(int64_t), base + old_v,
+          old * sizeof(double));
+  h->capacity = capacity;
+  pyramid_point(p);
+}
+
+void pyramid_close(TimePyramid *p)
+{
+  if (p == NULL) { return; }
+  munmap(p->map, p->bytes);
+  close(p->fd);
+  trace_free(p);
+}
+#endif
+
+size_t pyramid_length(const TimePyramid *p)
+{
+  return (size_t)((const PyramidHeader *)p->map)->count;
+}
+
+static MinMax child_pair(const TimePyramid *p, int k, uint64_t i,
+                         uint64_t count)
+{
+  // entry i of level k (0 being the samples), empty past the data
+  MinMax m = {INFINITY, -INFINITY};
+  if (i << k >= count) { return m; }
+  if (k > 0) { return p->level[k][i]; }
+  if (!isnan(p->v[i])) { m.min = m.max = p->v[i]; }
+  return m;
+}
+
+void pyramid_append(TimePyramid *p, const int64_t *t, const double *v,
+                    size_t n)
+{
+  // adds samples to the end, t can't go back past the last one. only the
+  // runs the new samples fall in get their min/max redone
+  PyramidHeader *h = p->map;
+  if (n == 0) { return; }
+  int64_t last = h->count > 0 ? p->t[h->count - 1] : INT64_MIN;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (t[i] < last)
+    {
+      printf("ERROR: pyramid samples have to be appended in time order\n");
+      exit(1);
+    }
+    last = t[i];
+  }
+  uint64_t first = h->count, count = h->count + n;
+  if (count > h->capacity)
+  {
+    uint64_t capacity = h->capacity;
+    while (capacity < count) { capacity *= 2; }
+    pyramid_grow(p, capacity);
+    h = p->map;
+  }
+  memcpy(p->t + first, t, n * sizeof *t);
+  memcpy(p->v + first, v, n * sizeof *v);
+  h->count = count;
+
+  for (int k = 1; k <= p->levels; ++k)
+  {
+    for (uint64_t i = first >> k; i <= (count - 1) >> k; ++i)
+    {
+      MinMax a = child_pair(p, k - 1, 2 * i, count);
+      MinMax b = child_pair(p, k - 1, 2 * i + 1, count);
+      p->level[k][i] = (MinMax){a.min < b.min ? a.min : b.min,
+                                a.max > b.max ? a.max : b.max};
+    }
+  }
+}
+
+size_t pyramid_find(const TimePyramid *p, int64_t t)
+{
+  // first sample at or after t
+  size_t lo = 0, hi = pyramid_length(p);
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (p->t[mid] < t) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+  return lo;
+}
+
+MinMax pyramid_range(const TimePyramid *p, size_t begin, size_t end)
+{
+  // min/max of samples [begin, end) from the biggest aligned runs that fit
+  uint64_t count = pyramid_length(p);
+  MinMax m = {INFINITY, -INFINITY};
+  while (begin < end)
+  {
+    int k = 0;
+    while (k < p->levels && (begin & ((2ull << k) - 1)) == 0 &&
+           begin + (2ull << k) <= end)
+    {
+      ++k;
+    }
+    MinMax run = child_pair(p, k, begin >> k, count);
+    if (run.min < m.min) { m.min = run.min; }
+    if (run.max > m.max) { m.max = run.max; }
+    begin += 1ull << k;
+  }
+  return m;
+}
@@ -0,0 +1,219 @@
+#define _DEFAULT_SOURCE  // madvise, posix_madvise can't drop pages on linux
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// out of core plotting - each column file is mapped whole but only a few
+// windows of it are ever resident. the kernel is asked to read the window
+// past the cursor before it gets there and to drop the ones behind it, so
+// a pass over a file of any size holds about three windows per column and
+// runs at whatever the disk gives
+
+#define STREAM_WINDOW ((size_t)32 << 20)  // bytes, a multiple of any page
+
+static const size_t type_size[] = {
+    [PLOT_F32] = 4, [PLOT_F64] = 8, [PLOT_I32] = 4, [PLOT_I64] = 8,
+    [PLOT_U16] = 2,
+};
+
+#ifdef _WIN32
+void stream_map(StreamArray *s, const char *path)
+{
+  (void)s;
+  (void)path;
+  printf("ERROR: reading files in place needs mmap, which isn't set up on "
+         "windows yet\n");
+  exit(1);
+}
+
+void stream_close(StreamArray *s) { (void)s; }
+
+static void stream_advise(StreamArray *s, size_t from, size_t to, int advice)
+{
+  (void)s;
+  (void)from;
+  (void)to;
+  (void)advice;
+}
+
+#define MADV_WILLNEED 0
+#define MADV_DONTNEED 0
+#else
+void stream_map(StreamArray *s, const char *path)
+{
+  // maps the whole file as bytes - element i is byte i until stream_open()
+  // lays a typed view over it
+  struct stat st;
+  s->fd = open(path, O_RDONLY);
+  if (s->fd < 0 || fstat(s->fd, &st) != 0)
+  {
+    printf("ERROR: couldn't open %s\n", path);
+    exit(1);
+  }
+  s->bytes = (size_t)st.st_size;
+  s->map = NULL;
+  if (s->bytes > 0)
+  {
+    s->map = mmap(NULL, s->bytes, PROT_READ, MAP_SHARED, s->fd, 0);
+    if ((void *)s->map == MAP_FAILED)
+    {
+      printf("ERROR: couldn't map %s\n", path);
+      exit(1);
+    }
+    madvise(s->map, s->bytes, MADV_SEQUENTIAL);
+  }
+  s->n = s->bytes;
+  s->offset = 0;
+  s->array = (PlotArray){.data = s->map, .stride = 1};
+  s->released = s->prefetched = 0;
+}
+
+void stream_close(StreamArray *s)
+{
+  if (s->map != NULL) { munmap(s->map, s->bytes); }
+  close(s->fd);
+}
+
+static void stream_advise(StreamArray *s, size_t from, size_t to, int advice)
+{
+  if (to > s->bytes) { to = s->bytes; }
+  if (from < to) { madvise(s->map + from, to - from, advice); }
+}
+#endif
+
+void stream_open(StreamArray *s, PlotFileArray file)
+{
+  // maps a column file, n is how many whole elements fit past the offset
+  size_t size = type_size[file.type];
+  size_t stride = file.stride ? file.stride : size;
+  stream_map(s, file.path);
+  s->n = 0;
+  if (s->bytes >= file.offset + size)
+  {
+    s->n = (s->bytes - file.offset - size) / stride + 1;
+  }
+  s->array = (PlotArray){.data = s->map ? s->map + file.offset : NULL,
+                         .stride = stride, .type = file.type};
+  s->offset = file.offset;
+}
+
+void stream_seek(StreamArray *s, size_t i)
+{
+  // drops everything resident and puts the window at element i, for the
+  // start of a pass (and with i = n, the end of one)
+  stream_advise(s, 0, s->bytes, MADV_DONTNEED);
+  size_t at = s->offset + i * s->array.stride;
+  s->released = s->prefetched = at / STREAM_WINDOW * STREAM_WINDOW;
+}
+
+void stream_advance(StreamArray *s, size_t i)
+{
+  // the cursor has reached element i - the next window gets read ahead once
+  // the cursor is into the last one asked for, and everything more than a
+  // window behind goes
+  size_t at = s->offset + i * s->array.stride;
+  if (s->prefetched < at)
+  {  // records further apart than a window
+    s->prefetched = at / STREAM_WINDOW * STREAM_WINDOW;
+  }
+  if (at + STREAM_WINDOW > s->prefetched && s->prefetched < s->bytes)
+  {
+    stream_advise(s, s->prefetched, s->prefetched + STREAM_WINDOW,
+                  MADV_WILLNEED);
+    s->prefetched += STREAM_WINDOW;
+  }
+  if (at >= s->released + 2 * STREAM_WINDOW)
+  {
+    size_t release = (at - STREAM_WINDOW) / STREAM_WINDOW * STREAM_WINDOW;
+    stream_advise(s, s->released, release, MADV_DONTNEED);
+    s->released = release;
+  }
+}
+
+static size_t stream_chunk(const StreamArray *x, const StreamArray *y)
+{
+  // elements per pass of the kernels, fewer than PLOT_CHUNK when the
+  // records are far enough apart that a chunk would run past a window -
+  // the cursor only moves between chunks, so one has to fit in a window
+  // for the windows behind it to get dropped in time
+  size_t stride = x->array.stride > y->array.stride ? x->array.stride
+                                                    : y->array.stride;
+  size_t fit = STREAM_WINDOW / stride;
+  return fit < 1 ? 1 : fit < PLOT_CHUNK ? fit : PLOT_CHUNK;
+}
+
+Bounds stream_bounds(StreamArray *x, StreamArray *y, size_t n)
+{
+  // compute_bounds() as the first pass over the files
+  Bounds b = {INFINITY, -INFINITY, INFINITY, -INFINITY, true};
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  double last_x = -INFINITY;
+  const size_t chunk = stream_chunk(x, y);
+  stream_seek(x, 0);
+  stream_seek(y, 0);
+  for (size_t start = 0; start < n; start += chunk)
+  {
+    size_t count = n - start < chunk ? n - start : chunk;
+    stream_advance(x, start);
+    stream_advance(y, start);
+    load_axis_chunk(x->array, start, count, x_scale, xs);
+    load_axis_chunk(y->array, start, count, y_scale, ys);
+    bounds_chunk(&b, xs, ys, count);
+    if (b.x_sorted) { b.x_sorted = sorted_chunk(xs, count, &last_x); }
+  }
+  b.x_sorted = b.x_sorted || x_declared_sorted;
+  if (b.min_x > b.max_x)
+  {  // nothing finite to plot
+    b.min_x = b.max_x = b.min_y = b.max_y = 0;
+  }
+  return b;
+}
+
+size_t stream_scatter(Canvas *c, StreamArray *x, StreamArray *y, size_t n,
+                      Bounds b, bool cull, Colour32 colour)
+{
+  // plot_scatter() as the second pass, returns the points drawn. sorted x
+  // binary searches the mapping for the slice in view and streams just that
+  double xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+  size_t drawn = 0;
+  size_t begin = 0, end = n;
+  Bounds window = cull_window(c, b);
+  ColumnDedupe dedupe;
+  if (b.x_sorted)
+  {
+    begin = sorted_search(x->array, n, window.min_x, false);
+    end = sorted_search(x->array, n, window.max_x, true);
+    dedupe_reset(&dedupe);
+  }
+  const size_t chunk = stream_chunk(x, y);
+  stream_seek(x, begin);
+  stream_seek(y, begin);
+  for (size_t start = begin; start < end; start += chunk)
+  {
+    size_t count = end - start < chunk ? end - start : chunk;
+    stream_advance(x, start);
+    stream_advance(y, start);
+    load_chunk(x->array, start, count, xs);
+    load_chunk(y->array, start, count, ys);
+    drawn += scatter_chunk(c, b, xs, ys, count, cull ? &window : NULL, colour,
+                           b.x_sorted ? &dedupe : NULL);
+  }
+  stream_seek(x, n);  // nothing left resident
+  stream_seek(y, n);
+  return drawn;
+}
@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// subplot grids - while a grid is open plot calls only note down their
+// data and the settings they were made with. once the last panel is in,
+// every panel gets a square of the one image and they're drawn on as many
+// threads as there are cores, each thread taking on a panel's settings
+// and drawing it through a canvas that's a window onto its square. the
+// squares don't overlap, so nothing needs locking, and the image is
+// encoded once at the end
+
+#define SUBPLOTS_MAX 10  // panels along a side, any more and they're tiny
+
+typedef struct
+{
+  int rows, cols;
+  Panel *panels;  // rows * cols, filled left to right then down
+  int count;
+} Figure;
+
+typedef struct
+{
+  const Figure *figure;
+  const Canvas *image;
+  atomic_int next_panel;
+} FigureJob;
+
+static _Thread_local Figure figure;
+
+static void render_figure(void);
+
+// USER FUNCTIONS
+void subplots(int rows, int cols)
+{
+  if (figure.panels != NULL)
+  {
+    printf("ERROR: subplots() grid still has %d of %d panels to go - "
+           "subplots_save() it first\n",
+           figure.rows * figure.cols - figure.count, figure.rows * figure.cols);
+    exit(1);
+  }
+  if (rows < 1 || cols < 1 || rows > SUBPLOTS_MAX || cols > SUBPLOTS_MAX)
+  {
+    printf("ERROR: subplots() takes 1 to %d rows and columns\n",
+           SUBPLOTS_MAX);
+    exit(1);
+  }
+  figure.panels = trace_malloc((size_t)rows * cols * sizeof *figure.panels);
+  if (figure.panels == NULL)
+  {
+    printf("ERROR: not enough memory for the subplots\n");
+    exit(1);
+  }
+  figure.rows = rows;
+  figure.cols = cols;
+  figure.count = 0;
+}
+
+void subplots_save(void)
+{
+  if (figure.panels == NULL)
+  {
+    printf("ERROR: subplots_save() needs a subplots() grid\n");
+    exit(1);
+  }
+  render_figure();
+}
+
+// NON-USER FUNCTIONS
+bool subplot_add(Panel panel)
+{
+  // takes a plot call as the grid's next panel, false if there's no grid
+  if (figure.panels == NULL) { return false; }
+  settings_save(&panel.settings);
+  figure.panels[figure.count++] = panel;
+  if (figure.count == figure.rows * figure.cols) { render_figure(); }
+  return true;
+}
+
+void subplot_check(const char *name)
+{
+  // for the plot calls that can't be a panel
+  if (figure.panels != NULL)
+  {
+    printf("ERROR: %s can't go in a subplots() grid yet\n", name);
+    exit(1);
+  }
+}
+
+static Canvas panel_canvas(const Figure *f, const Canvas *image, int i)
+{
+  // the square panel i is drawn in, centred in its cell of the grid
+  const int cell_w = WIDTH / f->cols, cell_h = HEIGHT / f->rows;
+  const int side = cell_w < cell_h ? cell_w : cell_h;
+  const int x = (i % f->cols) * cell_w + (cell_w - side) / 2;
+  const int y = (i / f->cols) * cell_h + (cell_h - side) / 2;
+  const int s = image->scale;
+  const ptrdiff_t offset = (ptrdiff_t)y * s * image->stride + x * s;
+  Canvas c = *image;
+  c.pixels += offset;
+  if (c.counts != NULL) { c.counts += offset; }
+  c.width = c.height = side * s;
+  frame_canvas(&c, panel_frame(side));
+  return c;
+}
+
+static void *figure_worker(void *arg)
+{
+  // takes a panel at a time until they run out
+  FigureJob *job = arg;
+  const Figure *f = job->figure;
+  const int hist_threads = hist_thread_count;
+  hist_thread_count = 1;  // the other panels have the other cores
+  for (;;)
+  {
+    int i = atomic_fetch_add(&job->next_panel, 1);
+    if (i >= f->count) { break; }
+    const Panel *panel = &f->panels[i];
+    settings_load(&panel->settings);
+    aa_scale = job->image->scale;  // the image's, whatever the panel's was
+    indexed_on = false;
+    Canvas c = panel_canvas(f, job->image, i);
+    draw_panel(&c, panel);
+  }
+  hist_thread_count = hist_threads;
+  return NULL;
+}
+
+static void render_figure(void)
+{
+  // draws the panels that are in over every core and writes the image to
+  // path(), panels never filled are left as background
+  uint64_t plot_start = trace_begin();
+  size_t len = strlen(file_path);
+  if (len >= 4 && strcmp(file_path + len - 4, ".svg") == 0)
+  {
+    printf("ERROR: subplots() can't be saved as an svg yet\n");
+    exit(1);
+  }
+  // panels drawing on different threads can't share one palette
+  PlotSettings own;
+  settings_save(&own);
+  indexed_on = false;
+  Canvas *image = plot_canvas();
+  draw_background(image, COLOR_GREY);
+  for (int i = 0; i < figure.count; ++i)
+  {  // the panels are windows onto the image's counts, so they're made here
+    if (figure.panels[i].settings.series_colour >> 24 != 0xFF)
+    {
+      canvas_counts(image);
+    }
+  }
+
+  FigureJob job = {.figure = &figure, .image = image};
+  atomic_init(&job.next_panel, 0);
+  int threads = cpu_count();
+  if (threads > figure.count) { threads = figure.count > 0 ? figure.count : 1; }
+  pthread_t *workers = trace_malloc(threads * sizeof *workers);
+  if (workers == NULL)
+  {
+    printf("ERROR: not enough memory for the subplots\n");
+    exit(1);
+  }
+  int started = 0;
+  for (; started < threads - 1; ++started)
+  {
+    if (pthread_create(&workers[started], NULL, figure_worker, &job) != 0)
+    {  // fewer threads is fine, the rest of the panels still get drawn
+      break;
+    }
+  }
+  figure_worker(&job);
+  for (int i = 0; i < started; ++i) { pthread_join(workers[i], NULL); }
+  trace_free(workers);
+
+  settings_load(&own);  // this thread drew panels with theirs
+  trace_free(figure.panels);
+  figure.panels = NULL;
+  save_image_as_png(image, file_path);
+  trace_end(TRACE_PLOT, plot_start);
+}
@@ -0,0 +1,292 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// svg output - a canvas with a writer attached draws its frame as rects and
+// text straight into the file, and its points only mark which pixel each
+// marker centre lands on. at the end every row's runs of marked pixels go
+// out as one stroke each, so however many points there were the file holds
+// at most a path segment per pixel row run of the plot, never one per point
+
+#define SVG_BUFFER (64 * 1024)
+
+struct SvgWriter
+{
+  FILE *f;
+  bool failed;
+  size_t len, written;
+  int width, height;
+  uint8_t *centres;  // width * height, 1 where a marker centre landed
+  char buf[SVG_BUFFER];
+};
+
+static void svg_flush(SvgWriter *w)
+{
+  if (w->len > 0 && fwrite(w->buf, 1, w->len, w->f) != w->len)
+  {
+    w->failed = true;
+  }
+  w->written += w->len;
+  w->len = 0;
+}
+
+static void svg_printf(SvgWriter *w, const char *format, ...)
+{
+  // formats into the buffer, flushing first when it won't fit
+  for (int attempt = 0; attempt < 2; ++attempt)
+  {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(w->buf + w->len, SVG_BUFFER - w->len, format, args);
+    va_end(args);
+    if (n >= 0 && (size_t)n < SVG_BUFFER - w->len)
+    {
+      w->len += (size_t)n;
+      return;
+    }
+    svg_flush(w);
+  }
+  w->failed = true;  // longer than the whole buffer
+}
+
+static void svg_colour(char *out, Colour32 colour)
+{
+  // 0xAABBGGRR to #rrggbb
+  snprintf(out, 8, "#%02x%02x%02x", (unsigned)(colour & 0xFF),
+           (unsigned)(colour >> 8 & 0xFF), (unsigned)(colour >> 16 & 0xFF));
+}
+
+SvgWriter *svg_open(const char *path, int width, int height)
+{
+  // NULL if the file can't be made
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) { return NULL; }
+  SvgWriter *w = trace_malloc(sizeof *w);
+  uint8_t *centres = trace_malloc((size_t)width * height);
+  if (w == NULL || centres == NULL)
+  {
+    printf("ERROR: not enough memory for the svg writer\n");
+    exit(1);
+  }
+  memset(centres, 0, (size_t)width * height);
+  w->f = f;
+  w->failed = false;
+  w->len = w->written = 0;
+  w->width = width;
+  w->height = height;
+  w->centres = centres;
+  svg_printf(w,
+             "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+             "xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"%d\" "
+             "height=\"%d\" viewBox=\"0 0 %d %d\" "
+             "shape-rendering=\"crispEdges\">\n",
+             width, height, width, height);
+  return w;
+}
+
+void svg_rect(SvgWriter *w, int x0, int y0, int x1, int y1, Colour32 colour)
+{
+  // an inclusive rectangle of pixels, like fill_cells()
+  char hex[8];
+  svg_colour(hex, colour);
+  svg_printf(w,
+             "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" "
+             "fill=\"%s\"/>\n",
+             x0, y0, x1 - x0 + 1, y1 - y0 + 1, hex);
+}
+
+void svg_dotted(SvgWriter *w, int x0, int y0, int x1, int y1,
+                Colour32 colour)
+{
+  // every other pixel from (x0, y0) to (x1, y1) along a row or column,
+  // starting with the first - the grid's dotted lines
+  char hex[8];
+  svg_colour(hex, colour);
+  bool across = y0 == y1;
+  svg_printf(w,
+             "<path d=\"M%d %d%c%d\" stroke=\"%s\" stroke-width=\"1\" "
+             "stroke-dasharray=\"1 1\" transform=\"translate(%s)\"/>\n",
+             x0, y0, across ? 'H' : 'V', (across ? x1 : y1) + 1, hex,
+             across ? "0 0.5" : "0.5 0");
+}
+
+void svg_text(SvgWriter *w, const char *label, int font_size, int ypos,
+              int xpos, char orientation)
+{
+  // draw_text() as text - same anchors, and stretched to the width the
+  // pixel font would take so the layout matches the raster
+  int len = (int)strlen(label);
+  if (len == 0) { return; }
+  int size = font_size;
+  int span = len * 6 * size - size;
+  char transform[64];
+  if (orientation == 'v')
+  {  // reads upwards, the baseline is the pixel font's right edge
+    ypos += (6 * len * size - 11 * size) / 2;
+    snprintf(transform, sizeof transform, "translate(%d %d) rotate(-90)",
+             xpos + 7 * size, ypos + 5 * size);
+  }
+  else
+  {
+    if (orientation == 'h') { xpos -= (len * size * 6) / 2; }
+    else if (orientation == 'r') { xpos -= len * size * 6 - size; }
+    snprintf(transform, sizeof transform, "translate(%d %d)", xpos,
+             ypos + 7 * size);
+  }
+  svg_printf(w,
+             "<text transform=\"%s\" font-family=\"monospace\" "
+             "font-size=\"%d\" textLength=\"%d\" "
+             "lengthAdjust=\"spacingAndGlyphs\">",
+             transform, 10 * size, span);
+  for (const char *p = label; *p; ++p)
+  {
+    switch (*p)
+    {
+    case '&': svg_printf(w, "&amp;"); break;
+    case '<': svg_printf(w, "&lt;"); break;
+    case '>': svg_printf(w, "&gt;"); break;
+    default: svg_printf(w, "%c", *p); break;
+    }
+  }
+  svg_printf(w, "</text>\n");
+}
+
+static bool centre_visible(const Canvas *c, int cx, int cy, int r)
+{
+  // the same test stamp_points() uses to count a point as drawn
+  const Rect clip = c->clip;
+  return cx + r >= clip.x0 && cx - r <= clip.x1 && cy + r >= clip.y0 &&
+         cy - r <= clip.y1 && cx >= 0 && cx < c->svg->width && cy >= 0 &&
+         cy < c->svg->height;
+}
+
+size_t svg_stamp(Canvas *c, const int32_t *xval, const int32_t *yval,
+                 size_t n)
+{
+  // stamp_chunk() for an svg canvas, returns how many points show
+  const int r = marker_stamp(c->scale)->radius;
+  uint8_t *centres = c->svg->centres;
+  size_t drawn = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (xval[i] == PIXEL_NONE || yval[i] == PIXEL_NONE) { continue; }
+    int cx = c->origin_x + xval[i], cy = c->origin_y - yval[i];
+    if (!centre_visible(c, cx, cy, r)) { continue; }
+    centres[(size_t)cy * c->svg->width + cx] = 1;
+    ++drawn;
+  }
+  return drawn;
+}
+
+bool svg_column(Canvas *c, int32_t xval, int32_t y0, int32_t y1)
+{
+  // stamp_column() for an svg canvas - every centre from y0 up to y1
+  const int r = marker_stamp(c->scale)->radius;
+  bool drawn = false;
+  int cx = c->origin_x + xval;
+  for (int cy = c->origin_y - y1; cy <= c->origin_y - y0; ++cy)
+  {
+    if (!centre_visible(c, cx, cy, r)) { continue; }
+    c->svg->centres[(size_t)cy * c->svg->width + cx] = 1;
+    drawn = true;
+  }
+  return drawn;
+}
+
+static void svg_points(SvgWriter *w, Rect clip, Marker shape,
+                       const Stamp *stamp, Colour32 colour)
+{
+  // the marked centres, clipped to the plot like the raster's stamps. a
+  // square or circle run along a row is exactly a stroke with square or
+  // round caps, a diamond run is a hexagon, and the plus and cross get a
+  // copy of the marker per centre
+  char hex[8];
+  svg_colour(hex, colour);
+  const int r = stamp->radius;
+  svg_printf(w,
+             "<clipPath id=\"plot\"><rect x=\"%d\" y=\"%d\" width=\"%d\" "
+             "height=\"%d\"/></clipPath>\n",
+             clip.x0, clip.y0, clip.x1 - clip.x0 + 1, clip.y1 - clip.y0 + 1);
+  bool stroked = shape == MARKER_SQUARE || shape == MARKER_CIRCLE ||
+                 shape == MARKER_PIXEL;
+  if (shape == MARKER_CROSS || shape == MARKER_PLUS)
+  {
+    svg_printf(w, "<defs><path id=\"m\" d=\"");
+    for (int s = 0; s < stamp->count; ++s)
+    {
+      const Span span = stamp->spans[s];
+      svg_printf(w, "M%d %gh%d", span.dx0, span.dy + 0.5,
+                 span.dx1 - span.dx0 + 1);
+    }
+    svg_printf(w, "\" stroke=\"%s\" stroke-width=\"1\"/></defs>\n", hex);
+  }
+  svg_printf(w, "<g clip-path=\"url(#plot)\"");
+  if ((colour >> 24) != 0xFF)
+  {
+    svg_printf(w, " opacity=\"%.3f\"", (colour >> 24) / 255.0);
+  }
+  svg_printf(w, ">\n");
+  if (stroked)
+  {
+    svg_printf(w,
+               "<path fill=\"none\" stroke=\"%s\" stroke-width=\"%d\" "
+               "stroke-linecap=\"%s\" d=\"",
+               hex, 2 * r + 1, shape == MARKER_CIRCLE ? "round" : "square");
+  }
+  else if (shape == MARKER_DIAMOND)
+  {
+    svg_printf(w, "<path fill=\"%s\" d=\"", hex);
+  }
+
+  for (int y = 0; y < w->height; ++y)
+  {
+    const uint8_t *row = w->centres + (size_t)y * w->width;
+    for (int x = 0; x < w->width; ++x)
+    {
+      if (!row[x]) { continue; }
+      int x0 = x;
+      if (stroked || shape == MARKER_DIAMOND)
+      {  // the whole run at once
+        while (x + 1 < w->width && row[x + 1]) { ++x; }
+      }
+      if (stroked) { svg_printf(w, "M%d.5 %d.5h%d", x0, y, x - x0); }
+      else if (shape == MARKER_DIAMOND)
+      {  // pixel edges, the tips reach r + 0.5 out from the centres
+        svg_printf(w, "M%d %d.5l%d.5 -%d.5h%dl%d.5 %d.5l-%d.5 %d.5h-%dz",
+                   x0 - r, y, r, r, x - x0, r, r, r, r, x - x0);
+      }
+      else
+      {
+        svg_printf(w, "<use xlink:href=\"#m\" x=\"%d\" y=\"%d\"/>\n", x, y);
+      }
+    }
+  }
+  if (stroked || shape == MARKER_DIAMOND) { svg_printf(w, "\"/>\n"); }
+  svg_printf(w, "</g>\n");
+}
+
+size_t svg_close(Canvas *c, Marker shape, Colour32 colour)
+{
+  // writes out the points and the end of the file, returns its size or 0
+  // if it couldn't be written
+  SvgWriter *w = c->svg;
+  if (colour >> 24 != 0)
+  {
+    svg_points(w, c->clip, shape, marker_stamp(c->scale), colour);
+  }
+  svg_printf(w, "</svg>\n");
+  svg_flush(w);
+  bool ok = fclose(w->f) == 0 && !w->failed;
+  size_t written = w->written;
+  trace_free(w->centres);
+  trace_free(w);
+  c->svg = NULL;
+  return ok ? written : 0;
+}
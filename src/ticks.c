@@ -0,0 +1,224 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// numeric axis ticks - every tick value is built as an integer mantissa
+// times a power of ten, so its label is exact and already the shortest
+// decimal for that value. nothing goes through a binary double on the way
+// to text, and there's no snprintf.
+
+#define TICK_INDEX_LIMIT 1e12  // past this the mantissa gets too long to show
+
+int format_decimal(char *out, int64_t mant, int exp10)
+{
+  // writes mant * 10^exp10 plainly, or as 1.5e-7 style when it's far from 1
+  // and that's shorter, returns the length
+  int len = 0;
+  if (mant == 0)
+  {
+    out[0] = '0';
+    out[1] = '\0';
+    return 1;
+  }
+  if (mant < 0) { out[len++] = '-'; }
+  uint64_t m = mant < 0 ? -(uint64_t)mant : (uint64_t)mant;
+  while (m % 10 == 0)
+  {
+    m /= 10;
+    ++exp10;
+  }
+  char digits[20];
+  int n = 0;
+  for (uint64_t rest = m; rest != 0; rest /= 10)
+  {
+    digits[n++] = (char)('0' + rest % 10);  // backwards
+  }
+  int lead = exp10 + n - 1;  // power of ten of the first digit
+  int abs_lead = lead < 0 ? -lead : lead;
+  int plain_len = lead < 0 ? n + 1 - lead : exp10 < 0 ? n + 1 : n + exp10;
+  int sci_len = n + (n > 1) + 1 + (lead < 0) + (abs_lead >= 100 ? 3
+                                                 : abs_lead >= 10 ? 2
+                                                                  : 1);
+
+  if ((lead >= -4 && lead < 7) || plain_len <= sci_len)
+  {
+    if (lead < 0)
+    {
+      out[len++] = '0';
+      out[len++] = '.';
+      for (int z = -1; z > lead; --z) { out[len++] = '0'; }
+    }
+    for (int d = n - 1; d >= 0; --d)
+    {
+      out[len++] = digits[d];
+      if (d > 0 && lead >= 0 && n - 1 - d == lead) { out[len++] = '.'; }
+    }
+    for (int z = 0; z < exp10; ++z) { out[len++] = '0'; }
+  }
+  else
+  {
+    out[len++] = digits[n - 1];
+    if (n > 1) { out[len++] = '.'; }
+    for (int d = n - 2; d >= 0; --d) { out[len++] = digits[d]; }
+    out[len++] = 'e';
+    if (lead < 0) { out[len++] = '-'; }
+    int e = abs_lead;
+    char exp_digits[4];
+    int k = 0;
+    for (; e != 0 || k == 0; e /= 10)
+    {
+      exp_digits[k++] = (char)('0' + e % 10);
+    }
+    while (k > 0) { out[len++] = exp_digits[--k]; }
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static double pow10i(int e)
+{
+  // dividing by the positive power keeps 0.1, 0.01... as close as they get
+  return e >= 0 ? pow(10, e) : 1 / pow(10, -e);
+}
+
+static int ticks_fit(const Tick *ticks, int n, int gap, int char_px)
+{
+  // neighbouring labels (centred on their ticks) have to clear each other
+  for (int i = 1; i < n; ++i)
+  {
+    int half_widths = char_px * (int)(strlen(ticks[i - 1].label) +
+                                      strlen(ticks[i].label)) / 2;
+    if (fabs(ticks[i].pos - ticks[i - 1].pos) < gap + half_widths)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int nice_ticks(double lo, double hi, AxisScale scale, double threshold,
+                      double min, double px, int gap, int char_px,
+                      Tick *ticks)
+{
+  // multiples of 1, 2 or 5 x 10^e over the values [lo, hi], the smallest
+  // step whose labels fit wins
+  double range = hi - lo;
+  if (!(range > 0) || !isfinite(range)) { return 0; }
+  static const int steps[] = {1, 2, 5};
+  int e = (int)floor(log10(range)) - 2;
+  for (int tries = 0; tries < 12; ++tries, ++e)
+  {
+    for (int s = 0; s < 3; ++s)
+    {
+      double step = steps[s] * pow10i(e);
+      double first = ceil(lo / step - 1e-9), last = floor(hi / step + 1e-9);
+      if (last - first + 1 > MAX_TICKS) { continue; }
+      if (fabs(first) > TICK_INDEX_LIMIT || fabs(last) > TICK_INDEX_LIMIT)
+      {
+        return 0;
+      }
+      int n = 0;
+      for (int64_t i = (int64_t)first; i <= (int64_t)last; ++i)
+      {
+        int64_t mant = i * steps[s];
+        double v = e >= 0 ? mant * pow10i(e) : mant / pow10i(-e);
+        if (scale == SCALE_LOG && v <= 0) { continue; }
+        ticks[n].pos = (axis_value(v, scale, threshold) - min) * px;
+        format_decimal(ticks[n].label, mant, e);
+        ++n;
+      }
+      if (ticks_fit(ticks, n, gap, char_px)) { return n; }
+    }
+  }
+  return 0;
+}
+
+static int decade_ticks(double min, double max, AxisScale scale,
+                        double threshold, double px, int gap, int char_px,
+                        Tick *ticks)
+{
+  // powers of ten (and their negatives and zero on a symlog axis), every
+  // stride-th decade so the labels fit. 0 if fewer than two land on the axis
+  int k0, k1;
+  if (scale == SCALE_LOG)
+  {
+    k0 = (int)ceil(min - 1e-9);
+    k1 = (int)floor(max + 1e-9);
+  }
+  else
+  {  // below the threshold the decades crowd into the linear part
+    double reach = fmax(fabs(min), fabs(max));
+    k0 = (int)ceil(log10(threshold) - 1e-9);
+    k1 = (int)floor(log10(axis_inverse(reach, scale, threshold)) + 1e-9);
+    while (k0 < k1 &&
+           axis_value(pow10i(k0), scale, threshold) * px < gap + 3 * char_px)
+    {  // too close to the 0 tick
+      ++k0;
+    }
+  }
+  if (k1 < k0) { return 0; }
+
+  static const int strides[] = {1, 2, 3, 5, 10, 20, 25, 50, 100};
+  for (size_t s = 0; s < sizeof strides / sizeof strides[0]; ++s)
+  {
+    int stride = strides[s];
+    int n = 0;
+    for (int side = -1; side <= 1; ++side)
+    {
+      if (scale == SCALE_LOG && side != 1) { continue; }
+      if (side == 0)
+      {
+        if (min <= 0 && max >= 0 && n < MAX_TICKS)
+        {
+          ticks[n].pos = (0 - min) * px;
+          format_decimal(ticks[n++].label, 0, 0);
+        }
+        continue;
+      }
+      // negatives run from the far end in so the list stays in order
+      for (int j = 0; j <= (k1 - k0) / stride; ++j)
+      {
+        int k = side < 0 ? k0 + ((k1 - k0) / stride - j) * stride
+                         : k0 + j * stride;
+        double u = axis_value(side * pow10i(k), scale, threshold);
+        if (u < min - 1e-9 || u > max + 1e-9) { continue; }
+        if (n == MAX_TICKS) { break; }
+        ticks[n].pos = (u - min) * px;
+        format_decimal(ticks[n++].label, side, k);
+      }
+    }
+    if (n < 2) { return 0; }
+    if (n < MAX_TICKS && ticks_fit(ticks, n, gap, char_px)) { return n; }
+  }
+  return 0;
+}
+
+int axis_ticks(double min, double max, AxisScale scale, double threshold,
+               int length, int gap, int char_px, Tick *ticks)
+{
+  // min/max are the axis bounds in scale units and length the pixels they
+  // span, positions come back in the same pixels
+  if (!isfinite(min) || !isfinite(max)) { return 0; }
+  if (max <= min)
+  {  // scale_chunk() puts a flat range in the middle, ticks go around it
+    double pad = min != 0 ? fabs(min) * 0.1 : 1;
+    min -= pad;
+    max += pad;
+  }
+  double px = length / (max - min);
+  if (scale == SCALE_LINEAR)
+  {
+    return nice_ticks(min, max, scale, threshold, min, px, gap, char_px,
+                      ticks);
+  }
+  int n = decade_ticks(min, max, scale, threshold, px, gap, char_px, ticks);
+  if (n >= 2) { return n; }
+  // less than two decades across, plain steps over the values instead
+  return nice_ticks(axis_inverse(min, scale, threshold),
+                    axis_inverse(max, scale, threshold), scale, threshold, min,
+                    px, gap, char_px, ticks);
+}
@@ -0,0 +1,406 @@
+#define _POSIX_C_SOURCE 200809L  // mkdir, sysconf
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#define make_dir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir((path), 0755)
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// slippy map tiles of an index - a tile is drawn like a small plot with no
+// frame whose axis bounds are its share of the data range. the index's
+// cells are the aggregate every level shares: near the top a tile covers
+// thousands of cells that mostly collapse to a stamp each, deep down it
+// reads the few cells under it point by point
+
+#define TILE_PATH_MAX 300
+
+_Thread_local TileFormat tile_kind = TILE_PNG;
+_Thread_local Colour32 tile_background = COLOR_WHITE;
+
+// USER FUNCTIONS
+void tile_format(TileFormat format, Colour32 background)
+{
+  tile_kind = format;
+  tile_background = background | 0xFF000000;  // tiles are opaque
+}
+
+// NON-USER FUNCTIONS
+static Canvas tile_canvas(int scale)
+{
+  // one tile's worth of canvas, the axis bounds span it exactly. an
+  // indexed one gets its colour buffer if a tile overflows the palette,
+  // and hit counts come with the first translucent series
+  int side = TILE_SIZE * scale;
+  Canvas c = {
+      .width = side,
+      .height = side,
+      .stride = side,
+      .scale = scale,
+      .clip = {0, 0, side - 1, side - 1},
+      .origin_x = 0,
+      .origin_y = side - 1,
+      .plot_px = TILE_SIZE,
+      .pad = 0,
+  };
+  if (indexed_on)
+  {
+    c.indices = trace_malloc((size_t)side * side);
+    c.palette = trace_malloc(sizeof *c.palette);
+    if (c.indices == NULL || c.palette == NULL)
+    {
+      printf("ERROR: not enough memory for a tile\n");
+      exit(1);
+    }
+  }
+  else { canvas_pixels(&c); }
+  return c;
+}
+
+static void free_canvas(Canvas *c)
+{
+  trace_free(c->pixels);
+  trace_free(c->counts);
+  trace_free(c->indices);
+  trace_free(c->palette);
+}
+
+static Bounds tile_world(const PlotIndex *index)
+{
+  // the range level 0's tile covers, in axis units
+  if (x_time != TIME_OFF)
+  {
+    printf("ERROR: tiles can't be drawn on a time axis\n");
+    exit(1);
+  }
+  Bounds world = index_bounds(index);
+  if (!(world.max_x > world.min_x))
+  {  // a flat range gets some room so it doesn't fill every tile
+    world.min_x -= 0.5;
+    world.max_x += 0.5;
+  }
+  if (!(world.max_y > world.min_y))
+  {
+    world.min_y -= 0.5;
+    world.max_y += 0.5;
+  }
+  return world;
+}
+
+static size_t render_tile(Canvas *c, const PlotIndex *index, Bounds world,
+                          int z, int tx, int ty)
+{
+  // draws tile (z, tx, ty), returns how many points landed on it
+  double tiles = ldexp(1, z);
+  double w = (world.max_x - world.min_x) / tiles;
+  double h = (world.max_y - world.min_y) / tiles;
+  Bounds b = {world.min_x + tx * w, world.min_x + (tx + 1) * w,
+              world.max_y - (ty + 1) * h, world.max_y - ty * h, false};
+  size_t pixels = (size_t)c->width * c->height;
+  if (c->palette != NULL)
+  {  // back to indices, whatever the last tile went over to
+    palette_reset(c->palette);
+    memset(c->indices, palette_index(c->palette, tile_background), pixels);
+  }
+  else
+  {
+    for (size_t i = 0; i < pixels; ++i) { c->pixels[i] = tile_background; }
+  }
+  if (series_colour >> 24 == 0) { return 0; }
+  size_t drawn = index_scatter(c, index, b, series_colour);
+  resolve_scatter(c, series_colour);
+  return drawn;
+}
+
+static int palette_indices(const uint8_t *rgb, size_t n, uint8_t *indices,
+                           Colour32 *palette)
+{
+  // indexes every pixel's colour, -1 as soon as there are more than 256.
+  // plots are long runs of one colour so the last one is checked first
+  uint32_t keys[512] = {0};  // 0 is free, every key has its alpha set
+  uint8_t slots[512];
+  int colours = 0;
+  uint32_t last = 0;
+  uint8_t last_index = 0;
+  for (size_t i = 0; i < n; ++i, rgb += 3)
+  {
+    uint32_t key = 0xFF000000 | rgb[0] | rgb[1] << 8 | rgb[2] << 16;
+    if (key != last)
+    {
+      uint32_t h = (key * 2654435761u) >> 23;
+      while (keys[h] != 0 && keys[h] != key) { h = (h + 1) & 511; }
+      if (keys[h] == 0)
+      {
+        if (colours == 256) { return -1; }
+        keys[h] = key;
+        slots[h] = (uint8_t)colours;
+        palette[colours++] = key;
+      }
+      last = key;
+      last_index = slots[h];
+    }
+    indices[i] = last_index;
+  }
+  return colours;
+}
+
+static bool write_tile(const Canvas *c, const char *path)
+{
+  // palette png when asked for and the tile has few enough colours, rgb
+  // png otherwise. an indexed tile at 1x has its palette already
+  uint8_t *encoded = NULL;
+  int len;
+  if (tile_kind == TILE_PALETTE && canvas_indexed(c) && c->scale == 1)
+  {
+    encoded = encode_palette_png(c->indices, TILE_SIZE, TILE_SIZE,
+                                 c->palette->colours, c->palette->count, &len);
+    bool ok = write_file(path, encoded, len);
+    trace_free(encoded);
+    return ok;
+  }
+  uint8_t *rgb = pack_rgb(c);
+  if (tile_kind == TILE_PALETTE)
+  {
+    uint8_t indices[TILE_SIZE * TILE_SIZE];
+    Colour32 palette[256];
+    int colours = palette_indices(rgb, TILE_SIZE * TILE_SIZE, indices,
+                                  palette);
+    if (colours > 0)
+    {
+      encoded = encode_palette_png(indices, TILE_SIZE, TILE_SIZE, palette,
+                                   colours, &len);
+    }
+  }
+  if (encoded == NULL)
+  {
+    encoded = encode_png(rgb, TILE_SIZE, TILE_SIZE, &len);
+  }
+  trace_free(rgb);
+  bool ok = write_file(path, encoded, len);
+  trace_free(encoded);
+  return ok;
+}
+
+static void check_dir(const char *path)
+{
+  if (make_dir(path) != 0 && errno != EEXIST)
+  {
+    printf("ERROR: couldn't make the folder %s\n", path);
+    exit(1);
+  }
+}
+
+void plot_tile(const PlotIndex *index, int z, int x, int y, const char *path)
+{
+  // one tile on its own - level z splits the range into 2^z x 2^z tiles,
+  // x counts from the left and y from the top
+  if (z < 0 || z > TILE_MAX_ZOOM || x < 0 || y < 0 || x >= 1 << z ||
+      y >= 1 << z)
+  {
+    printf("ERROR: there's no tile %d/%d/%d\n", z, x, y);
+    exit(1);
+  }
+  Bounds world = tile_world(index);
+  Canvas c = tile_canvas(aa_scale);
+  render_tile(&c, index, world, z, x, y);
+  bool ok = write_tile(&c, path);
+  free_canvas(&c);
+  if (!ok)
+  {
+    printf("ERROR: couldn't write %s - check the folder exists\n", path);
+    exit(1);
+  }
+  printf("-- tile %d/%d/%d saved as %s --\n", z, x, y, path);
+}
+
+typedef struct
+{
+  const PlotIndex *index;
+  const char *dir;
+  Bounds world;
+  int z;
+  const uint64_t *marked;  // tiles with a cell in reach, row by row
+  const PlotSettings *settings;  // the caller's, for the workers to draw with
+  atomic_int next_row;
+  atomic_size_t written;
+  atomic_bool failed;
+} TileLevel;
+
+static void *tile_worker(void *arg)
+{
+  // takes a row of tiles at a time until the level runs out, one canvas
+  // per worker is all the memory it holds on to
+  TileLevel *level = arg;
+  settings_load(level->settings);
+  const int side = 1 << level->z;
+  Canvas c = tile_canvas(aa_scale);
+  char path[TILE_PATH_MAX];
+  for (;;)
+  {
+    int ty = atomic_fetch_add(&level->next_row, 1);
+    if (ty >= side) { break; }
+    for (int tx = 0; tx < side; ++tx)
+    {
+      size_t t = (size_t)ty * side + tx;
+      if (!((level->marked[t >> 6] >> (t & 63)) & 1)) { continue; }
+      if (render_tile(&c, level->index, level->world, level->z, tx, ty) == 0)
+      {  // only the cells' boxes were in reach, no points
+        continue;
+      }
+      snprintf(path, sizeof path, "%s/%d/%d/%d.png", level->dir, level->z, tx,
+               ty);
+      if (write_tile(&c, path)) { atomic_fetch_add(&level->written, 1); }
+      else { atomic_store(&level->failed, true); }
+    }
+  }
+  free_canvas(&c);
+  return NULL;
+}
+
+static void mark_tiles(const PlotIndex *index, Bounds world, int z,
+                       uint64_t *marked)
+{
+  // sets the bit of every tile some non-empty cell's box (plus a marker)
+  // reaches, the rest are left out of the level
+  const int side = 1 << z;
+  const int cells = index->grid * index->grid;
+  double tile_w = (world.max_x - world.min_x) / side;
+  double tile_h = (world.max_y - world.min_y) / side;
+  double reach = (point_size + 1.0) / TILE_SIZE;  // in tiles
+  memset(marked, 0, ((size_t)side * side / 64 + 1) * sizeof *marked);
+  for (int i = 0; i < cells; ++i)
+  {
+    if (index->start[i] == index->start[i + 1]) { continue; }
+    Bounds box = index->boxes[i];
+    double u0 = axis_value(box.min_x, x_scale, symlog_linear);
+    double u1 = axis_value(box.max_x, x_scale, symlog_linear);
+    double v0 = axis_value(box.min_y, y_scale, symlog_linear);
+    double v1 = axis_value(box.max_y, y_scale, symlog_linear);
+    if (isnan(u1) || isnan(v1)) { continue; }  // nothing on a log axis
+    double left = isnan(u0) ? 0 : (u0 - world.min_x) / tile_w - reach;
+    double right = (u1 - world.min_x) / tile_w + reach;
+    double top = (world.max_y - v1) / tile_h - reach;
+    double bottom = isnan(v0) ? side : (world.max_y - v0) / tile_h + reach;
+    if (right < 0 || bottom < 0 || left >= side || top >= side) { continue; }
+    int x0 = left < 0 ? 0 : (int)left;
+    int y0 = top < 0 ? 0 : (int)top;
+    int x1 = right >= side ? side - 1 : (int)right;
+    int y1 = bottom >= side ? side - 1 : (int)bottom;
+    for (int ty = y0; ty <= y1; ++ty)
+    {
+      for (int tx = x0; tx <= x1; ++tx)
+      {
+        size_t t = (size_t)ty * side + tx;
+        marked[t >> 6] |= 1ull << (t & 63);
+      }
+    }
+  }
+}
+
+int cpu_count(void)
+{
+  // cores online, at least 1
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#endif
+}
+
+size_t plot_tiles(const PlotIndex *index, int max_zoom, const char *dir,
+                  int threads)
+{
+  // every level from 0 to max_zoom as dir/z/x/y.png, a level at a time with
+  // the tiles spread over the threads (0 for one per core). tiles no point
+  // reaches aren't written. returns how many were
+  if (max_zoom < 0 || max_zoom > TILE_PYRAMID_MAX_ZOOM)
+  {
+    printf("ERROR: tile pyramids go from zoom 0 up to %d\n",
+           TILE_PYRAMID_MAX_ZOOM);
+    exit(1);
+  }
+  if (strlen(dir) > TILE_PATH_MAX - 32)
+  {
+    printf("ERROR: tile folder path is too long\n");
+    exit(1);
+  }
+  if (threads < 1) { threads = cpu_count(); }
+  Bounds world = tile_world(index);
+  PlotSettings settings;
+  settings_save(&settings);
+  size_t most = ((size_t)1 << (2 * max_zoom)) / 64 + 1;
+  uint64_t *marked = trace_malloc(most * sizeof *marked);
+  pthread_t *workers = trace_malloc(threads * sizeof *workers);
+  if (marked == NULL || workers == NULL)
+  {
+    printf("ERROR: not enough memory for the tile pyramid\n");
+    exit(1);
+  }
+  char path[TILE_PATH_MAX];
+  check_dir(dir);
+  size_t written = 0;
+
+  for (int z = 0; z <= max_zoom; ++z)
+  {
+    mark_tiles(index, world, z, marked);
+    const int side = 1 << z;
+    snprintf(path, sizeof path, "%s/%d", dir, z);
+    check_dir(path);
+    for (int tx = 0; tx < side; ++tx)
+    {  // a column folder for every column with a tile in it
+      for (int ty = 0; ty < side; ++ty)
+      {
+        size_t t = (size_t)ty * side + tx;
+        if ((marked[t >> 6] >> (t & 63)) & 1)
+        {
+          snprintf(path, sizeof path, "%s/%d/%d", dir, z, tx);
+          check_dir(path);
+          break;
+        }
+      }
+    }
+
+    TileLevel level = {index, dir, world, z, marked, &settings, 0, 0, false};
+    int started = 0;
+    for (; started < threads - 1; ++started)
+    {
+      if (pthread_create(&workers[started], NULL, tile_worker, &level) != 0)
+      {  // fewer threads is fine, the rest of the work still gets done
+        break;
+      }
+    }
+    tile_worker(&level);
+    for (int i = 0; i < started; ++i) { pthread_join(workers[i], NULL); }
+    if (atomic_load(&level.failed))
+    {
+      printf("ERROR: couldn't write a tile under %s\n", dir);
+      exit(1);
+    }
+    written += atomic_load(&level.written);
+  }
+  trace_free(workers);
+  trace_free(marked);
+  printf("-- %zu tiles for zoom 0-%d saved under %s --\n", written, max_zoom,
+         dir);
+  return written;
+}
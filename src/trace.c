@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 199309L  // clock_gettime
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// stage tracing - a ring of the most recent stage events plus running
+// totals, all updated with relaxed atomics so plots on several threads can
+// record at once. each ring slot carries the number of the event in it,
+// cleared while the event is being written, so trace_dump() can run while
+// workers are still recording and leaves out whatever it catches half
+// written. with tracing off each hook is a single flag check.
+
+#define TRACE_CAPACITY 4096  // events kept for trace_dump()
+
+typedef struct
+{
+  atomic_uint_fast64_t seq;  // the event's number + 1, 0 while it's written
+  atomic_uint_fast64_t start_ns, dur_ns;
+  atomic_uint_fast64_t who;  // thread id << 32 | stage
+} TraceEvent;
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    [TRACE_PLOT] = "plot",
+    [TRACE_BOUNDS] = "bounds",
+    [TRACE_BACKGROUND] = "background_border",
+    [TRACE_GRID] = "grid",
+    [TRACE_TEXT] = "text",
+    [TRACE_SCATTER] = "scatter",
+    [TRACE_PACK] = "rgb_pack",
+    [TRACE_ENCODE] = "encode",
+    [TRACE_WRITE] = "write",
+};
+
+static atomic_bool trace_on;
+static _Atomic uint64_t trace_epoch;
+static TraceEvent events[TRACE_CAPACITY];
+static atomic_uint_fast64_t event_count;
+static atomic_uint_fast64_t stage_ns[TRACE_STAGE_COUNT];
+static atomic_uint_fast64_t stage_calls[TRACE_STAGE_COUNT];
+static atomic_uint_fast64_t counters[COUNTER_COUNT];
+static atomic_uint_fast64_t next_tid = 1;
+static _Thread_local uint32_t thread_id;
+
+// heap accounting runs whether tracing is on or not so a block allocated
+// before trace() is still balanced when it gets freed
+static atomic_uint_fast64_t heap_bytes;
+static atomic_uint_fast64_t heap_peak;
+static atomic_uint_fast64_t allocations;
+
+#define RELAXED memory_order_relaxed
+
+uint64_t trace_now_ns(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// USER FUNCTIONS
+void trace(bool on)
+{
+  uint64_t unset = 0;
+  if (on)
+  {  // the first trace() starts the clock, trace_reset() restarts it
+    atomic_compare_exchange_strong(&trace_epoch, &unset, trace_now_ns());
+  }
+  atomic_store(&trace_on, on);
+}
+
+void trace_reset(void)
+{
+  atomic_store(&event_count, 0);
+  for (int s = 0; s < TRACE_STAGE_COUNT; ++s)
+  {
+    atomic_store(&stage_ns[s], 0);
+    atomic_store(&stage_calls[s], 0);
+  }
+  for (int c = 0; c < COUNTER_COUNT; ++c) { atomic_store(&counters[c], 0); }
+  atomic_store(&heap_peak, atomic_load(&heap_bytes));
+  atomic_store(&allocations, 0);
+  atomic_store(&trace_epoch, trace_now_ns());
+}
+
+TraceStats trace_stats(void)
+{
+  TraceStats stats;
+  for (int s = 0; s < TRACE_STAGE_COUNT; ++s)
+  {
+    stats.stage_ns[s] = atomic_load_explicit(&stage_ns[s], RELAXED);
+    stats.stage_calls[s] = atomic_load_explicit(&stage_calls[s], RELAXED);
+  }
+  stats.points_in = atomic_load_explicit(&counters[COUNT_POINTS_IN], RELAXED);
+  stats.points_drawn =
+      atomic_load_explicit(&counters[COUNT_POINTS_DRAWN], RELAXED);
+  stats.points_culled =
+      atomic_load_explicit(&counters[COUNT_POINTS_CULLED], RELAXED);
+  stats.deflate_in_bytes =
+      atomic_load_explicit(&counters[COUNT_DEFLATE_IN], RELAXED);
+  stats.encoded_bytes = atomic_load_explicit(&counters[COUNT_ENCODED], RELAXED);
+  stats.heap_bytes = atomic_load_explicit(&heap_bytes, RELAXED);
+  stats.heap_peak_bytes = atomic_load_explicit(&heap_peak, RELAXED);
+  stats.allocations = atomic_load_explicit(&allocations, RELAXED);
+  return stats;
+}
+
+const char *trace_stage_name(TraceStage stage)
+{
+  return stage < TRACE_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+int trace_dump(const char *path)
+{
+  // writes the recorded events in chrome's trace event format (load it in
+  // chrome://tracing or perfetto), returns 0 on success
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+  {
+    printf("ERROR: couldn't open %s for the trace dump\n", path);
+    return -1;
+  }
+  uint64_t count = atomic_load(&event_count);
+  uint64_t first = count > TRACE_CAPACITY ? count - TRACE_CAPACITY : 0;
+  uint64_t epoch = atomic_load(&trace_epoch);
+  uint64_t last_ns = 0;
+  uint64_t written = 0;
+
+  fprintf(f, "{\"traceEvents\": [");
+  for (uint64_t i = first; i < count; ++i)
+  {
+    TraceEvent *slot = &events[i % TRACE_CAPACITY];
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    uint64_t start_ns = atomic_load_explicit(&slot->start_ns, RELAXED);
+    uint64_t dur = atomic_load_explicit(&slot->dur_ns, RELAXED);
+    uint64_t who = atomic_load_explicit(&slot->who, RELAXED);
+    atomic_thread_fence(memory_order_acquire);
+    if (seq != i + 1 || atomic_load_explicit(&slot->seq, RELAXED) != seq)
+    {  // still being written, or already written over by a later event
+      continue;
+    }
+    uint64_t start = start_ns > epoch ? start_ns - epoch : 0;
+    if (start + dur > last_ns) { last_ns = start + dur; }
+    fprintf(f,
+            "%s\n  {\"name\": \"%s\", \"cat\": \"plot\", \"ph\": \"X\", "
+            "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}",
+            written++ == 0 ? "" : ",", stage_names[who & 0xFFFFFFFF],
+            start / 1000.0, dur / 1000.0, (unsigned)(who >> 32));
+  }
+
+  TraceStats s = trace_stats();
+  fprintf(f,
+          "%s\n  {\"name\": \"heap\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, "
+          "\"args\": {\"live\": %llu, \"peak\": %llu}}",
+          written > 0 ? "," : "", last_ns / 1000.0,
+          (unsigned long long)s.heap_bytes,
+          (unsigned long long)s.heap_peak_bytes);
+  fprintf(f,
+          "\n], \"otherData\": {\"points_in\": %llu, \"points_drawn\": %llu, "
+          "\"points_culled\": %llu, \"deflate_in_bytes\": %llu, "
+          "\"encoded_bytes\": %llu, \"heap_peak_bytes\": %llu, "
+          "\"allocations\": %llu, \"events_dropped\": %llu}}\n",
+          (unsigned long long)s.points_in, (unsigned long long)s.points_drawn,
+          (unsigned long long)s.points_culled,
+          (unsigned long long)s.deflate_in_bytes,
+          (unsigned long long)s.encoded_bytes,
+          (unsigned long long)s.heap_peak_bytes,
+          (unsigned long long)s.allocations,
+          (unsigned long long)(count - written));
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+// NON-USER FUNCTIONS
+uint64_t trace_begin(void)
+{
+  if (!atomic_load_explicit(&trace_on, RELAXED)) { return 0; }
+  return trace_now_ns();
+}
+
+void trace_end(TraceStage stage, uint64_t start)
+{
+  if (start == 0) { return; }  // tracing was off when the stage began
+  uint64_t dur = trace_now_ns() - start;
+  if (thread_id == 0)
+  {
+    thread_id = (uint32_t)atomic_fetch_add_explicit(&next_tid, 1, RELAXED);
+  }
+  uint64_t n = atomic_fetch_add_explicit(&event_count, 1, RELAXED);
+  TraceEvent *slot = &events[n % TRACE_CAPACITY];
+  atomic_store_explicit(&slot->seq, 0, RELAXED);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&slot->start_ns, start, RELAXED);
+  atomic_store_explicit(&slot->dur_ns, dur, RELAXED);
+  atomic_store_explicit(&slot->who, (uint64_t)thread_id << 32 | stage,
+                        RELAXED);
+  atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+  atomic_fetch_add_explicit(&stage_ns[stage], dur, RELAXED);
+  atomic_fetch_add_explicit(&stage_calls[stage], 1, RELAXED);
+}
+
+void trace_count(TraceCounter counter, uint64_t amount)
+{
+  if (!atomic_load_explicit(&trace_on, RELAXED)) { return; }
+  atomic_fetch_add_explicit(&counters[counter], amount, RELAXED);
+}
+
+// tracking allocator - every block carries its size in front so frees can
+// be subtracted without a lookup
+typedef union
+{
+  size_t size;
+  max_align_t align;
+} AllocHeader;
+
+static void heap_add(uint64_t size)
+{
+  uint64_t now = atomic_fetch_add_explicit(&heap_bytes, size, RELAXED) + size;
+  uint64_t peak = atomic_load_explicit(&heap_peak, RELAXED);
+  while (now > peak && !atomic_compare_exchange_weak_explicit(
+                           &heap_peak, &peak, now, RELAXED, RELAXED))
+  {
+  }
+}
+
+void *trace_malloc(size_t size)
+{
+  AllocHeader *h = malloc(sizeof *h + size);
+  if (h == NULL) { return NULL; }
+  h->size = size;
+  heap_add(size);
+  atomic_fetch_add_explicit(&allocations, 1, RELAXED);
+  return h + 1;
+}
+
+void *trace_realloc(void *p, size_t size)
+{
+  if (p == NULL) { return trace_malloc(size); }
+  AllocHeader *h = (AllocHeader *)p - 1;
+  size_t old = h->size;
+  h = realloc(h, sizeof *h + size);
+  if (h == NULL) { return NULL; }
+  h->size = size;
+  atomic_fetch_sub_explicit(&heap_bytes, old, RELAXED);
+  heap_add(size);
+  atomic_fetch_add_explicit(&allocations, 1, RELAXED);
+  return h + 1;
+}
+
+void trace_free(void *p)
+{
+  if (p == NULL) { return; }
+  AllocHeader *h = (AllocHeader *)p - 1;
+  atomic_fetch_sub_explicit(&heap_bytes, h->size, RELAXED);
+  free(h);
+}
@@ -0,0 +1,160 @@
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// axis scales - values are transformed in place right after a chunk is
+// loaded so the bounds pass, the scatter pass and scale_chunk() all work in
+// transformed units. anything with no place on the axis turns into NaN and
+// gets skipped like a null.
+
+// log10 splits v into m * 2^e with m in [sqrt(1/2), sqrt(2)) and takes
+// ln(m) = 2 atanh(s), s = (m - 1) / (m + 1). |s| < 0.172 there, so the series
+// up to s^9 is off by under 1e-9 - far below a pixel at any zoom.
+#define LOG10_2 0.30102999566398119521
+#define LOG10_E 0.43429448190325182765
+#define SQRT_2 1.41421356237309504880
+#define MANTISSA_BITS 0x000FFFFFFFFFFFFFull
+#define ONE_BITS 0x3FF0000000000000ull
+
+static inline double fast_log10(double v)
+{
+  // zero, negatives, NaN, subnormals and inf go through the libm log10
+  if (!(v >= DBL_MIN) || v > DBL_MAX) { return v > 0 ? log10(v) : NAN; }
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof bits);
+  int e = (int)(bits >> 52) - 1023;
+  bits = (bits & MANTISSA_BITS) | ONE_BITS;
+  double m;
+  memcpy(&m, &bits, sizeof m);
+  if (m > SQRT_2)
+  {
+    m *= 0.5;
+    ++e;
+  }
+  double s = (m - 1) / (m + 1), s2 = s * s;
+  double p = 2.0 / 9;
+  p = p * s2 + 2.0 / 7;
+  p = p * s2 + 2.0 / 5;
+  p = p * s2 + 2.0 / 3;
+  p = p * s2 + 2;
+  double ln_m = p * s;
+  return e * LOG10_2 + ln_m * LOG10_E;
+}
+
+static inline double symlog(double v, double inv_threshold)
+{
+  // log10(1 + |v| / threshold) with v's sign - linear near zero, log further
+  // out, and defined everywhere
+  return copysign(fast_log10(1 + fabs(v) * inv_threshold), v);
+}
+
+#ifdef __SSE2__
+static inline __m128d log10_pd(__m128d v)
+{
+  // fast_log10 on two lanes, both have to be normal positive numbers
+  const __m128d one = _mm_set1_pd(1);
+  __m128i bits = _mm_castpd_si128(v);
+  __m128i e = _mm_shuffle_epi32(_mm_srli_epi64(bits, 52),
+                                _MM_SHUFFLE(3, 1, 2, 0));
+  __m128d exponent = _mm_sub_pd(_mm_cvtepi32_pd(e), _mm_set1_pd(1023));
+  __m128d m = _mm_castsi128_pd(
+      _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi64x(MANTISSA_BITS)),
+                   _mm_set1_epi64x(ONE_BITS)));
+  __m128d big = _mm_cmpgt_pd(m, _mm_set1_pd(SQRT_2));
+  m = _mm_sub_pd(m, _mm_and_pd(big, _mm_mul_pd(m, _mm_set1_pd(0.5))));
+  exponent = _mm_add_pd(exponent, _mm_and_pd(big, one));
+
+  __m128d s = _mm_div_pd(_mm_sub_pd(m, one), _mm_add_pd(m, one));
+  __m128d s2 = _mm_mul_pd(s, s);
+  __m128d p = _mm_set1_pd(2.0 / 9);
+  p = _mm_add_pd(_mm_mul_pd(p, s2), _mm_set1_pd(2.0 / 7));
+  p = _mm_add_pd(_mm_mul_pd(p, s2), _mm_set1_pd(2.0 / 5));
+  p = _mm_add_pd(_mm_mul_pd(p, s2), _mm_set1_pd(2.0 / 3));
+  p = _mm_add_pd(_mm_mul_pd(p, s2), _mm_set1_pd(2));
+  __m128d ln_m = _mm_mul_pd(p, s);
+  return _mm_add_pd(_mm_mul_pd(exponent, _mm_set1_pd(LOG10_2)),
+                    _mm_mul_pd(ln_m, _mm_set1_pd(LOG10_E)));
+}
+
+static inline int all_normal(__m128d v)
+{
+  __m128d ok = _mm_and_pd(_mm_cmpge_pd(v, _mm_set1_pd(DBL_MIN)),
+                          _mm_cmple_pd(v, _mm_set1_pd(DBL_MAX)));
+  return _mm_movemask_pd(ok) == 3;
+}
+#endif
+
+void transform_chunk(double *v, size_t n, AxisScale scale, double threshold)
+{
+  size_t i = 0;
+  if (scale == SCALE_LOG)
+  {
+#ifdef __SSE2__
+    for (; i + 2 <= n; i += 2)
+    {
+      __m128d x = _mm_loadu_pd(v + i);
+      if (!all_normal(x))
+      {  // a non-positive or special value somewhere, do the pair one by one
+        v[i] = fast_log10(v[i]);
+        v[i + 1] = fast_log10(v[i + 1]);
+        continue;
+      }
+      _mm_storeu_pd(v + i, log10_pd(x));
+    }
+#endif
+    for (; i < n; ++i) { v[i] = fast_log10(v[i]); }
+  }
+  else if (scale == SCALE_SYMLOG)
+  {
+    double inv_threshold = 1 / threshold;
+#ifdef __SSE2__
+    const __m128d sign = _mm_set1_pd(-0.0);
+    for (; i + 2 <= n; i += 2)
+    {
+      __m128d x = _mm_loadu_pd(v + i);
+      __m128d u = _mm_add_pd(
+          _mm_set1_pd(1), _mm_mul_pd(_mm_andnot_pd(sign, x),
+                                     _mm_set1_pd(inv_threshold)));
+      if (!all_normal(u))
+      {  // NaN or too big to take apart
+        v[i] = symlog(v[i], inv_threshold);
+        v[i + 1] = symlog(v[i + 1], inv_threshold);
+        continue;
+      }
+      _mm_storeu_pd(v + i, _mm_or_pd(log10_pd(u), _mm_and_pd(sign, x)));
+    }
+#endif
+    for (; i < n; ++i) { v[i] = symlog(v[i], inv_threshold); }
+  }
+}
+
+double axis_value(double v, AxisScale scale, double threshold)
+{
+  // transform_chunk() for one value, with libm's log10
+  if (scale == SCALE_LOG) { return v > 0 ? log10(v) : NAN; }
+  if (scale == SCALE_SYMLOG)
+  {
+    return copysign(log10(1 + fabs(v) / threshold), v);
+  }
+  return v;
+}
+
+double axis_inverse(double u, AxisScale scale, double threshold)
+{
+  // back from axis units to data values
+  if (scale == SCALE_LOG) { return pow(10, u); }
+  if (scale == SCALE_SYMLOG)
+  {
+    return copysign(threshold * (pow(10, fabs(u)) - 1), u);
+  }
+  return u;
+}
@@ -0,0 +1,139 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+// a zlib stream that only knows runs - bytes repeating the ones period
+// bytes back (the pixel to the left) or a row back (the pixel above) become
+// matches, everything else is a literal, all with deflate's fixed huffman
+// codes. plot images are long runs of a few colours, so this gets close to
+// real deflate at a fraction of the work (stb's searches a whole hash
+// bucket at every byte of a flat row)
+
+typedef struct
+{
+  uint8_t *out;
+  size_t len;
+  uint64_t bits;
+  int count;
+} BitWriter;
+
+static inline void put_bits(BitWriter *w, uint32_t value, int n)
+{
+  // deflate packs from the low bit up
+  w->bits |= (uint64_t)value << w->count;
+  w->count += n;
+  while (w->count >= 8)
+  {
+    w->out[w->len++] = (uint8_t)w->bits;
+    w->bits >>= 8;
+    w->count -= 8;
+  }
+}
+
+static inline void put_code(BitWriter *w, uint32_t code, int n)
+{
+  // huffman codes go in from their top bit
+  uint32_t reversed = 0;
+  for (int i = 0; i < n; ++i) { reversed |= ((code >> i) & 1) << (n - 1 - i); }
+  put_bits(w, reversed, n);
+}
+
+static void put_symbol(BitWriter *w, int symbol)
+{
+  // the fixed literal/length code
+  if (symbol < 144) { put_code(w, 0x30 + symbol, 8); }
+  else if (symbol < 256) { put_code(w, 0x190 + symbol - 144, 9); }
+  else if (symbol < 280) { put_code(w, symbol - 256, 7); }
+  else { put_code(w, 0xC0 + symbol - 280, 8); }
+}
+
+static const uint16_t length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                         1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                         4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+static const uint16_t distance_base[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+
+static void put_match(BitWriter *w, int length, int distance)
+{
+  // length 3-258 at distance 1-32768
+  int code = 28;
+  while (length_base[code] > length) { --code; }
+  put_symbol(w, 257 + code);
+  put_bits(w, length - length_base[code], length_extra[code]);
+  code = 29;
+  while (distance_base[code] > distance) { --code; }
+  put_code(w, code, 5);
+  put_bits(w, distance - distance_base[code], code < 4 ? 0 : code / 2 - 1);
+}
+
+static inline size_t run_length(const uint8_t *p, size_t most, size_t back)
+{
+  size_t run = 0;
+  while (run < most && p[run] == p[(ptrdiff_t)(run - back)]) { ++run; }
+  return run;
+}
+
+uint8_t *zlib_rle(const uint8_t *data, size_t len, int period, int row,
+                  size_t *out_len)
+{
+  // period is the bytes per pixel and row the bytes per scanline (0 for
+  // none, at most 32768). free the result with trace_free()
+  size_t cap = len + len / 8 + 64;  // 9 bits a literal at worst
+  BitWriter w = {trace_malloc(cap), 0, 0, 0};
+  if (w.out == NULL) { return NULL; }
+  w.out[w.len++] = 0x78;  // deflate, 32k window
+  w.out[w.len++] = 0x01;  // no dictionary, header check bits
+  put_bits(&w, 1, 1);     // the only block
+  put_bits(&w, 1, 2);     // fixed codes
+
+  size_t i = 0;
+  while (i < len)
+  {
+    size_t most = len - i < 258 ? len - i : 258;
+    size_t left = 0, up = 0;
+    if (i >= (size_t)period) { left = run_length(data + i, most, period); }
+    if (row > 0 && i >= (size_t)row && left < most)
+    {
+      up = run_length(data + i, most, row);
+    }
+    if (left >= 3 && left >= up)
+    {
+      put_match(&w, (int)left, period);
+      i += left;
+    }
+    else if (up >= 3)
+    {
+      put_match(&w, (int)up, row);
+      i += up;
+    }
+    else { put_symbol(&w, data[i++]); }
+  }
+  put_symbol(&w, 256);  // end of block
+  if (w.count > 0) { put_bits(&w, 0, 8 - w.count); }
+
+  uint32_t a = 1, b = 0;  // adler-32, reduced often enough not to overflow
+  for (size_t k = 0; k < len;)
+  {
+    size_t end = len - k < 5552 ? len : k + 5552;
+    for (; k < end; ++k)
+    {
+      a += data[k];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  uint32_t adler = b << 16 | a;
+  for (int s = 24; s >= 0; s -= 8) { w.out[w.len++] = (uint8_t)(adler >> s); }
+  *out_len = w.len;
+  return w.out;
+}
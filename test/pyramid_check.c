@@ -0,0 +1,68 @@
+// pyramid_range() against a plain scan of the samples, after appends that
+// grow the file by one doubling and by several at once. prints the first
+// range that disagrees and exits 1, run with make check
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "plotting.h"
+#include "plotting_internal.h"
+
+#define SAMPLES 11500
+
+static int64_t t[SAMPLES];
+static double v[SAMPLES];
+
+static int check(const TimePyramid *p, size_t begin, size_t end)
+{
+  double min = INFINITY, max = -INFINITY;
+  for (size_t i = begin; i < end; ++i)
+  {
+    if (isnan(v[i])) { continue; }
+    if (v[i] < min) { min = v[i]; }
+    if (v[i] > max) { max = v[i]; }
+  }
+  MinMax m = pyramid_range(p, begin, end);
+  if (m.min != min || m.max != max)
+  {
+    printf("FAIL: range [%zu, %zu) gave %g/%g, expected %g/%g\n", begin, end,
+           m.min, m.max, min, max);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  const char *path = "pyramid_check.tmp";
+  remove(path);
+  for (size_t i = 0; i < SAMPLES; ++i)
+  {
+    t[i] = (int64_t)i;
+    v[i] = i % 97 == 0 ? NAN : 1000 + (double)((i * 7919) % 3001);
+  }
+  TimePyramid *p = pyramid_open(path);
+  // a small append, one that doubles, then one that grows it 8x
+  const size_t steps[] = {700, 1500, SAMPLES};
+  size_t done = 0;
+  int failed = 0;
+  for (size_t s = 0; s < sizeof steps / sizeof *steps; ++s)
+  {
+    pyramid_append(p, t + done, v + done, steps[s] - done);
+    done = steps[s];
+    for (size_t size = 1; size <= done && !failed; size = size * 3 + 1)
+    {
+      for (size_t begin = 0; begin + size <= done && !failed; begin += 37)
+      {
+        failed |= check(p, begin, begin + size);
+      }
+    }
+    failed |= check(p, 0, done);
+  }
+  pyramid_close(p);
+  remove(path);
+  if (failed) { return 1; }
+  printf("pyramid ranges OK\n");
+  return 0;
+}